@@ -0,0 +1,165 @@
+/*
+ * cache.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Byte-bounded LRU cache of file contents for hot GETs
+ */
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_BUCKETS 1024              // Hash buckets, a power of two
+#define CACHE_EPOCHS 256                // Invalidation counters, shared by paths hashing alike
+#define DEFAULT_CACHE_CAPACITY (64 << 20) // Bytes of file data kept by default
+#define CACHE_MAX_ENTRY (1 << 20)       // Largest file worth caching
+#define CHECKSUM_SLOTS 4096             // Remembered whole-file CRC32Cs, a power of two
+
+// Type:        cache_entry_t
+// --------------------------
+// One cached file. Entries are reference counted so a GET can keep sending
+// from one after it has been evicted or invalidated; the last release frees it.
+typedef struct cache_entry {
+    char *path;
+    uint64_t hash;
+    char *data;
+    size_t size;
+    uint64_t version; // file_version of the cached contents
+    uint32_t checksum; // CRC32C of the whole contents, so checksummed hits needn't recompute it
+    int refs; // Holders, plus one while the entry is in the cache
+
+    struct cache_entry *lru_prev; // Towards more recently used
+    struct cache_entry *lru_next; // Towards less recently used
+    struct cache_entry *next;     // Next entry in the same bucket
+} cache_entry_t;
+
+// Type:        cache_stats_t
+// --------------------------
+// Counters describing cache effectiveness
+typedef struct cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;     // Entries pushed out to make room
+    unsigned long invalidations; // Entries dropped because the file changed
+    size_t bytes;                // File data currently cached
+    unsigned long entries;
+    unsigned long checksum_hits;   // Checksummed GETs that could skip reading the file
+    unsigned long checksum_misses;
+} cache_stats_t;
+
+// Type:        checksum_slot_t
+// ----------------------------
+// CRC32C of one version of a whole file, version 0 when empty
+typedef struct checksum_slot {
+    uint64_t version;
+    uint64_t size;
+    uint32_t checksum;
+} checksum_slot_t;
+
+// Type:        content_cache_t
+// ----------------------------
+// Hash table of cache entries with an LRU list, guarded by one mutex
+typedef struct content_cache {
+    cache_entry_t *buckets[CACHE_BUCKETS];
+    cache_entry_t *lru_head; // Most recently used
+    cache_entry_t *lru_tail; // Next to be evicted
+    uint64_t epochs[CACHE_EPOCHS];
+    checksum_slot_t checksums[CHECKSUM_SLOTS]; // Direct mapped by version
+    size_t capacity;
+    size_t max_entry;
+    cache_stats_t stats;
+    pthread_mutex_t lock;
+} content_cache_t;
+
+extern content_cache_t content_cache;
+
+// Function:    cache_init
+// -----------------------
+// Prepares the cache
+//
+// capacity:    bytes of file data to keep, 0 disables caching
+void cache_init(size_t capacity);
+
+// Function:    cache_admits
+// -------------------------
+// Checks whether a file of this size is worth reading into the cache
+//
+// returns 1 if it would be cached, 0 otherwise
+int cache_admits(uint64_t size);
+
+// Function:    cache_lookup
+// -------------------------
+// Finds a cached file and marks it most recently used, provided it still
+// holds the version on disk. A stale entry, left behind by a change the
+// cache never saw, is dropped and counts as a miss.
+//
+// path:        file path as requested
+// version:     file_version of the file now, 0 if it's gone
+//
+// returns referenced entry to pass to cache_release, NULL on a miss
+cache_entry_t *cache_lookup(const char *path, uint64_t version);
+
+// Function:    cache_release
+// --------------------------
+// Drops a reference taken by cache_lookup
+void cache_release(cache_entry_t *entry);
+
+// Function:    cache_epoch
+// ------------------------
+// Reads the invalidation counter covering a path; take it before reading the
+// file and hand it to cache_insert
+//
+// returns current epoch for path
+uint64_t cache_epoch(const char *path);
+
+// Function:    cache_insert
+// -------------------------
+// Adds file contents read by a GET, evicting least recently used entries to
+// make room. Skipped if the path was invalidated since epoch was taken, so a
+// reader that raced a WRITE can't cache the old contents.
+//
+// path:        file path as requested
+// data:        malloc'd contents, owned by the cache afterwards
+// size:        bytes in data
+// version:     file_version of the file read
+// checksum:    CRC32C of the whole contents
+// epoch:       value of cache_epoch(path) from before the file was read
+void cache_insert(const char *path, char *data, size_t size, uint64_t version, uint32_t checksum, uint64_t epoch);
+
+// Function:    cache_invalidate
+// -----------------------------
+// Drops a path after the file changed (WRITE) or disappeared (RM)
+void cache_invalidate(const char *path);
+
+// Function:    checksum_lookup
+// ----------------------------
+// Finds the CRC32C of a whole file computed by an earlier GET. Versions
+// change whenever a file is replaced, so entries never need invalidating.
+//
+// version:     file_version of the file
+// size:        bytes in the file
+// checksum:    receives the CRC32C on a hit
+//
+// returns 1 on a hit, 0 on a miss
+int checksum_lookup(uint64_t version, uint64_t size, uint32_t *checksum);
+
+// Function:    checksum_insert
+// ----------------------------
+// Remembers the CRC32C of a whole file, replacing whatever shared its slot
+void checksum_insert(uint64_t version, uint64_t size, uint32_t checksum);
+
+// Function:    get_cache_stats
+// ----------------------------
+// Copies the cache counters
+void get_cache_stats(cache_stats_t *stats);
+
+// Function:    cache_cleanup
+// --------------------------
+// Frees every entry no longer referenced
+void cache_cleanup(void);
+
+#endif // CACHE_H
@@ -0,0 +1,35 @@
+/*
+ * crc32c.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * CRC32C (Castagnoli) checksums for end-to-end transfer integrity
+ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Function:    crc32c
+// -------------------
+// Extends a CRC32C over more bytes. Start with 0; checksumming a buffer in
+// pieces gives the same result as checksumming it whole. Uses the SSE4.2
+// crc32 instruction over three interleaved lanes, joined with PCLMULQDQ,
+// when the CPU has them, and a slicing-by-8 table otherwise.
+//
+// crc: checksum of the bytes so far
+// data/len: next bytes
+//
+// returns checksum including data
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+// Function:    crc32c_implementation
+// ----------------------------------
+// Names the kernel crc32c picked for this CPU
+//
+// returns "sse4.2+pclmul", "sse4.2" or "table"
+const char *crc32c_implementation(void);
+
+#endif // CRC32C_H
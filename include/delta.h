@@ -0,0 +1,158 @@
+/*
+ * delta.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Rolling-checksum deltas for uploads that rewrite part of a file
+ */
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define DELTA_MIN_BLOCK 2048        // Smallest block signatures are taken over
+#define DELTA_MAX_BLOCK (1 << 17)   // Largest block signatures are taken over
+#define DELTA_MAX_LITERAL (1 << 16) // Longest run of new bytes in one DATA instruction
+
+// Signature stream
+// ----------------
+// Sent by the server after the response to a SIGNATURE request:
+//
+//   | block size (4) | block count (8) | per block: weak (4) | strong (8) |
+//
+// Only whole blocks of the server's copy are listed.
+#define SIGNATURE_HEADER_SIZE 12
+#define SIGNATURE_ENTRY_SIZE 12
+
+// Delta stream
+// ------------
+// Sent by the client after a DELTA request header, size bytes in all:
+//
+//   | base version (8) | block size (4) | instructions... |
+//
+// COPY:  | 1 | first block (8) | block count (4) |    blocks of the server's copy
+// DATA:  | 2 | length (4) | bytes (length) |           new bytes
+// END:   | 3 | new size (8) | digest (8) |             rebuilt file must match
+#define DELTA_HEADER_SIZE 12
+#define DELTA_COPY 1
+#define DELTA_DATA 2
+#define DELTA_END  3
+
+// Type:        block_signature_t
+// ------------------------------
+// Checksums of one block of the server's copy
+typedef struct block_signature {
+    uint32_t weak;   // Rolling checksum, cheap to slide along the new file
+    uint64_t strong; // Confirms a weak match
+} block_signature_t;
+
+// Type:        signature_t
+// ------------------------
+// Decoded signature of the server's copy of a file
+typedef struct signature {
+    uint32_t block_size;
+    uint64_t count;
+    block_signature_t *blocks;
+} signature_t;
+
+// Function:    delta_block_size
+// -----------------------------
+// Picks the signature block size for a file, about the square root of its size
+//
+// returns block size in bytes
+uint32_t delta_block_size(uint64_t file_size);
+
+// Function:    weak_checksum
+// --------------------------
+// rsync-style rolling checksum of a block
+//
+// returns checksum, low 16 bits the byte sum and high 16 bits the weighted sum
+uint32_t weak_checksum(const unsigned char *data, size_t len);
+
+// Function:    roll_checksum
+// --------------------------
+// Slides a weak checksum one byte along
+//
+// sum: checksum of the len bytes starting at out
+// out: byte leaving the window
+// in: byte entering the window
+// len: window length
+//
+// returns checksum of the window one byte further on
+uint32_t roll_checksum(uint32_t sum, unsigned char out, unsigned char in, size_t len);
+
+// Function:    strong_checksum
+// ----------------------------
+// 64-bit hash of a block, the same on every platform
+//
+// returns hash
+uint64_t strong_checksum(const void *data, size_t len);
+
+// Function:    signature_size
+// ---------------------------
+// Bytes in the signature stream of a file
+//
+// returns size of the stream
+uint64_t signature_size(uint64_t file_size);
+
+// Function:    send_signature
+// ---------------------------
+// Checksums every whole block of a file and streams the signature
+//
+// fd: file to sign
+// file_size: bytes in the file
+// socket_desc: destination socket
+//
+// returns 0 on success, -1 on file read errors, 1 for connection errors
+int send_signature(int fd, uint64_t file_size, int socket_desc);
+
+// Function:    receive_signature
+// ------------------------------
+// Reads and decodes a signature stream
+//
+// socket_desc: origin socket
+// size: bytes in the stream, as announced by the server
+// signature: signature_t to populate, released with free_signature
+//
+// returns 0 on success, -1 on a malformed stream (the rest is drained), 1 for connection errors
+int receive_signature(int socket_desc, uint64_t size, signature_t *signature);
+
+// Function:    free_signature
+// ---------------------------
+// Releases a decoded signature
+void free_signature(signature_t *signature);
+
+// Function:    make_delta
+// -----------------------
+// Writes the delta turning the signed copy into data
+//
+// data/size: new contents of the file
+// signature: signature of the server's copy
+// base_version: file version the signature was taken from
+// out: stream receiving the delta
+//
+// returns 0 on success, -1 on write errors or allocation failure
+int make_delta(const unsigned char *data, uint64_t size, const signature_t *signature,
+               uint64_t base_version, FILE *out);
+
+// Function:    apply_delta
+// ------------------------
+// Rebuilds a file from its previous version and a delta read off a socket
+//
+// base_fd: previous version of the file
+// base_size: bytes in base_fd
+// base_version: file version of base_fd
+// out_fd: receives the rebuilt file from offset 0
+// socket_desc: origin socket
+// delta_size: bytes in the delta stream
+// consumed: receives the number of delta bytes read, so the caller can drain the rest
+//
+// returns 0 on success, -1 on a file error or malformed delta, 1 for connection
+// errors, 2 if the delta was made against another version of the file
+int apply_delta(int base_fd, uint64_t base_size, uint64_t base_version, int out_fd,
+                int socket_desc, uint64_t delta_size, uint64_t *consumed);
+
+#endif // DELTA_H
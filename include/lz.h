@@ -0,0 +1,53 @@
+/*
+ * lz.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Fast LZ77 block codec for compressed transfers
+ */
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+#define LZ_CHUNK (1 << 16) // Largest block, so every match offset fits in 16 bits
+#define LZ_MIN_MATCH 4
+
+// Block format
+// ------------
+// A block is a run of sequences, each some new bytes then an earlier run to
+// repeat:
+//
+//   | token (1) | literal length ext | literals | offset (2, LE) | match length ext |
+//
+// The token's high nibble is the literal count and its low nibble the match
+// length minus LZ_MIN_MATCH; a nibble of 15 continues in extension bytes,
+// each adding its value until one is below 255. The last sequence stops after
+// its literals.
+
+// Function:    lz_compress
+// ------------------------
+// Compresses a block
+//
+// source/len: bytes to compress, at most LZ_CHUNK
+// dest: output buffer
+// capacity: bytes available in dest
+//
+// returns compressed size, 0 if it wouldn't fit in capacity
+size_t lz_compress(const void *source, size_t len, void *dest, size_t capacity);
+
+// Function:    lz_decompress
+// --------------------------
+// Expands a block, checking every length and offset against both buffers so
+// corrupt input can't read or write out of bounds
+//
+// source/len: compressed block
+// dest: output buffer
+// capacity: bytes available in dest
+// produced: receives the expanded size
+//
+// returns 0 on success, -1 on a malformed block
+int lz_decompress(const void *source, size_t len, void *dest, size_t capacity, size_t *produced);
+
+#endif // LZ_H
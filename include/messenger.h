@@ -10,21 +10,214 @@
 #define MESSENGER_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <malloc.h>
+#include <time.h>
 
 #define BUFFER_SIZE 1028
+#define DRAIN_BUFFER_SIZE (1 << 16) // Scratch space for discarding unwanted uploads
+#define DEFAULT_SEND_CHUNK (1 << 21) // Bytes per sendfile(2) call or buffered read
+#define DEFAULT_RECEIVE_CHUNK (1 << 20) // Pipe capacity for splice(2), or the recv buffer in the fallback
+#define MIN_TRANSFER_CHUNK (1 << 12)
+#define MAX_TRANSFER_CHUNK (1 << 30)
+#define PROGRESS_INTERVAL_MS 100 // Default gap between progress reports while a transfer runs
 #define DEFAULT_ADDRESS "127.0.0.1"
 #define DEFAULT_PORT 2000
 
+// Frame layout
+// ------------
+// Every control message travels as a compact binary frame:
+//
+//   | type (1) | flags (1) | reserved (2) | length (4, network order) | payload (length) |
+//
+// Bulk file data is streamed raw after the frame that announces its size.
+#define FRAME_HEADER_SIZE 8
+#define FRAME_INLINE_SIZE 64          // Payloads up to this size are held without a heap allocation
+#define FRAME_MAX_PAYLOAD (1 << 20)   // Upper bound on a single control frame
+
+// Frame types
+#define MSG_TEXT     1 // Human readable status string
+#define MSG_REQUEST  4 // Request header: version, op, flags, size, target
+#define MSG_RESPONSE 5 // Server verdict: status, size, version, message
+
+// Request protocol
+// ----------------
+// A request is a single MSG_REQUEST frame:
+//
+//   | version (1) | op (1) | flags (2) | size (8) | offset (8) | target (rest of frame) |
+//
+// WRITE streams size bytes immediately after the header, GET and RM send
+// nothing more. A GET asks for size bytes starting at offset, with size 0
+// meaning through the end of the file; RM leaves offset at 0.
+//
+// A GET flagged REQUEST_RESUME continues a download that already holds the
+// bytes before offset, and quotes the version (8, network order) of the
+// file they came from after the fixed fields, upload ID and hash. If the
+// file has been replaced since, the server answers CHANGED and sends no
+// data, and the download starts over.
+//
+// With REQUEST_UPLOAD set, an upload ID (8, network order) sits between the
+// fixed fields and the target. A WRITE carrying one is resumable: size is the
+// whole file, the bytes from offset to size follow the header, and the server
+// keeps what it received under that ID until the upload completes. STATUS
+// asks how many bytes the server holds for an upload ID, answered in the
+// response's size; without an ID it reports the target's size instead.
+//
+// Striped transfers split a file over several connections. A striped GET is
+// a set of ranged GETs. A striped WRITE sends each range as a WRITE flagged
+// REQUEST_STRIPE (size bytes stored at offset under the upload ID), then a
+// COMMIT of the upload ID with size set to the whole file publishes it.
+//
+// The server replies with exactly one MSG_RESPONSE:
+//
+//   | status (4) | size (8) | version (8) | message (rest of frame) |
+//
+// and for an accepted GET streams size bytes after it, the requested range
+// clipped to the end of the file. GET and STATUS of a file report the file's
+// version, which changes whenever it is replaced, so the stripes of one
+// transfer can check they all read the same file.
+//
+// A plain or resumable WRITE flagged REQUEST_COMPRESS sends its bytes as a
+// compressed stream. A GET flagged REQUEST_COMPRESS lets the server choose
+// one, which it announces with RESPONSE_COMPRESSED in the response frame's
+// flags. Sizes and offsets always count file bytes:
+//
+//   | raw length (4) | stored length (4) | bytes (stored length) |
+//
+// repeated until size file bytes are covered. Each chunk covers at most
+// LZ_CHUNK bytes of the file. A chunk whose stored length equals its raw
+// length is sent as is; otherwise it is an lz block (see lz.h).
+//
+// A delta WRITE rewrites a file the server already holds. SIGNATURE is
+// answered like a GET of the file's block signature (see delta.h), tagged
+// with the file's version. DELTA then streams size bytes of copy and data
+// instructions made against that signature, which the server rebuilds into
+// a staging file and renames over the target.
+//
+// With REQUEST_HASH set, the SHA-256 of the file's contents (32) follows the
+// upload ID, or the fixed fields when there is none. LINK carries one with
+// size set to the file's size and sends no data: a server keeping a content
+// store (see store.h) that already holds those bytes files them under the
+// target and answers OK, anything else answers NOT_FOUND and the client
+// sends the file with a WRITE instead.
+//
+// A WRITE flagged REQUEST_CHECKSUM follows its data with the CRC32C (4,
+// network order) of the file bytes it sent, and the server stores them only
+// if its own running checksum agrees, answering CORRUPT otherwise. A GET
+// flagged REQUEST_CHECKSUM is answered with RESPONSE_CHECKSUM in the
+// response frame's flags and the CRC32C of the range after its data. The
+// checksum always covers file bytes, after any compressed stream is expanded.
+// A transfer that resumes an earlier one, a resumable WRITE at a nonzero
+// offset or a GET flagged REQUEST_RESUME, is checksummed from the file's
+// first byte instead, so the receiver verifies the bytes it kept as well.
+#define RFS_PROTOCOL_VERSION 4
+#define REQUEST_FIXED_SIZE   20
+#define RESPONSE_FIXED_SIZE  20
+#define REQUEST_HEADER_MAX   (REQUEST_FIXED_SIZE + UPLOAD_ID_SIZE + CONTENT_HASH_SIZE + VERSION_SIZE)
+#define TARGET_MAX           1024
+#define RESPONSE_MESSAGE_MAX 256
+
+// Operations
+#define OP_GET   1
+#define OP_WRITE 2
+#define OP_RM    3
+#define OP_STATUS 4 // Committed bytes of a resumable upload, or the size of a file
+#define OP_COMMIT 5 // Publish a striped upload
+#define OP_SIGNATURE 6 // Block signature of a file, for a delta WRITE
+#define OP_DELTA 7     // Rebuild a file from its signed version and a delta
+#define OP_LINK 8      // Store a file the server already holds by content hash
+
+// Request flags
+#define REQUEST_KEEPALIVE 0x0001 // Keep the connection open for the next request
+#define REQUEST_UPLOAD    0x0002 // An upload ID follows the fixed fields
+#define REQUEST_STRIPE    0x0004 // WRITE of one range of a striped upload
+#define REQUEST_COMPRESS  0x0008 // WRITE data is a compressed stream; a GET may answer with one
+#define REQUEST_HASH      0x0010 // A content hash follows the upload ID
+#define REQUEST_CHECKSUM  0x0020 // WRITE data is followed by its CRC32C; a GET asks for one
+#define REQUEST_RESUME    0x0040 // GET continues a download of the file version that follows
+
+// Response frame flags
+#define RESPONSE_COMPRESSED 0x01 // GET data follows as a compressed stream
+#define RESPONSE_CHECKSUM   0x02 // GET data is followed by its CRC32C
+
+#define UPLOAD_ID_SIZE 8
+#define CONTENT_HASH_SIZE 32
+#define VERSION_SIZE 8
+#define RESUMABLE_WRITE_MIN (1 << 24) // rfs uploads files at least this big resumably
+#define STRIPE_MIN (1 << 24)          // rfs stripes files at least this big when asked to
+#define MAX_STREAMS 64                // Connections one striped transfer may use
+
+// Response status codes
+#define STATUS_OK          0
+#define STATUS_NOT_FOUND   1 // Target doesn't exist
+#define STATUS_BAD_PATH    2 // Destination directory is missing
+#define STATUS_IO_ERROR    3 // Server failed to read or store the file
+#define STATUS_BAD_REQUEST 4 // Unknown op or malformed header
+#define STATUS_BAD_RANGE   5 // Offset lies past the end of the file or upload
+#define STATUS_CHANGED     6 // File was replaced since its signature was taken, or a resumed GET began
+#define STATUS_CORRUPT     7 // WRITE data didn't match its checksum
+
+#define PART_SUFFIX ".part" // Appended to a download's name while it is incomplete
+#define PART_VERSION_SUFFIX ".version" // Appended to a .part file's name for the version its bytes came from
+
+#define COMPRESSED_CHUNK_HEADER 8
+#define COMPRESS_MIN_SIZE 1024 // Smaller transfers are always sent raw
+#define CHECKSUM_SIZE 4
+
+// Transfer encodings, how the file bytes of a transfer travel
+#define TRANSFER_COMPRESSED 0x1 // As a compressed stream
+#define TRANSFER_CHECKSUM   0x2 // Followed by their CRC32C
+
 // Safe free macro
 #define SAFE_FREE(p) do { if (p) { free(p); p = NULL; } } while (0)
 
+// Type:        frame_t
+// --------------------
+// A decoded frame. payload points either at inline_payload or at a heap buffer,
+// so a frame_t must not be copied by value; release it with free_frame.
+// The payload is always NUL terminated one byte past length.
+typedef struct frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t length;
+    char *payload;
+    char inline_payload[FRAME_INLINE_SIZE + 1];
+} frame_t;
+
+// Type:        request_t
+// ----------------------
+// Decoded request header
+typedef struct request {
+    uint8_t version;
+    uint8_t op;
+    uint16_t flags;
+    uint64_t size;
+    uint64_t offset;    // First byte wanted by a GET, or sent by a resumable WRITE
+    uint64_t upload_id; // Set when flags has REQUEST_UPLOAD
+    unsigned char content_hash[CONTENT_HASH_SIZE]; // Set when flags has REQUEST_HASH
+    uint64_t resume_version; // Set when flags has REQUEST_RESUME
+    char target[TARGET_MAX];
+} request_t;
+
+// Type:        response_t
+// -----------------------
+// Decoded server response
+typedef struct response {
+    int32_t status;
+    uint64_t size;
+    uint64_t version; // File version for GET and STATUS, 0 otherwise
+    uint8_t flags;    // RESPONSE_* flags of the response frame
+    char message[RESPONSE_MESSAGE_MAX];
+} response_t;
+
 // Function:    server_init
 // ------------------------
 // Initializes a TCP server
@@ -39,44 +232,517 @@ int server_init();
 // Returns fd associated with socket
 int client_init();
 
-// Function:	send_file
+// Function:    hton64
+// -------------------
+// Converts a 64-bit value to network byte order
+uint64_t hton64(uint64_t value);
+
+// Function:    ntoh64
+// -------------------
+// Converts a 64-bit value from network byte order
+uint64_t ntoh64(uint64_t value);
+
+// send_file transports
+#define SEND_SENDFILE 0 // sendfile(2), buffered fallback
+#define SEND_MMAP 1     // Shared read-only mapping, sendfile(2) if the file can't be mapped
+
+// Type:        file_mapping_t
+// ---------------------------
+// A read-only MAP_SHARED mapping of a file, shared by every concurrent sender
+// of the same inode so they read the same pages. Mappings are only ever made
+// of files the server replaces by rename, so their size never changes.
+typedef struct file_mapping {
+    dev_t device;
+    ino_t inode;
+    uint64_t size;
+    char *data;
+    int refs;
+    struct file_mapping *next;
+} file_mapping_t;
+
+// Type:        transfer_progress_t
+// --------------------------------
+// Telemetry of one transfer, as handed to the progress callback
+typedef struct transfer_progress {
+    uint64_t bytes;     // File bytes moved so far
+    uint64_t total;     // File bytes in the transfer
+    double elapsed;     // Seconds since the transfer started
+    double rate;        // Average bytes per second since the start
+    int done;           // Set on the final report, whether or not every byte moved
+    int mark;           // Free for the callback's own use, 0 when the transfer starts
+    struct timespec start;
+    double next_report; // Elapsed time before which progress isn't reported
+} transfer_progress_t;
+
+// Type:        progress_callback_t
+// --------------------------------
+// Receives a report when a transfer starts, at most once per interval while
+// it runs, and when it ends. Transfers on different threads report
+// concurrently.
+typedef void (*progress_callback_t)(transfer_progress_t *progress, void *context);
+
+// Type:        transfer_config_t
+// ------------------------------
+// I/O sizes used by send_file and receive_file. Large chunks keep the number
+// of system calls per gigabyte low on the big-file path. Without a progress
+// callback, the default, transfers don't read the clock at all.
+typedef struct transfer_config {
+    size_t send_chunk;    // Bytes per sendfile(2) call or mapped send, and the buffered fallback's read size
+    size_t receive_chunk; // Requested pipe capacity for splice(2), and the fallback's recv buffer
+    int send_mode;        // SEND_SENDFILE or SEND_MMAP
+    progress_callback_t progress; // Telemetry callback, NULL for none
+    void *progress_context;
+    double progress_interval;     // Seconds between reports while a transfer runs
+} transfer_config_t;
+
+extern transfer_config_t transfer_config;
+
+// Function:    set_transfer_chunk
+// -------------------------------
+// Sets both the send and receive chunk sizes
+//
+// bytes: chunk size, between MIN_TRANSFER_CHUNK and MAX_TRANSFER_CHUNK
+//
+// returns 0 on success, -1 if bytes is out of range
+int set_transfer_chunk(uint64_t bytes);
+
+// Function:    set_progress_callback
+// ----------------------------------
+// Installs the callback receiving progress reports of every transfer; set it
+// before transfers start
+//
+// callback: called with each report, NULL to stop reporting
+// context: handed to the callback unchanged
+// interval_ms: shortest gap between reports while a transfer runs
+void set_progress_callback(progress_callback_t callback, void *context, unsigned interval_ms);
+
+// Function:    progress_start
+// ---------------------------
+// Begins tracking a transfer, reporting it to the callback if there is one
+//
+// progress: tracker for the transfer
+// total: bytes the transfer will move
+void progress_start(transfer_progress_t *progress, uint64_t total);
+
+// Function:    progress_advance
+// -----------------------------
+// Counts bytes moved, reporting once the interval since the last report has passed
+void progress_advance(transfer_progress_t *progress, uint64_t bytes);
+
+// Function:    progress_finish
+// ----------------------------
+// Sends the final report of a transfer, complete or not
+void progress_finish(transfer_progress_t *progress);
+
+// Function:    parse_size
+// -----------------------
+// Parses a byte count with an optional K, M or G suffix (powers of 1024)
+//
+// text: e.g. "4096", "512K", "8M"
+// size: destination for the parsed value
+//
+// returns 0 on success, -1 if text isn't a valid size
+int parse_size(const char *text, uint64_t *size);
+
+// Function:    map_shared_file
+// ----------------------------
+// Maps a whole file read-only, reusing the live mapping of the same inode if
+// there is one, and hints the kernel to read it ahead sequentially
+//
+// fd: open file
+//
+// returns referenced mapping to pass to unmap_shared_file, NULL if it can't be mapped
+file_mapping_t *map_shared_file(int fd);
+
+// Function:    unmap_shared_file
+// ------------------------------
+// Drops a reference taken by map_shared_file, unmapping after the last one
+void unmap_shared_file(file_mapping_t *mapping);
+
+// Function:    file_version
+// -------------------------
+// Identifies one version of a file. Files are replaced by rename, so a new
+// version always has a new inode or modification time.
+//
+// info: stat of the file
+//
+// returns version, never 0
+uint64_t file_version(const struct stat *info);
+
+// Function:    open_file
 // ----------------------
-// Opens a file and transmits it byte by byte to the provided socket
+// Opens a file for transmission and reports its size
 //
 // filename: string indicating relative filepath
+// file_size: destination for the size of the file in bytes
+//
+// returns fd on success, -1 if the file can't be opened or isn't a regular file
+int open_file(const char *filename, uint64_t *file_size);
+
+// Function:    check_directory
+// ----------------------------
+// Tests whether the directory a file would be saved into exists
+//
+// filename: string file name, optionally prefixed by a relative path
+//
+// returns 1 if the outer directory exists (or none is given), 0 otherwise
+int check_directory(const char *filename);
+
+// Function:    drain_stream
+// -------------------------
+// Reads and discards bytes from a socket to keep the stream aligned
+//
+// returns 0 on success, -1 if the connection failed
+int drain_stream(int socket_desc, uint64_t size);
+
+// Function:	send_file
+// ----------------------
+// Transmits file_size bytes from the start of an open file to the provided socket
+//
+// fd: file descriptor opened with open_file
+// file_size: number of bytes announced to the peer
+// socket_desc: file descriptor for the socket
+//
+// returns: 0 on success, -1 on file read errors, 1 for connection errors
+int send_file(int fd, uint64_t file_size, int socket_desc);
+
+// Function:	send_file_range
+// ----------------------------
+// Transmits length bytes of an open file, starting at offset, to the provided
+// socket, zero-copy via sendfile(2) or from a shared mapping
+// (transfer_config.send_mode, server files only), with a buffered fallback
+//
+// fd: file descriptor opened with open_file
+// offset: first byte to send
+// length: number of bytes announced to the peer
 // socket_desc: file descriptor for the socket
+// checksum: running CRC32C to extend with the bytes as they are sent, or
+//           NULL. Bytes sendfile moved are read back from the page cache.
 //
-// returns: 0 on success, -1 on memory allocation failure, 1 for other errors
-int send_file(char *filename, int socket_desc);
+// returns: 0 on success, -1 on file read errors, 1 for connection errors
+int send_file_range(int fd, uint64_t offset, uint64_t length, int socket_desc, uint32_t *checksum);
+
+// Function:    checksum_file
+// --------------------------
+// Extends a CRC32C with a range of a file, for bytes a transfer's checksum
+// covers but the transfer doesn't carry
+//
+// fd: file open for reading
+// offset/length: range to checksum
+// checksum: running CRC32C to extend
+//
+// returns 0 on success, -1 on read errors
+int checksum_file(int fd, uint64_t offset, uint64_t length, uint32_t *checksum);
+
+// Function:    send_checksum
+// --------------------------
+// Sends the CRC32C trailer that ends a checksummed transfer
+//
+// returns 0 on success, -1 on failure
+int send_checksum(int socket_desc, uint32_t checksum);
+
+// Function:    receive_checksum
+// -----------------------------
+// Reads the CRC32C trailer of a checksummed transfer and compares it with
+// the receiver's own
+//
+// returns 0 if they match, 1 if the connection failed, 3 if they differ
+int receive_checksum(int socket_desc, uint32_t checksum);
+
+// Function:    open_staging_file
+// ------------------------------
+// Creates a hidden temporary file beside filename for an atomic replace
+//
+// filename: final destination
+// staging_path: receives the temporary file's path
+// len: size of staging_path
+//
+// returns fd open for writing, -1 on failure
+int open_staging_file(const char *filename, char *staging_path, size_t len);
+
+// Function:    pwrite_all
+// -----------------------
+// Writes exactly len bytes to a file descriptor at offset, leaving its file
+// position alone
+//
+// returns 0 on success, -1 on failure
+int pwrite_all(int fd, const void *buf, size_t len, uint64_t offset);
+
+// Function:    pread_all
+// ----------------------
+// Reads exactly len bytes of a file at offset, leaving its file position alone
+//
+// returns 0 on success, -1 on failure or if the file ends first
+int pread_all(int fd, void *buf, size_t len, uint64_t offset);
+
+// Function:    upload_path
+// ------------------------
+// Builds the name of the hidden file a resumable upload collects into, beside
+// its destination
+//
+// filename: final destination
+// upload_id: client's upload ID
+// path: receives the upload file's path
+// len: size of path
+//
+// returns 0 on success, -1 if the name doesn't fit
+int upload_path(const char *filename, uint64_t upload_id, char *path, size_t len);
 
 // Function:	receive_file
 // -------------------------
-// Receives a file over TCP and saves it locally, automatically handles versioning and directory existence checks
+// Receives file_size bytes over TCP and saves them locally, zero-copy via
+// splice(2) with a large buffer fallback. The data is staged in a temporary
+// file and renamed over filename once complete, so a failed transfer never
+// leaves a torn file. If the file can't be opened or written the remaining
+// bytes are drained so the connection stays usable.
 // 
 // filename: string file name
+// file_size: number of bytes announced by the peer
+// socket_desc: file descriptor for socket
+// encoding: TRANSFER_* flags of the data
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum (nothing is stored)
+int receive_file(char *filename, uint64_t file_size, int socket_desc, int encoding);
+
+// Function:    receive_stream
+// ---------------------------
+// Moves file_size bytes from a socket into an open file starting at offset,
+// with positional writes so several streams may fill one file at once
+//
+// fd: destination file
+// offset: file position the first byte lands at
+// file_size: number of bytes announced by the peer
+// socket_desc: file descriptor for socket
+// total_bytes_received: receives the number of bytes taken off the socket
+// checksum: running CRC32C to extend with the bytes as they arrive, or NULL.
+//           Spliced bytes are read back from the page cache, so fd should
+//           be readable; a write-only fd is received through a buffer.
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors
+int receive_stream(int fd, uint64_t offset, uint64_t file_size, int socket_desc, uint64_t *total_bytes_received,
+                   uint32_t *checksum);
+
+// Function:    should_compress
+// ----------------------------
+// Decides whether a transfer is worth compressing, skipping small files,
+// known compressed formats, and data whose first chunk doesn't shrink
+//
+// filename: name of the file, for its extension
+// fd: open file, read when data is NULL
+// data: contents in memory, or NULL
+// offset/length: range to be sent
+//
+// returns 1 to compress, 0 to send raw
+int should_compress(const char *filename, int fd, const char *data, uint64_t offset, uint64_t length);
+
+// Function:    send_compressed
+// ----------------------------
+// Transmits length bytes of a file (or of data, when not NULL) from offset as
+// a compressed stream
+//
+// wire_bytes: receives the number of bytes actually sent, or NULL
+// checksum: running CRC32C to extend with the file bytes sent, or NULL
+//
+// returns: 0 on success, -1 on file read errors, 1 for connection errors
+int send_compressed(int fd, const char *data, uint64_t offset, uint64_t length, int socket_desc,
+                    uint64_t *wire_bytes, uint32_t *checksum);
+
+// Function:    receive_compressed
+// -------------------------------
+// Expands file_size bytes of a compressed stream into an open file at offset
+//
+// total_bytes_received: receives the number of file bytes taken off the socket
+// checksum: running CRC32C to extend with the expanded bytes, or NULL
+//
+// returns: 0 on success, -1 on file errors or a chunk that doesn't expand,
+// 1 for connection errors or a malformed stream
+int receive_compressed(int fd, uint64_t offset, uint64_t file_size, int socket_desc, uint64_t *total_bytes_received,
+                       uint32_t *checksum);
+
+// Function:    drain_compressed
+// -----------------------------
+// Reads and discards the rest of a compressed stream of size file bytes
+//
+// returns 0 on success, -1 if the connection failed or the stream is malformed
+int drain_compressed(int socket_desc, uint64_t size);
+
+// Function:    drain_transfer
+// ---------------------------
+// Discards the rest of a transfer, raw or compressed, and its checksum trailer
+//
+// size: file bytes still expected
+// encoding: TRANSFER_* flags of the data
+//
+// returns 0 on success, -1 if the connection failed
+int drain_transfer(int socket_desc, uint64_t size, int encoding);
+
+// Function:	receive_range
+// --------------------------
+// Receives one range of a striped transfer into path at offset, creating the
+// file if needed but never truncating or renaming it. On a local write failure
+// the remaining bytes are drained so the connection stays usable.
+//
+// path: file collecting the transfer
+// offset: file position of the range
+// size: number of bytes announced by the peer
+// socket_desc: file descriptor for socket
+// encoding: TRANSFER_* flags of the data
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum
+int receive_range(const char *path, uint64_t offset, uint64_t size, int socket_desc, int encoding);
+
+// Function:    partial_path
+// -------------------------
+// Builds the name of the file a resumable download collects into
+//
+// returns 0 on success, -1 if the name doesn't fit in len bytes
+int partial_path(const char *filename, char *part_path, size_t len);
+
+// Function:	receive_partial
+// ----------------------------
+// Receives the remainder of a transfer that already has offset bytes in
+// part_path, appending file_size more bytes and renaming it over filename
+// once complete. Bytes received before a dropped connection are kept for a
+// later resume, and checked by its checksum, which starts at byte 0.
+//
+// filename: final destination
+// part_path: file collecting the transfer, e.g. from partial_path or upload_path
+// offset: bytes of the partial file to keep
+// file_size: number of bytes announced by the peer
 // socket_desc: file descriptor for socket
+// encoding: TRANSFER_* flags of the data
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum (the partial file is removed)
+int receive_partial(char *filename, const char *part_path, uint64_t offset, uint64_t file_size, int socket_desc,
+                    int encoding);
+
+// Function:    send_request
+// -------------------------
+// Sends a request header
+//
+// returns 0 on success, -1 on failure
+int send_request(int socket_desc, const request_t *request);
+
+// Function:    receive_request
+// ----------------------------
+// Receives and validates a request header
+//
+// returns 0 on success, -1 on failure or malformed request
+int receive_request(int socket_desc, request_t *request);
+
+// Function:    decode_request
+// ---------------------------
+// Decodes and validates the payload of a MSG_REQUEST frame, for callers that
+// assemble frames themselves (e.g. non-blocking readers)
+//
+// returns 0 on success, -1 on malformed request
+int decode_request(const char *payload, uint32_t length, request_t *request);
+
+// Function:    send_response
+// --------------------------
+// Sends the server's single verdict on a request
+//
+// status: STATUS_* code
+// size: size of the data that follows (GET), 0 otherwise
+// message: optional human readable message, may be NULL
+//
+// returns 0 on success, -1 on failure
+int send_response(int socket_desc, int32_t status, uint64_t size, const char *message);
+
+// Function:    send_versioned_response
+// --------------------------------------
+// Sends a response that also reports the version of the file it concerns,
+// with RESPONSE_* flags in its frame header
+//
+// returns 0 on success, -1 on failure
+int send_versioned_response(int socket_desc, int32_t status, uint64_t size, uint64_t version, uint8_t flags,
+                            const char *message);
+
+// Function:    receive_response
+// -----------------------------
+// Receives the server's verdict on a request
+//
+// returns 0 on success, -1 on failure or malformed response
+int receive_response(int socket_desc, response_t *response);
+
+// Function:    send_all
+// ---------------------
+// Sends exactly len bytes, retrying on short writes
+//
+// socket_desc: file descriptor for destination socket
+// buf: data to send
+// len: number of bytes
+//
+// returns 0 on success, -1 on failure
+int send_all(int socket_desc, const void *buf, size_t len);
+
+// Function:    recv_all
+// ---------------------
+// Reads exactly len bytes, retrying until the whole range has arrived
 //
-// returns: 0 on success, -1 on 
-int receive_file(char *filename, int socket_desc);
+// socket_desc: file descriptor for origin socket
+// buf: destination buffer
+// len: number of bytes
+//
+// returns 0 on success, -1 on failure or if the peer disconnected
+int recv_all(int socket_desc, void *buf, size_t len);
+
+// Function:    send_frame
+// -----------------------
+// Sends a single frame, header and payload in one write
+//
+// socket_desc: file descriptor for destination socket
+// type: MSG_* frame type
+// flags: frame flags
+// payload: frame body, may be NULL when length is 0
+// length: size of payload in bytes
+//
+// returns 0 on success, -1 on failure
+int send_frame(int socket_desc, uint8_t type, uint8_t flags, const void *payload, uint32_t length);
+
+// Function:    decode_frame_header
+// --------------------------------
+// Decodes the fixed header of a frame into type, flags and length
+//
+// header: FRAME_HEADER_SIZE bytes as read from the wire
+// frame: frame_t to populate
+void decode_frame_header(const unsigned char *header, frame_t *frame);
+
+// Function:    receive_frame
+// --------------------------
+// Reads one complete frame from a socket
+//
+// socket_desc: file descriptor for origin socket
+// frame: frame_t to populate
+//
+// returns 0 on success, -1 on failure
+int receive_frame(int socket_desc, frame_t *frame);
+
+// Function:    free_frame
+// -----------------------
+// Releases any heap storage held by a frame
+void free_frame(frame_t *frame);
 
 // Function:	send_msg
 // ---------------------
-// Sends a simple message over TCP
+// Sends a simple message over TCP as a MSG_TEXT frame
 //
 // msg: string containing message
 // socket_desc: file descriptor for destination socket
 //
-// returns 0 on success, -1 on failure
+// returns 1 on success, 0 on failure
 int send_msg(char *msg, int socket_desc);
 
 // Function:	receive_msg
 // ------------------------
-// Receives a simple message over TCP
+// Receives a MSG_TEXT frame and returns it as a dynamically allocated string
 //
-// msg: string containing message
 // socket_desc: file descriptor for origin socket
 //
-// returns 0 on success, -1 on failure
+// returns msg on success, NULL on failure
 char* receive_msg(int socket_desc);
 
 #endif //MESSENGER_H
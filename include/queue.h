@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "slab.h"
 
 // Struct:	node_t
 // -------------------
@@ -41,6 +42,23 @@ typedef struct
 	unsigned int size;
 } queue_t;
 
+// Struct:	mpsc_queue_t
+// -------------------------
+// A lock-free multi-producer single-consumer FIFO queue (Vyukov's algorithm).
+// Any number of threads may push concurrently without locks; only one thread
+// at a time may peek or pop. head always points at a spent stub node whose
+// next is the oldest element; producers swing tail with one atomic exchange
+// and then link the previous tail to their node, so a pop racing a push can
+// briefly see the queue as empty until the link lands.
+//
+// Data structure:
+// head(stub) -next-> node1 -next-> ... -next-> tail -next-> NULL
+typedef struct
+{
+	node_t* head; // Consumer side
+	node_t* tail; // Producer side, swapped atomically
+} mpsc_queue_t;
+
 // Function:	create_node
 // ------------------------
 // Creates a new free-floating node
@@ -90,9 +108,54 @@ void remove_node(queue_t* queue, node_t* node);
 // queue: some queue_t*
 void* pop_queue(queue_t* queue);
 
+// Function:	get_node_stats
+// ---------------------------
+// Copies the pool counters for node_t allocations
+//
+// stats: destination for the counters
+void get_node_stats(slab_stats_t* stats);
+
 // Function:    destroy_queue
 // --------------------------
 // Destroys a queue
 void destroy_queue(queue_t* queue);
 
+// Function:	create_mpsc_queue
+// ------------------------------
+// Creates an empty lock-free multi-producer single-consumer queue
+//
+// returns: mpsc_queue_t* holding only its stub node
+mpsc_queue_t* create_mpsc_queue(void);
+
+// Function:	push_mpsc_queue
+// ----------------------------
+// Appends an element; safe to call from any number of threads at once
+//
+// queue: some mpsc_queue_t
+// element: some data element of anonymous type
+void push_mpsc_queue(mpsc_queue_t* queue, void* element);
+
+// Function:	peek_mpsc_queue
+// ----------------------------
+// Returns the oldest element without removing it; consumer only
+//
+// queue: some mpsc_queue_t
+//
+// returns: oldest element, NULL if the queue is empty or a push is still linking
+void* peek_mpsc_queue(mpsc_queue_t* queue);
+
+// Function:	pop_mpsc_queue
+// ---------------------------
+// Removes and returns the oldest element; consumer only
+//
+// queue: some mpsc_queue_t
+//
+// returns: oldest element, NULL if the queue is empty or a push is still linking
+void* pop_mpsc_queue(mpsc_queue_t* queue);
+
+// Function:    destroy_mpsc_queue
+// -------------------------------
+// Destroys an mpsc queue and frees any elements left in it; no pushes may be in flight
+void destroy_mpsc_queue(mpsc_queue_t* queue);
+
 #endif // QUEUE_H
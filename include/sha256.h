@@ -0,0 +1,48 @@
+/*
+ * sha256.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * SHA-256 for content addressing
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+// Type:        sha256_t
+// ---------------------
+// Running hash state
+typedef struct sha256 {
+    uint32_t state[8];
+    uint64_t length;                       // Bytes hashed so far
+    unsigned char block[SHA256_BLOCK_SIZE]; // Bytes waiting for a full block
+    size_t filled;
+} sha256_t;
+
+// Function:    sha256_init
+// ------------------------
+// Starts a new hash
+void sha256_init(sha256_t *hash);
+
+// Function:    sha256_update
+// --------------------------
+// Adds len bytes to the hash
+void sha256_update(sha256_t *hash, const void *data, size_t len);
+
+// Function:    sha256_final
+// -------------------------
+// Pads the message and writes the digest
+void sha256_final(sha256_t *hash, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+// Function:    sha256_hex
+// -----------------------
+// Formats a digest as 64 lowercase hex digits and a NUL
+void sha256_hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[2 * SHA256_DIGEST_SIZE + 1]);
+
+#endif // SHA256_H
@@ -0,0 +1,86 @@
+/*
+ * slab.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Pooled fixed-size object allocator
+ */
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define SLAB_MAX_CLASSES 8      // Distinct slab_t instances a process may use
+#define SLAB_CHUNK_OBJECTS 256  // Objects carved from each malloc'd chunk
+#define SLAB_BATCH 64           // Objects moved between a thread cache and the depot at once
+#define SLAB_CACHE_MAX (2 * SLAB_BATCH) // Thread cache size that triggers a flush to the depot
+
+// Type:        slab_stats_t
+// -------------------------
+// Allocation counters for one slab
+typedef struct slab_stats {
+    unsigned long hits;      // Allocations served from recycled or pre-carved objects
+    unsigned long fallbacks; // Allocations that had to malloc a fresh chunk
+    unsigned long chunks;    // Chunks currently owned by the slab
+} slab_stats_t;
+
+// Type:        slab_chunk_t
+// -------------------------
+// Header of one malloc'd block of objects
+typedef struct slab_chunk {
+    struct slab_chunk *next;
+} slab_chunk_t;
+
+// Type:        slab_t
+// -------------------
+// Pool of equally sized objects. Each thread keeps a private free list and
+// only takes the depot lock to trade whole batches, so the common alloc/free
+// pair touches no shared state. Objects may be freed by a different thread
+// than the one that allocated them, and a thread's cached objects return to
+// the depot when it exits.
+typedef struct slab {
+    size_t object_size;
+    int id; // Index of this slab's thread caches, assigned on first use
+
+    pthread_mutex_t lock; // Guards everything below
+    void *depot;          // Shared free list
+    int depot_count;
+    slab_chunk_t *chunks;
+    struct slab_cache *caches; // Thread caches in use, for stats
+    slab_stats_t stats;        // Hits of exited threads; live caches are summed on read
+} slab_t;
+
+// Macro:       SLAB_INITIALIZER
+// -----------------------------
+// Static initializer for a slab of objects of the given type; objects are
+// pointer-aligned, so the type must not need stricter alignment
+#define SLAB_INITIALIZER(type) { sizeof(type) > sizeof(void *) ? sizeof(type) : sizeof(void *), \
+                                 0, PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL, NULL, { 0, 0, 0 } }
+
+// Function:    slab_alloc
+// -----------------------
+// Takes an object from the calling thread's cache, refilling it from the depot
+// or a fresh chunk when empty
+//
+// slab:        pool to allocate from
+//
+// returns pointer to uninitialised object, exits on allocation failure
+void *slab_alloc(slab_t *slab);
+
+// Function:    slab_free
+// ----------------------
+// Returns an object to the calling thread's cache, flushing a batch to the
+// depot when the cache grows past SLAB_CACHE_MAX
+//
+// slab:        pool the object came from
+// object:      object to release, may be NULL
+void slab_free(slab_t *slab, void *object);
+
+// Function:    get_slab_stats
+// ---------------------------
+// Copies a slab's counters
+void get_slab_stats(slab_t *slab, slab_stats_t *stats);
+
+#endif // SLAB_H
@@ -0,0 +1,104 @@
+/*
+ * store.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Content-addressed store deduplicating identical uploads
+ */
+#ifndef STORE_H
+#define STORE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "sha256.h"
+
+#define STORE_ROOT_MAX 1024
+#define STORE_PATH_MAX (STORE_ROOT_MAX + 2 * SHA256_DIGEST_SIZE + 8)
+#define STORE_HASH_CHUNK (1 << 20) // Bytes read per step while hashing a file
+
+// Store layout
+// ------------
+// Every distinct content the server holds is one object, named by the hex
+// SHA-256 of its bytes under a subdirectory of its first two digits:
+//
+//   <root>/ab/ab34...ef
+//
+// Stored files are hard links to their object, so identical files share one
+// inode and every reader (sendfile, mmap, the content cache) sees a plain
+// file. The server only ever replaces files by rename, never rewrites one in
+// place, so a shared inode can't change under the other names. An object
+// whose names have all been removed is left behind and reclaimed at the next
+// start. The root must be on the same filesystem as the files served.
+
+// Type:        store_stats_t
+// --------------------------
+// Counters describing deduplication
+typedef struct store_stats {
+    unsigned long stored;       // Uploads whose content was new
+    unsigned long deduplicated; // Uploads folded into an object already held
+    unsigned long linked;       // Uploads skipped because the client announced held content
+    unsigned long reclaimed;    // Orphaned objects removed at startup
+    uint64_t bytes_saved;       // File bytes not stored twice
+} store_stats_t;
+
+// Type:        content_store_t
+// ----------------------------
+// Store configuration and counters, guarded by one mutex
+typedef struct content_store {
+    char root[STORE_ROOT_MAX];
+    int enabled;
+    store_stats_t stats;
+    pthread_mutex_t lock;
+} content_store_t;
+
+extern content_store_t content_store;
+
+// Function:    content_hash
+// -------------------------
+// SHA-256 of a whole file
+//
+// fd: open file
+// size: bytes in the file
+// digest: receives the hash
+//
+// returns 0 on success, -1 if the file couldn't be read in full
+int content_hash(int fd, uint64_t size, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+// Function:    store_init
+// -----------------------
+// Enables the store under root, creating it if needed and reclaiming objects
+// no file refers to any more
+//
+// returns 0 on success, -1 if root can't be used
+int store_init(const char *root);
+
+// Function:    store_ingest
+// -------------------------
+// Files a newly written file under its content. If an object with the same
+// content exists the file is replaced by a link to it; otherwise the file
+// becomes the object. Callers must hold the file against other writers.
+//
+// path: file just written
+//
+// returns 0 if the content was new, 1 if it was already held, -1 on errors
+// (the file is left as an independent copy)
+int store_ingest(const char *path);
+
+// Function:    store_link
+// -----------------------
+// Publishes held content under a new name without any data transfer
+//
+// digest: content hash announced by the client
+// size: size the client expects the content to have
+// target: file to create or replace
+//
+// returns 0 on success, 1 if no object of that hash and size is held, -1 on errors
+int store_link(const unsigned char digest[SHA256_DIGEST_SIZE], uint64_t size, const char *target);
+
+// Function:    get_store_stats
+// ----------------------------
+// Copies the store counters
+void get_store_stats(store_stats_t *stats);
+
+#endif // STORE_H
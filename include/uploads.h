@@ -0,0 +1,123 @@
+/*
+ * uploads.h / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Registry of the upload files a server is collecting
+ */
+#ifndef UPLOADS_H
+#define UPLOADS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#define UPLOAD_TTL (24 * 60 * 60) // Default seconds an untouched upload file is kept
+
+// Type:        byte_range_t
+// -------------------------
+// Bytes start up to, not including, end
+typedef struct byte_range {
+    uint64_t start;
+    uint64_t end;
+} byte_range_t;
+
+// Type:        upload_t
+// ---------------------
+// One upload file, named by upload_path, with the ranges of it that arrived
+// intact. Only striped uploads record ranges; a resumable upload is appended
+// to in order, so its size is all there is to know.
+typedef struct upload {
+    char *path;
+    time_t last_active;  // When a request last wrote into the file
+    int writers;         // Requests writing into the file right now
+    byte_range_t *ranges; // Sorted, neither overlapping nor touching
+    int range_count;
+    int range_capacity;
+    struct upload *next;
+} upload_t;
+
+// Type:        upload_stats_t
+// ---------------------------
+// Counters describing upload bookkeeping
+typedef struct upload_stats {
+    unsigned long active;    // Upload files being tracked
+    unsigned long committed; // Striped uploads published by COMMIT
+    unsigned long refused;   // COMMITs refused for missing ranges
+    unsigned long expired;   // Upload files removed after sitting untouched past the TTL
+} upload_stats_t;
+
+// Type:        upload_table_t
+// ---------------------------
+// Every tracked upload, guarded by one mutex
+typedef struct upload_table {
+    upload_t *uploads;
+    int ttl;
+    upload_stats_t stats;
+    pthread_mutex_t lock;
+} upload_table_t;
+
+extern upload_table_t upload_table;
+
+// Function:    uploads_init
+// -------------------------
+// Sets how long an upload file may sit untouched before it is removed, and
+// takes on the upload files an earlier run left under the working directory
+//
+// ttl:         seconds, 0 for UPLOAD_TTL
+void uploads_init(int ttl);
+
+// Function:    upload_begin
+// -------------------------
+// Registers a request about to write into an upload file, tracking the
+// upload from then on if it is new
+//
+// path:        upload file, from upload_path
+//
+// returns 0 on success, -1 if the upload can't be tracked
+int upload_begin(const char *path);
+
+// Function:    upload_end
+// -----------------------
+// Ends a write begun with upload_begin. A range that was stored intact is
+// added to the upload's ranges; one that wasn't is taken out of them, since
+// whatever it held before may have been overwritten.
+//
+// path:        upload file
+// offset/length: range the request covered
+// stored:      1 if every byte of it arrived intact, 0 otherwise
+void upload_end(const char *path, uint64_t offset, uint64_t length, int stored);
+
+// Function:    upload_claim
+// -------------------------
+// Checks that a striped upload holds every byte of the file and no request
+// is still writing into it, and stops tracking it so it can be published
+//
+// path:        upload file
+// size:        bytes in the whole file
+//
+// returns 0 if it is complete, -1 if it is unknown or has gaps
+int upload_claim(const char *path, uint64_t size);
+
+// Function:    upload_forget
+// --------------------------
+// Stops tracking an upload whose file has been published
+void upload_forget(const char *path);
+
+// Function:    expire_uploads
+// ---------------------------
+// Removes upload files no request has written into for the TTL, so
+// abandoned uploads don't collect on disk; run periodically by the reaper
+//
+// now:         current time
+//
+// returns number of upload files removed
+int expire_uploads(time_t now);
+
+// Function:    get_upload_stats
+// -----------------------------
+// Copies the upload counters
+void get_upload_stats(upload_stats_t *stats);
+
+#endif // UPLOADS_H
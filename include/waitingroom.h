@@ -1,4 +1,3 @@
-
 /*
  * waitingroom.h / Practicum 2
  *
@@ -15,67 +14,174 @@
 
 #include "queue.h"
 #include <pthread.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
-// Global Variables
-extern pthread_mutex_t global_map_lock; // Mutex for access to active file map
-extern queue_t *file_map; // Stores file handlers for files that have been queried at runtime
-extern int shutdown_signal; // Flag for terminating sleeping threads
+#define FILE_MAP_BUCKETS 4096 // Hash buckets in file_map, a power of two
+#define FILE_MAP_STRIPES 64   // Bucket locks; bucket i is guarded by stripe i % FILE_MAP_STRIPES
+#define HANDLER_IDLE_TTL 60   // Default seconds an idle file handler is kept before it is reclaimed
+#define REAPER_INTERVAL 5     // Longest gap between idle handler sweeps, in seconds
 
 // Function Pointer:    request_handler_fn
 // ---------------------------------------
 // Passed to file worker for some process related to handling client requests given a socket fd
-typedef int (*request_handler_fn)(int);
+// and the context supplied to make_request (owned by the handler once called)
+typedef int (*request_handler_fn)(int, void *);
+
+// Function Pointer:    reaper_task_fn
+// -----------------------------------
+// Extra sweep the reaper runs on every pass, given the current time; returns
+// how many things it reclaimed
+typedef int (*reaper_task_fn)(time_t);
+
+// Type:        access_mode_t
+// --------------------------
+// How a request touches its file. Consecutive ACCESS_SHARED requests for one
+// file may run side by side; an ACCESS_STAGED request runs alongside them but
+// waits for the previous staged request; an ACCESS_EXCLUSIVE request runs alone.
+typedef enum access_mode {
+    ACCESS_SHARED,    // Reads the file (GET)
+    ACCESS_STAGED,    // Replaces the file atomically once done, readers unaffected meanwhile (WRITE)
+    ACCESS_EXCLUSIVE  // Modifies the file in place (RM)
+} access_mode_t;
+
+// Handler state bits; the remaining high bits count running shared requests
+#define HANDLER_TOKEN     0x1  // Handler is on the ready queue or a worker is consuming its queue
+#define HANDLER_RELEASING 0x2  // The consuming worker is checking for late requests before letting go
+#define HANDLER_PENDING   0x4  // A request arrived while the token was being released
+#define HANDLER_PARKED    0x8  // The front request is waiting for running requests to finish
+#define HANDLER_STAGER    0x10 // A staged request is running
+#define HANDLER_READER    0x20 // One running shared request
 
 // Type:        file_handler_t
 // ---------------------------
 // Local memory structure for keeping track of files that have been queried already
-// Stores process thread for closure when server is terminated
+// Holds the file's pending requests until a pool worker picks the handler up
 typedef struct file_handler {
     char *filename;
+    uint64_t hash; // Hash of filename, selects the bucket
 
-    // Thread access controllers
-    pthread_mutex_t lock;
-    pthread_cond_t cond;
-    pthread_t tid;
+    // All waiting clients; pushed lock-free by make_request, popped only by the token holder
+    mpsc_queue_t *request_queue;
+
+    // HANDLER_* bits plus the running reader count, updated with atomic compare-and-swap
+    unsigned int state;
 
-    // All waiting clients
-    queue_t *request_queue;
+    // When the handler last went idle, for reclamation
+    time_t last_used;
 
     // Process for file worker
     request_handler_fn handler_fn;
+
+    // Next handler in the same file_map bucket
+    struct file_handler *next;
 } file_handler_t;
 
+// Type:        file_map_t
+// -----------------------
+// Hash table of file handlers keyed on filename. Each bucket is a chain of
+// handlers guarded by one of FILE_MAP_STRIPES locks, so requests for different
+// files rarely contend.
+typedef struct file_map {
+    file_handler_t *buckets[FILE_MAP_BUCKETS];
+    pthread_mutex_t stripes[FILE_MAP_STRIPES];
+} file_map_t;
+
+// Type:        worker_pool_t
+// --------------------------
+// Fixed set of worker threads shared by every file. Handlers holding the
+// token (HANDLER_TOKEN) wait in the ready queue, at most once each.
+typedef struct worker_pool {
+    pthread_t *threads;
+    int size;
+
+    queue_t *ready; // file_handler_t pointers with requests to run
+    int idle;       // Workers asleep on cond; schedulers only signal when nonzero
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} worker_pool_t;
+
+// Type:        handler_stats_t
+// ----------------------------
+// Counters describing file handler turnover
+typedef struct handler_stats {
+    unsigned long live;      // Handlers currently in file_map
+    unsigned long created;   // Handlers created since start
+    unsigned long reclaimed; // Handlers retired after sitting idle past the TTL
+} handler_stats_t;
+
+// Global Variables
+extern file_map_t file_map;
+extern worker_pool_t worker_pool; // Threads processing requests for all files // Stores file handlers for files that have been queried at runtime
+extern int shutdown_signal; // Flag for terminating sleeping threads
+
 // Type:        client_t
 // --------------------
 // Capsule for passing client socket fds
 typedef struct client {
     int socket_desc;
+    access_mode_t mode;
+    void *context;
 } client_t;
 
 // Function:    make_request
 // -------------------------
 // Searches file_map for a file_handler_t with a matching filename
-// Creates a new one and pushes to file_map if none
+// Creates a new one and adds it to file_map if none
 //
 // filename:    requested filename
 // socket_desc: fd for client socket
-void make_request(char* filename, int socket_desc, request_handler_fn handler_fn);
+// mode:        ACCESS_SHARED for reads, ACCESS_EXCLUSIVE for modifications
+// handler_fn:  process run by the file worker for this request
+// context:     request state passed through to handler_fn
+void make_request(char* filename, int socket_desc, access_mode_t mode, request_handler_fn handler_fn, void *context);
 
 // Function:    file_worker
 // ------------------------
-// Iteratively processes clients in a handler's queue
+// Pool worker: processes requests from ready file handlers in per-file FIFO order,
+// running consecutive shared requests for one file concurrently
 void *file_worker(void *arg);
 
-// Function:    map_init
-// ---------------------
-// Initializes file_map
-void waiting_room_init(void);
+// Function:    reclaim_idle_handlers
+// ----------------------------------
+// Retires file handlers idle for at least the TTL; run periodically by the reaper
+//
+// now:         current time
+//
+// returns number of handlers reclaimed
+int reclaim_idle_handlers(time_t now);
+
+// Function:    set_reaper_task
+// ----------------------------
+// Has the reaper run a sweep of its own on every pass; set it before
+// waiting_room_init
+//
+// task:        sweep to run, NULL for none
+void set_reaper_task(reaper_task_fn task);
+
+// Function:    get_handler_stats
+// ------------------------------
+// Copies the live/created/reclaimed handler counters
+void get_handler_stats(handler_stats_t *stats);
+
+// Function:    get_client_stats
+// -----------------------------
+// Copies the pool counters for client_t allocations
+void get_client_stats(slab_stats_t *stats);
+
+// Function:    waiting_room_init
+// ------------------------------
+// Initializes file_map and starts the worker pool and handler reaper
+//
+// workers:     number of pool threads, 0 for one per online core
+// ttl:         seconds an idle file handler is kept, 0 for HANDLER_IDLE_TTL
+void waiting_room_init(int workers, int ttl);
 
 // Function:    cleanup_waiting_room
 // --------------------------------
-// Destroys all threads indicated by file_map
+// Lets the pool finish queued requests, joins it and frees every file handler
 void cleanup_waiting_room(void);
 
-#endif //WAITINGROOM_H
\ No newline at end of file
+#endif //WAITINGROOM_H
@@ -0,0 +1,372 @@
+/*
+ * cache.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Byte-bounded LRU cache of file contents for hot GETs
+ */
+
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAFE_FREE(p) do { if (p) { free(p); p = NULL; } } while (0)
+
+content_cache_t content_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Helper Function:    hash_path
+// -----------------------------
+// FNV-1a hash of a path
+//
+// returns 64-bit hash
+static uint64_t hash_path(const char *path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *)path; *c; c++)
+    {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Helper Function:    find_entry
+// ------------------------------
+// Finds the cached entry for a path
+// Caller must hold content_cache.lock
+//
+// returns pointer to the bucket link holding the entry, or to the chain's final NULL
+static cache_entry_t **find_entry(const char *path, uint64_t hash)
+{
+    cache_entry_t **link = &content_cache.buckets[hash & (CACHE_BUCKETS - 1)];
+    while (*link && ((*link)->hash != hash || strcmp((*link)->path, path) != 0))
+        link = &(*link)->next;
+    return link;
+}
+
+// Helper Function:    lru_unlink
+// ------------------------------
+// Takes an entry out of the LRU list
+// Caller must hold content_cache.lock
+static void lru_unlink(cache_entry_t *entry)
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        content_cache.lru_head = entry->lru_next;
+
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        content_cache.lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+// Helper Function:    lru_push_front
+// ----------------------------------
+// Makes an entry the most recently used
+// Caller must hold content_cache.lock
+static void lru_push_front(cache_entry_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = content_cache.lru_head;
+    if (content_cache.lru_head)
+        content_cache.lru_head->lru_prev = entry;
+    else
+        content_cache.lru_tail = entry;
+    content_cache.lru_head = entry;
+}
+
+// Helper Function:    free_entry
+// ------------------------------
+// Frees an entry's memory
+static void free_entry(cache_entry_t *entry)
+{
+    SAFE_FREE(entry->path);
+    SAFE_FREE(entry->data);
+    SAFE_FREE(entry);
+}
+
+// Helper Function:    remove_entry
+// --------------------------------
+// Takes an entry out of the table and LRU list and drops the cache's reference
+// Caller must hold content_cache.lock
+//
+// link:        bucket link holding the entry, from find_entry
+//
+// returns the entry if it should now be freed, NULL if a GET still holds it
+static cache_entry_t *remove_entry(cache_entry_t **link)
+{
+    cache_entry_t *entry = *link;
+    *link = entry->next;
+    lru_unlink(entry);
+
+    content_cache.stats.bytes -= entry->size;
+    content_cache.stats.entries--;
+
+    return --entry->refs == 0 ? entry : NULL;
+}
+
+// Function:    cache_init
+// -----------------------
+// Prepares the cache
+//
+// capacity:    bytes of file data to keep, 0 disables caching
+void cache_init(size_t capacity)
+{
+    pthread_mutex_lock(&content_cache.lock);
+    content_cache.capacity = capacity;
+    content_cache.max_entry = capacity < CACHE_MAX_ENTRY ? capacity : CACHE_MAX_ENTRY;
+    pthread_mutex_unlock(&content_cache.lock);
+}
+
+// Function:    cache_admits
+// -------------------------
+// Checks whether a file of this size is worth reading into the cache
+//
+// returns 1 if it would be cached, 0 otherwise
+int cache_admits(uint64_t size)
+{
+    return size > 0 && size <= content_cache.max_entry;
+}
+
+// Function:    cache_lookup
+// -------------------------
+// Finds a cached file and marks it most recently used, provided it still
+// holds the version on disk. Invalidation only covers changes made through
+// the same path, so a file replaced through another name for it, or outside
+// the server, is caught here: its stale entry is dropped and counts as a miss.
+//
+// path:        file path as requested
+// version:     file_version of the file now, 0 if it's gone
+//
+// returns referenced entry to pass to cache_release, NULL on a miss
+cache_entry_t *cache_lookup(const char *path, uint64_t version)
+{
+    if (content_cache.capacity == 0)
+        return NULL;
+
+    uint64_t hash = hash_path(path);
+    cache_entry_t *dead = NULL;
+    pthread_mutex_lock(&content_cache.lock);
+    cache_entry_t **link = find_entry(path, hash);
+    cache_entry_t *entry = *link;
+    if (entry && entry->version != version)
+    {
+        dead = remove_entry(link);
+        content_cache.stats.invalidations++;
+        entry = NULL;
+    }
+    if (entry)
+    {
+        entry->refs++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+        content_cache.stats.hits++;
+    }
+    else
+        content_cache.stats.misses++;
+    pthread_mutex_unlock(&content_cache.lock);
+
+    if (dead)
+        free_entry(dead);
+    return entry;
+}
+
+// Function:    cache_release
+// --------------------------
+// Drops a reference taken by cache_lookup
+void cache_release(cache_entry_t *entry)
+{
+    pthread_mutex_lock(&content_cache.lock);
+    int last = --entry->refs == 0;
+    pthread_mutex_unlock(&content_cache.lock);
+
+    if (last)
+        free_entry(entry);
+}
+
+// Function:    cache_epoch
+// ------------------------
+// Reads the invalidation counter covering a path; take it before reading the
+// file and hand it to cache_insert
+//
+// returns current epoch for path
+uint64_t cache_epoch(const char *path)
+{
+    uint64_t hash = hash_path(path);
+    pthread_mutex_lock(&content_cache.lock);
+    uint64_t epoch = content_cache.epochs[hash % CACHE_EPOCHS];
+    pthread_mutex_unlock(&content_cache.lock);
+    return epoch;
+}
+
+// Function:    cache_insert
+// -------------------------
+// Adds file contents read by a GET, evicting least recently used entries to
+// make room. Skipped if the path was invalidated since epoch was taken, so a
+// reader that raced a WRITE can't cache the old contents.
+//
+// path:        file path as requested
+// data:        malloc'd contents, owned by the cache afterwards
+// size:        bytes in data
+// version:     file_version of the file read
+// checksum:    CRC32C of the whole contents
+// epoch:       value of cache_epoch(path) from before the file was read
+void cache_insert(const char *path, char *data, size_t size, uint64_t version, uint32_t checksum, uint64_t epoch)
+{
+    if (!cache_admits(size))
+    {
+        free(data);
+        return;
+    }
+
+    cache_entry_t *entry = malloc(sizeof(cache_entry_t));
+    char *path_copy = strdup(path);
+    if (!entry || !path_copy)
+    {
+        fprintf(stderr, "cache.cache_insert: memory allocation failed for %s\n", path);
+        free(entry);
+        free(path_copy);
+        free(data);
+        return;
+    }
+    entry->path = path_copy;
+    entry->hash = hash_path(path);
+    entry->data = data;
+    entry->size = size;
+    entry->version = version;
+    entry->checksum = checksum;
+    entry->refs = 1;
+
+    cache_entry_t *evicted = NULL;
+    pthread_mutex_lock(&content_cache.lock);
+
+    // Another GET may have cached it first, or a WRITE/RM may have landed meanwhile
+    cache_entry_t **link = find_entry(path, entry->hash);
+    if (*link || content_cache.epochs[entry->hash % CACHE_EPOCHS] != epoch)
+    {
+        pthread_mutex_unlock(&content_cache.lock);
+        free_entry(entry);
+        return;
+    }
+
+    // Make room, collecting unreferenced victims to free outside the lock
+    while (content_cache.stats.bytes + size > content_cache.capacity && content_cache.lru_tail)
+    {
+        cache_entry_t *victim = content_cache.lru_tail;
+        cache_entry_t *dead = remove_entry(find_entry(victim->path, victim->hash));
+        content_cache.stats.evictions++;
+        if (dead)
+        {
+            dead->next = evicted;
+            evicted = dead;
+        }
+    }
+
+    entry->next = content_cache.buckets[entry->hash & (CACHE_BUCKETS - 1)];
+    content_cache.buckets[entry->hash & (CACHE_BUCKETS - 1)] = entry;
+    lru_push_front(entry);
+    content_cache.stats.bytes += size;
+    content_cache.stats.entries++;
+    pthread_mutex_unlock(&content_cache.lock);
+
+    while (evicted)
+    {
+        cache_entry_t *next = evicted->next;
+        free_entry(evicted);
+        evicted = next;
+    }
+}
+
+// Function:    cache_invalidate
+// -----------------------------
+// Drops a path after the file changed (WRITE) or disappeared (RM)
+void cache_invalidate(const char *path)
+{
+    if (content_cache.capacity == 0)
+        return;
+
+    uint64_t hash = hash_path(path);
+    cache_entry_t *dead = NULL;
+
+    pthread_mutex_lock(&content_cache.lock);
+    content_cache.epochs[hash % CACHE_EPOCHS]++;
+    cache_entry_t **link = find_entry(path, hash);
+    if (*link)
+    {
+        dead = remove_entry(link);
+        content_cache.stats.invalidations++;
+    }
+    pthread_mutex_unlock(&content_cache.lock);
+
+    if (dead)
+        free_entry(dead);
+}
+
+// Function:    checksum_lookup
+// ----------------------------
+// Finds the CRC32C of a whole file computed by an earlier GET
+//
+// returns 1 on a hit, 0 on a miss
+int checksum_lookup(uint64_t version, uint64_t size, uint32_t *checksum)
+{
+    checksum_slot_t *slot = &content_cache.checksums[version & (CHECKSUM_SLOTS - 1)];
+    int hit;
+
+    pthread_mutex_lock(&content_cache.lock);
+    hit = slot->version == version && slot->size == size;
+    if (hit)
+    {
+        *checksum = slot->checksum;
+        content_cache.stats.checksum_hits++;
+    }
+    else
+        content_cache.stats.checksum_misses++;
+    pthread_mutex_unlock(&content_cache.lock);
+    return hit;
+}
+
+// Function:    checksum_insert
+// ----------------------------
+// Remembers the CRC32C of a whole file, replacing whatever shared its slot
+void checksum_insert(uint64_t version, uint64_t size, uint32_t checksum)
+{
+    checksum_slot_t *slot = &content_cache.checksums[version & (CHECKSUM_SLOTS - 1)];
+
+    pthread_mutex_lock(&content_cache.lock);
+    slot->version = version;
+    slot->size = size;
+    slot->checksum = checksum;
+    pthread_mutex_unlock(&content_cache.lock);
+}
+
+// Function:    get_cache_stats
+// ----------------------------
+// Copies the cache counters
+void get_cache_stats(cache_stats_t *stats)
+{
+    pthread_mutex_lock(&content_cache.lock);
+    *stats = content_cache.stats;
+    pthread_mutex_unlock(&content_cache.lock);
+}
+
+// Function:    cache_cleanup
+// --------------------------
+// Frees every entry no longer referenced
+void cache_cleanup(void)
+{
+    pthread_mutex_lock(&content_cache.lock);
+    while (content_cache.lru_tail)
+    {
+        cache_entry_t *victim = content_cache.lru_tail;
+        cache_entry_t *dead = remove_entry(find_entry(victim->path, victim->hash));
+        if (dead)
+            free_entry(dead);
+    }
+    content_cache.capacity = 0;
+    pthread_mutex_unlock(&content_cache.lock);
+}
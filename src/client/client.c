@@ -9,7 +9,81 @@
  *
  *	 Custom implementation of client.c from provided template
  */
+#include <signal.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include "messenger.h"
+#include "delta.h"
+#include "store.h"
+
+#define SESSION_LINE_MAX 4096
+#define BATCH_CONNECTIONS 4 // Connections a batch is spread over unless RFS_STREAMS says otherwise
+#define BATCH_WINDOW 32     // Requests a batch connection keeps in flight
+#define STRIPES_SUFFIX ".stripes" // Appended to the hidden name a striped GET collects into
+
+// Type:        stripe_t
+// ---------------------
+// One range of a striped transfer, moved over its own connection
+typedef struct stripe {
+    char *target;       // File on the server
+    int fd;             // Local file, shared by every stripe through positional I/O
+    uint64_t offset;
+    uint64_t length;
+    uint64_t version;   // File version every stripe of a GET must see
+    uint64_t upload_id; // Upload every stripe of a WRITE lands in
+    int result;         // 0 on success, -1 if refused, 1 if the connection failed
+    uint64_t acknowledged; // Bytes of a WRITE stripe the server reported stored
+} stripe_t;
+
+// Type:        batch_item_t
+// -------------------------
+// One file of an MGET or MPUT
+typedef struct batch_item {
+    char *source;      // Remote file for MGET, local file for MPUT
+    char *destination; // Local file for MGET, remote file for MPUT
+    uint64_t bytes;    // File bytes moved
+    int result;        // 0 on success, -1 if refused, 1 if its connection was lost or it was never sent
+    char message[RESPONSE_MESSAGE_MAX];
+} batch_item_t;
+
+// Type:        batch_t
+// --------------------
+// A batch of GETs or WRITEs shared out over a few connections; each
+// connection claims the next unclaimed file as it has room for it
+typedef struct batch {
+    uint8_t op; // OP_GET or OP_WRITE
+    batch_item_t *items;
+    int count;
+    int next;   // First item no connection has claimed yet
+    pthread_mutex_t lock;
+} batch_t;
+
+// Type:        batch_lane_t
+// -------------------------
+// One connection of a batch. Its sender keeps up to BATCH_WINDOW requests in
+// flight while its receiver reads their replies, which come back in order.
+typedef struct batch_lane {
+    batch_t *batch;
+    int socket_desc;
+    int *order;   // Items in the order their requests went out
+    int sent;
+    int answered;
+    int finished; // The sender has nothing more to send
+    int lost;     // The connection failed, nothing more goes out
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} batch_lane_t;
+
+int stream_count = 1; // Connections per large transfer, from RFS_STREAMS
+int batch_connections = BATCH_CONNECTIONS; // Connections per MGET or MPUT, from RFS_STREAMS
+int delta_enabled = 0; // Send WRITEs as deltas against the server's copy, from RFS_DELTA
+int compress_enabled = 0; // Compress WRITEs and accept compressed GETs, from RFS_COMPRESS
+int dedup_enabled = 0; // Offer WRITEs by content hash before sending them, from RFS_DEDUP
+int checksum_enabled = 1; // CRC32C every GET and WRITE end to end, off with RFS_CHECKSUM=0
+int terminal_width = 0; // Columns for progress bars, 0 when stdout isn't a terminal
 
 // Function: clean_up
 // ------------------
@@ -20,170 +94,856 @@ void clean_up(char *response, int socket_desc)
     close(socket_desc);
 }
 
+// Helper Function:    show_progress
+// ---------------------------------
+// Progress callback drawing a bar of '#'s across the terminal as a transfer
+// runs, then its size, duration and rate once it ends
+//
+// progress: report of the transfer; mark is 1 + the columns drawn once the
+//           bar's line has been started
+// context: terminal width in columns, 0 for no bar
+void show_progress(transfer_progress_t *progress, void *context)
+{
+    int width = *(int *)context;
+    if (width > 0)
+    {
+        if (progress->mark == 0)
+        {
+            fputc('\n', stdout);
+            progress->mark = 1;
+        }
+        int columns = progress->total ? (int)((double)progress->bytes / (double)progress->total * width) : width;
+        for (; progress->mark <= columns; progress->mark++)
+            fputc('#', stdout);
+    }
+
+    if (progress->done)
+        fprintf(stdout, "%sclient: %" PRIu64 " bytes in %.2f s, %.1f MB/s\n", width > 0 ? "\n" : "",
+                progress->bytes, progress->elapsed, progress->rate / 1e6);
+    fflush(stdout);
+}
+
 // Function:    handle_error
 // -------------------------
 // Handles errors in the client
 //
-// response:    server response message
-// socket_desc: fd for client socket
 // msg:         error message
-// server_msg:  optional message sent to server
-int handle_error(char *response, int socket_desc, char *msg, char *server_msg)
+// result:      value handed back to the caller (-1 request failed, 1 connection lost)
+//
+// returns result
+int handle_error(char *msg, int result)
 {
     fprintf(stderr, "\n%s\n", msg);
-    if (server_msg)
-        send_msg(server_msg, socket_desc);
-    clean_up(response, socket_desc);
-    return -1;
+    return result;
 }
 
 // Function:    handle_outbound
 // ----------------------------
-// Passes a command and a target to a TCP socket and confirms receipt
+// Passes a request header to the server in a single frame
 //
-// cmd: string command to be issued
+// op:          OP_* operation
+// target:      target filename on the server
+// size:        size of the data that follows the header (WRITE), or of the range wanted (GET)
+// offset:      first byte wanted (GET) or sent (resumable WRITE)
+// upload_id:   resumable upload ID, sent when flags has REQUEST_UPLOAD
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd
 //
 // returns 0 on success, -1 on failure
-int handle_outbound(char *cmd, char *target, int socket_desc)
+int handle_outbound(uint8_t op, char *target, uint64_t size, uint64_t offset, uint64_t upload_id,
+                    uint16_t flags, int socket_desc)
 {
-    // Notify the server
-    if(!send_msg(cmd, socket_desc))
+    request_t request;
+    memset(&request, 0, sizeof(request));
+    request.op = op;
+    request.size = size;
+    request.offset = offset;
+    request.upload_id = upload_id;
+    request.flags = flags;
+
+    if (strlen(target) >= TARGET_MAX)
     {
-        fprintf(stderr, "client.handle_outbound: unable to reach server for %s request\n", cmd);
+        fprintf(stderr, "client.handle_outbound: target %s is too long\n", target);
         return -1;
     }
+    strcpy(request.target, target);
 
-    // Wait until server is ready
-    char *response = receive_msg(socket_desc);
-    if(!response)
+    // Notify the server
+    if (send_request(socket_desc, &request) == -1)
     {
-        fprintf(stderr, "client.handle_outbound: error receiving server's response for %s request\n", cmd);
+        fprintf(stderr, "client.handle_outbound: unable to reach server for request on %s\n", target);
         return -1;
     }
+    return 0;
+}
 
-    if (strcmp(response, "GO") == 0) // Approval is given
+// Helper Function:    make_upload_id
+// ----------------------------------
+// Derives a resumable upload's ID from its target and the identity of the
+// local file, so rerunning the same WRITE finds the bytes an interrupted one
+// left on the server, while a changed file starts a fresh upload. Striped
+// uploads lay their bytes out differently, so the stream count is mixed in.
+//
+// target:      target filename on the server
+// info:        stat of the local file
+// streams:     connections the upload is spread over
+//
+// returns upload ID
+uint64_t make_upload_id(const char *target, const struct stat *info, int streams)
+{
+    uint64_t identity[6] = { (uint64_t)info->st_dev, (uint64_t)info->st_ino, (uint64_t)info->st_size,
+                             (uint64_t)info->st_mtim.tv_sec, (uint64_t)info->st_mtim.tv_nsec, (uint64_t)streams };
+    uint64_t hash = 14695981039346656037ULL;
+
+    // FNV-1a over the target and the file identity
+    for (const unsigned char *c = (const unsigned char *)target; *c; c++)
+        hash = (hash ^ *c) * 1099511628211ULL;
+    for (size_t i = 0; i < sizeof(identity); i++)
+        hash = (hash ^ ((const unsigned char *)identity)[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// Helper Function:    send_upload
+// -------------------------------
+// Sends a range of a local file the way its WRITE request announced it:
+// compressed or raw, followed by its CRC32C when REQUEST_CHECKSUM is set.
+// A resumed upload's CRC32C starts at byte 0, so the server can check the
+// bytes it kept too; a stripe's covers only its range.
+//
+// fd:          local file opened with open_file
+// offset/length: range to send
+// flags:       REQUEST_* flags of the WRITE
+// socket_desc: client socket fd
+// wire_bytes:  receives the bytes sent for a compressed range, or NULL
+//
+// returns 0 on success, -1 on file read errors, 1 for connection errors
+int send_upload(int fd, uint64_t offset, uint64_t length, uint16_t flags, int socket_desc, uint64_t *wire_bytes)
+{
+    uint32_t checksum = 0;
+    uint32_t *running = (flags & REQUEST_CHECKSUM) ? &checksum : NULL;
+    if (running && !(flags & REQUEST_STRIPE) && checksum_file(fd, 0, offset, running) == -1)
+        return -1;
+
+    int sent = (flags & REQUEST_COMPRESS) ? send_compressed(fd, NULL, offset, length, socket_desc, wire_bytes, running)
+                                          : send_file_range(fd, offset, length, socket_desc, running);
+    if (sent == 0 && running && send_checksum(socket_desc, checksum) == -1)
+        sent = 1;
+    return sent;
+}
+
+// Helper Function:    response_encoding
+// -------------------------------------
+// TRANSFER_* flags of the data following a GET response
+int response_encoding(const response_t *response)
+{
+    return ((response->flags & RESPONSE_COMPRESSED) ? TRANSFER_COMPRESSED : 0) |
+           ((response->flags & RESPONSE_CHECKSUM) ? TRANSFER_CHECKSUM : 0);
+}
+
+// Helper Function:    handle_resumable_write
+// ------------------------------------------
+// Uploads a large file under an upload ID: asks the server how much of it
+// already arrived, then sends only the rest
+//
+// fd/file_size: local file opened with open_file
+// target:      target filename
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd
+//
+// returns 0 on success, -1 if the request failed, 1 if the connection was lost
+int handle_resumable_write(int fd, uint64_t file_size, char *target, uint16_t flags, int socket_desc)
+{
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+        return handle_error("client: error opening file during WRITE\n", -1);
+    uint64_t upload_id = make_upload_id(target, &info, 1);
+
+    // Ask how much of this upload the server already holds
+    response_t response;
+    if (handle_outbound(OP_STATUS, target, 0, 0, upload_id, REQUEST_UPLOAD | REQUEST_KEEPALIVE, socket_desc) == -1 ||
+        receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting upload status for WRITE\n", 1);
+    uint64_t offset = (response.status == STATUS_OK && response.size <= file_size) ? response.size : 0;
+    uint16_t encoding = (compress_enabled && should_compress(target, fd, NULL, offset, file_size - offset)
+                         ? REQUEST_COMPRESS : 0) | (checksum_enabled ? REQUEST_CHECKSUM : 0);
+
+    for (;;)
     {
-        // Free original response
-        SAFE_FREE(response);
-        response = NULL;
+        if (offset > 0)
+            fprintf(stdout, "client: resuming upload of %s at byte %" PRIu64 "\n", target, offset);
+
+        // Keep the connection if the resume is refused, so the retry can reuse it
+        uint16_t attempt_flags = REQUEST_UPLOAD | encoding | (offset > 0 ? (flags | REQUEST_KEEPALIVE) : flags);
+        if (handle_outbound(OP_WRITE, target, file_size, offset, upload_id, attempt_flags, socket_desc) == -1)
+            return handle_error("client: WRITE request could not be sent\n", 1);
+
+        int sent = send_upload(fd, offset, file_size - offset, attempt_flags, socket_desc, NULL);
+        if (sent == 1)
+            return handle_error("client: lost connection during WRITE\n", 1);
+        if (sent != 0) // The size is already on the wire, so the stream can't be resynchronised
+            return handle_error("client: error reading file during WRITE\n", 1);
+
+        if (receive_response(socket_desc, &response) == -1)
+            return handle_error("client: error getting server response after WRITE\n", 1);
 
-        // Send target filename
-        if(!send_msg(target, socket_desc))
+        // The server lost what it had, send everything
+        if (response.status == STATUS_BAD_RANGE && offset > 0)
         {
-            fprintf(stderr, "client.handle_outbound: error sending target %s to server\n", target);
-            return -1;
+            offset = 0;
+            continue;
         }
+        break;
+    }
+
+    fprintf(stdout, "server: %s\n", response.message);
+    return response.status == STATUS_OK ? 0 : -1;
+}
 
-        // Get approval from server
-        response = receive_msg(socket_desc);
-        if(!response)
+// Helper Function:    run_stripes
+// -------------------------------
+// Runs one thread per stripe and waits for all of them
+//
+// stripes:     ranges to move
+// count:       number of stripes
+// routine:     thread body, get_stripe or write_stripe
+//
+// returns 0 if every stripe succeeded, -1 if one was refused, 1 if a connection failed
+int run_stripes(stripe_t *stripes, int count, void *(*routine)(void *))
+{
+    pthread_t threads[MAX_STREAMS];
+    int started = 0, result = 0;
+
+    for (; started < count; started++)
+        if (pthread_create(&threads[started], NULL, routine, &stripes[started]) != 0)
         {
-            fprintf(stderr, "client.handle_outbound: error getting server response about target %s\n", target);
-            return -1;
+            fprintf(stderr, "client: unable to start stripe %d\n", started);
+            result = 1;
+            break;
         }
 
-        // If the signal is given to proceed
-        if (strcmp(response, "CONTINUE") == 0)
-        {
-            SAFE_FREE(response);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (stripes[i].result == 1 || (stripes[i].result == -1 && result == 0))
+            result = stripes[i].result;
+    }
+    return result;
+}
+
+// Helper Function:    split_stripes
+// ---------------------------------
+// Divides a file into stream_count nearly equal ranges
+//
+// stripes:     array of stream_count stripes to fill in
+// file_size:   bytes to divide
+void split_stripes(stripe_t *stripes, uint64_t file_size)
+{
+    for (int i = 0; i < stream_count; i++)
+    {
+        stripes[i].offset = file_size / stream_count * i;
+        stripes[i].length = (i == stream_count - 1 ? file_size : file_size / stream_count * (i + 1))
+                          - stripes[i].offset;
+        stripes[i].result = 1;
+        stripes[i].acknowledged = 0;
+    }
+}
+
+// Helper Function:    stripes_acknowledged
+// ----------------------------------------
+// Confirms that the server answered STATUS_OK for every stripe of a WRITE
+// and that the ranges it acknowledged cover the file end to end
+//
+// stripes:     stripes as left by run_stripes
+// count:       number of stripes
+// file_size:   bytes in the whole file
+//
+// returns 1 if every byte was acknowledged, 0 otherwise
+int stripes_acknowledged(const stripe_t *stripes, int count, uint64_t file_size)
+{
+    uint64_t covered = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (stripes[i].result != 0 || stripes[i].offset != covered ||
+            stripes[i].acknowledged != stripes[i].length)
             return 0;
-        }
-        else
-        {
-            fprintf(stderr, "client.handle_outbound: session aborted by server before file could be sent\n");
-            SAFE_FREE(response);
-            return -1;
-        }
+        covered += stripes[i].length;
     }
-    else
+    return covered == file_size;
+}
+
+// Helper Function:    write_stripe
+// --------------------------------
+// Thread body sending one range of a striped WRITE over a new connection
+void *write_stripe(void *arg)
+{
+    stripe_t *stripe = (stripe_t *)arg;
+    int socket_desc = client_init();
+    if (socket_desc < 0)
+        return NULL;
+
+    response_t response;
+    uint16_t flags = REQUEST_UPLOAD | REQUEST_STRIPE | (checksum_enabled ? REQUEST_CHECKSUM : 0);
+    if (handle_outbound(OP_WRITE, stripe->target, stripe->length, stripe->offset, stripe->upload_id,
+                        flags, socket_desc) == 0 &&
+        send_upload(stripe->fd, stripe->offset, stripe->length, flags, socket_desc, NULL) == 0 &&
+        receive_response(socket_desc, &response) == 0)
     {
-        fprintf(stderr, "client.handle_outbound: session aborted by server before filename could be processed\n");
-        SAFE_FREE(response);
+        stripe->result = response.status == STATUS_OK ? 0 : -1;
+        stripe->acknowledged = response.status == STATUS_OK ? response.size : 0;
+        if (stripe->result)
+            fprintf(stderr, "server: %s\n", response.message);
+    }
+
+    close(socket_desc);
+    return NULL;
+}
+
+// Helper Function:    reopen_connection
+// -------------------------------------
+// Replaces a connection the server may have closed while it sat idle with a
+// fresh one under the same descriptor, so whoever holds it carries on
+//
+// socket_desc: client socket fd
+//
+// returns 0 on success, -1 if the server can't be reached
+int reopen_connection(int socket_desc)
+{
+    int fresh = client_init();
+    if (fresh < 0)
         return -1;
+    int moved = dup2(fresh, socket_desc);
+    close(fresh);
+    return moved == -1 ? -1 : 0;
+}
+
+// Helper Function:    handle_striped_write
+// ----------------------------------------
+// Uploads a large file over stream_count connections at once, each sending
+// one range into the same upload on the server, then publishes it with
+// COMMIT. The caller's connection sits idle while the stripes run and the
+// server may close it meanwhile, so it is reopened for the COMMIT.
+//
+// fd/file_size: local file opened with open_file
+// target:      target filename
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd, reopened and left open
+//
+// returns 0 on success, -1 if the request failed, 1 if the connection was lost
+int handle_striped_write(int fd, uint64_t file_size, char *target, uint16_t flags, int socket_desc)
+{
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+        return handle_error("client: error opening file during WRITE\n", -1);
+
+    stripe_t stripes[MAX_STREAMS];
+    split_stripes(stripes, file_size);
+    for (int i = 0; i < stream_count; i++)
+    {
+        stripes[i].target = target;
+        stripes[i].fd = fd;
+        stripes[i].upload_id = make_upload_id(target, &info, stream_count);
+    }
+
+    int result = run_stripes(stripes, stream_count, write_stripe);
+    if (reopen_connection(socket_desc) == -1)
+        return handle_error("client: unable to reconnect after striped WRITE\n", 1);
+    if (result == 1)
+        return handle_error("client: lost connection during striped WRITE\n", -1);
+    if (result == -1)
+        return handle_error("client: striped WRITE rejected by server\n", -1);
+
+    // Publish the file only once the server has confirmed storing every range
+    if (!stripes_acknowledged(stripes, stream_count, file_size))
+        return handle_error("client: server did not acknowledge every stripe of the WRITE\n", -1);
+
+    response_t response;
+    if (handle_outbound(OP_COMMIT, target, file_size, 0, stripes[0].upload_id, flags | REQUEST_UPLOAD,
+                        socket_desc) == -1 ||
+        receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting server response after COMMIT\n", 1);
+
+    fprintf(stdout, "server: %s\n", response.message);
+    return response.status == STATUS_OK ? 0 : -1;
+}
+
+// Helper Function:    handle_delta_write
+// --------------------------------------
+// Uploads only what changed: fetches the block signature of the server's
+// copy, rolls a checksum along the local file to find the blocks it still
+// shares, and sends copy instructions for those and the bytes in between.
+// Both requests keep the connection, so a full WRITE can follow on it.
+//
+// fd/file_size: local file opened with open_file
+// target:      target filename
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd
+//
+// returns 0 on success, 1 if the connection was lost, 2 if the file should
+// be sent in full instead (no server copy, no savings, or the delta was refused)
+int handle_delta_write(int fd, uint64_t file_size, char *target, uint16_t flags, int socket_desc)
+{
+    response_t response;
+    if (handle_outbound(OP_SIGNATURE, target, 0, 0, 0, flags | REQUEST_KEEPALIVE, socket_desc) == -1 ||
+        receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting signature for WRITE\n", 1);
+    if (response.status != STATUS_OK) // Nothing to diff against
+        return 2;
+
+    signature_t signature;
+    int received = receive_signature(socket_desc, response.size, &signature);
+    if (received == 1)
+        return handle_error("client: lost connection receiving signature for WRITE\n", 1);
+    if (received == -1)
+        return 2;
+
+    // Stage the delta in a temporary file, its size has to lead the request
+    unsigned char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    FILE *delta = data == MAP_FAILED ? NULL : tmpfile();
+    int made = delta ? make_delta(data, file_size, &signature, response.version, delta) : -1;
+    if (data != MAP_FAILED)
+        munmap(data, file_size);
+    free_signature(&signature);
+
+    long delta_size = (made == 0 && fflush(delta) == 0) ? ftell(delta) : -1;
+    if (delta_size < 0 || (uint64_t)delta_size >= file_size)
+    {
+        if (delta)
+            fclose(delta);
+        return 2;
+    }
+    fprintf(stdout, "client: sending %s as a %ld byte delta of %" PRIu64 " bytes\n", target, delta_size, file_size);
+
+    if (handle_outbound(OP_DELTA, target, (uint64_t)delta_size, 0, 0, flags | REQUEST_KEEPALIVE, socket_desc) == -1)
+    {
+        fclose(delta);
+        return handle_error("client: WRITE request could not be sent\n", 1);
     }
+    int sent = send_file(fileno(delta), (uint64_t)delta_size, socket_desc);
+    fclose(delta);
+    if (sent != 0) // The size is already on the wire, so the stream can't be resynchronised
+        return handle_error("client: lost connection during WRITE\n", 1);
+
+    if (receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting server response after WRITE\n", 1);
+
+    fprintf(stdout, "server: %s\n", response.message);
+    return response.status == STATUS_OK ? 0 : 2;
+}
+
+// Helper Function:    handle_link_write
+// -------------------------------------
+// Offers a WRITE by content hash: if the server already holds those bytes it
+// stores them under the target and nothing more is sent. The request keeps
+// the connection, so a full WRITE can follow on it. Hashing a large file can
+// outlast the server's idle timeout; if the offer then finds the connection
+// closed, a fresh one takes its place for the full WRITE.
+//
+// fd/file_size: local file opened with open_file
+// target:      target filename
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd
+//
+// returns 0 on success, 1 if the connection was lost, 2 if the file should
+// be sent instead (the server doesn't hold it, or keeps no content store)
+int handle_link_write(int fd, uint64_t file_size, char *target, uint16_t flags, int socket_desc)
+{
+    request_t request;
+    memset(&request, 0, sizeof(request));
+    request.op = OP_LINK;
+    request.size = file_size;
+    request.flags = flags | REQUEST_HASH | REQUEST_KEEPALIVE;
+    if (strlen(target) >= TARGET_MAX || content_hash(fd, file_size, request.content_hash) == -1)
+        return 2;
+    strcpy(request.target, target);
+
+    response_t response;
+    if (send_request(socket_desc, &request) == -1 || receive_response(socket_desc, &response) == -1)
+    {
+        if (reopen_connection(socket_desc) == -1)
+            return handle_error("client: error offering content hash for WRITE\n", 1);
+        fprintf(stdout, "client: connection closed while hashing %s, sending it in full\n", target);
+        return 2;
+    }
+    if (response.status != STATUS_OK)
+        return 2;
+
+    fprintf(stdout, "client: server already holds the contents of %s, %" PRIu64 " bytes not sent\n",
+            target, file_size);
+    fprintf(stdout, "server: %s\n", response.message);
+    return 0;
 }
 
 // Function:    handle_write
 // -------------------------
-// Handling outbound write requests
+// Handling outbound write requests: header and file data go out back to back
+// and the server answers once. Files of RESUMABLE_WRITE_MIN bytes or more are
+// uploaded resumably, so retrying an interrupted WRITE only sends the rest,
+// or striped over RFS_STREAMS connections when more than one is asked for.
+// With RFS_DEDUP set, the file is first offered by content hash, and not
+// sent at all if the server already holds it. With RFS_DELTA set, a file the
+// server already holds is sent as a delta against its copy first. With RFS_COMPRESS set, plain and resumable uploads
+// are compressed when should_compress finds it worthwhile. Unless RFS_CHECKSUM=0, the data is followed by its CRC32C
+// and the server stores nothing that fails it.
 //
+// source:      local filename
 // target:      target filename
+// flags:       REQUEST_* flags
 // socket_desc: client socket fd
 //
-// returns 0 on success, 1 on file error, -1 on connection error
-int handle_write(char *target, int socket_desc)
+// returns 0 on success, -1 if the request failed, 1 if the connection was lost
+int handle_write(char *source, char *target, uint16_t flags, int socket_desc)
 {
+    uint64_t file_size;
+    int fd = open_file(source, &file_size);
+    if (fd == -1)
+        return handle_error("client: error opening file during WRITE\n", -1);
+
+    if (dedup_enabled)
+    {
+        int result = handle_link_write(fd, file_size, target, flags, socket_desc);
+        if (result != 2)
+        {
+            close(fd);
+            return result;
+        }
+    }
+
+    if (delta_enabled && file_size >= DELTA_MIN_BLOCK)
+    {
+        int result = handle_delta_write(fd, file_size, target, flags, socket_desc);
+        if (result != 2)
+        {
+            close(fd);
+            return result;
+        }
+        fprintf(stdout, "client: sending %s in full\n", target);
+    }
+
+    if (stream_count > 1 && file_size >= STRIPE_MIN)
+    {
+        int result = handle_striped_write(fd, file_size, target, flags, socket_desc);
+        close(fd);
+        return result;
+    }
+
+    if (file_size >= RESUMABLE_WRITE_MIN)
+    {
+        int result = handle_resumable_write(fd, file_size, target, flags, socket_desc);
+        close(fd);
+        return result;
+    }
+
+    int compressed = compress_enabled && should_compress(source, fd, NULL, 0, file_size);
+    flags |= (compressed ? REQUEST_COMPRESS : 0) | (checksum_enabled ? REQUEST_CHECKSUM : 0);
+    if (handle_outbound(OP_WRITE, target, file_size, 0, 0, flags, socket_desc) == -1)
+    {
+        close(fd);
+        return handle_error("client: WRITE request could not be sent\n", 1);
+    }
+
     // Attempt to send the file
-    int sent = send_file(target, socket_desc);
+    uint64_t wire_bytes;
+    int sent = send_upload(fd, 0, file_size, flags, socket_desc, &wire_bytes);
+    close(fd);
+    if (compressed && sent == 0)
+        fprintf(stdout, "client: %" PRIu64 " bytes compressed to %" PRIu64 "\n", file_size, wire_bytes);
     switch (sent) // Error handling
     {
         case 0:
             break;
         case 1:
-            return handle_error(NULL, socket_desc,
-                                "client: lost connection during WRITE\n",
-                                NULL);
-        case -1:
-            return handle_error(NULL, socket_desc,
-                                "client: error opening file during WRITE\n",
-                                NULL);
+            return handle_error("client: lost connection during WRITE\n", 1);
+        case -1: // The size is already on the wire, so the stream can't be resynchronised
+            return handle_error("client: error reading file during WRITE\n", 1);
         default:
-            return handle_error(NULL, socket_desc,
-                                "client: undefined error during WRITE\n",
-                                NULL);
+            return handle_error("client: undefined error during WRITE\n", 1);
     }
 
     // Wait for server response
-    char *response = receive_msg(socket_desc);
+    response_t response;
+    if (receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting server response after WRITE\n", 1);
+
+    fprintf(stdout, "server: %s\n", response.message);
+    return response.status == STATUS_OK ? 0 : -1;
+}
+
+// Helper Function:    get_stripe
+// ------------------------------
+// Thread body fetching one range of a striped GET over a new connection and
+// writing it into place in the shared destination file
+void *get_stripe(void *arg)
+{
+    stripe_t *stripe = (stripe_t *)arg;
+    int socket_desc = client_init();
+    if (socket_desc < 0)
+        return NULL;
+
+    response_t response;
+    if (handle_outbound(OP_GET, stripe->target, stripe->length, stripe->offset, 0,
+                        checksum_enabled ? REQUEST_CHECKSUM : 0, socket_desc) == 0 &&
+        receive_response(socket_desc, &response) == 0)
+    {
+        // Every stripe has to come from the same version of the file
+        if (response.status != STATUS_OK || response.size != stripe->length || response.version != stripe->version)
+        {
+            fprintf(stderr, "client: %s changed during striped GET\n", stripe->target);
+            stripe->result = -1;
+        }
+        else
+        {
+            uint64_t received;
+            uint32_t checksum = 0;
+            uint32_t *running = (response.flags & RESPONSE_CHECKSUM) ? &checksum : NULL;
+            stripe->result = receive_stream(stripe->fd, stripe->offset, stripe->length, socket_desc, &received,
+                                            running);
+            if (stripe->result == 0 && running && receive_checksum(socket_desc, checksum) != 0)
+            {
+                fprintf(stderr, "client: stripe of %s failed its checksum\n", stripe->target);
+                stripe->result = -1;
+            }
+        }
+    }
+
+    close(socket_desc);
+    return NULL;
+}
+
+// Helper Function:    open_stripe_file
+// ------------------------------------
+// Opens the hidden file a striped GET collects into, beside its destination.
+// The name is fixed per destination, so a run that is killed leaves at most
+// one such file behind, and the next striped GET of that destination empties
+// and reuses it. It takes the permissions of the file it will replace, or
+// 0644 for a new one.
+//
+// destination: local filename
+// stripe_path: receives the file's path
+// len:         size of stripe_path
+//
+// returns fd open for reading and writing, -1 on failure
+int open_stripe_file(const char *destination, char *stripe_path, size_t len)
+{
+    const char *last_slash = strrchr(destination, '/');
+    int directory_length = last_slash ? (int)(last_slash - destination + 1) : 0;
+    if (snprintf(stripe_path, len, "%.*s.%s" STRIPES_SUFFIX, directory_length, destination,
+                 destination + directory_length) >= (int)len)
+        return -1;
+
+    struct stat info;
+    mode_t mode = stat(destination, &info) == 0 ? (info.st_mode & 07777) : 0644;
+    int fd = open(stripe_path, O_RDWR | O_CREAT | O_TRUNC, mode);
+    if (fd != -1)
+        fchmod(fd, mode);
+    return fd;
+}
 
-    if (!response) {
-        return handle_error(response, socket_desc,
-                            "client: error getting server response after WRITE\n",
-                            NULL);
+// Helper Function:    handle_striped_get
+// --------------------------------------
+// Downloads a large file over stream_count connections at once. STATUS gives
+// the file's size and version; each stripe then GETs its range into the
+// destination's hidden stripe file (open_stripe_file), which is renamed into
+// place once all succeed.
+// The caller's connection sits idle while the stripes run and the server may
+// close it meanwhile, so a session gets it back reopened.
+//
+// source:      target filename on the server
+// destination: local filename
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd, used for STATUS and left open
+//
+// returns 0 on success, -1 if the request failed, 1 if the connection was
+// lost, 2 if the file is too small to stripe
+int handle_striped_get(char *source, char *destination, uint16_t flags, int socket_desc)
+{
+    response_t response;
+    if (handle_outbound(OP_STATUS, source, 0, 0, 0, flags | REQUEST_KEEPALIVE, socket_desc) == -1 ||
+        receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting server response for GET\n", 1);
+
+    if (response.status != STATUS_OK)
+    {
+        fprintf(stderr, "server: %s\n", response.message);
+        return handle_error("client: GET request rejected by server\n", -1);
     }
+    if (response.size < STRIPE_MIN)
+        return 2;
+
+    char stripe_path[BUFFER_SIZE + sizeof(STRIPES_SUFFIX) + 1];
+    int fd = open_stripe_file(destination, stripe_path, sizeof(stripe_path));
+    if (fd == -1)
+        return handle_error("client: error saving file during GET\n", -1);
 
-    fprintf(stdout, "server: %s\n", response);
-    clean_up(response, socket_desc);
+    stripe_t stripes[MAX_STREAMS];
+    split_stripes(stripes, response.size);
+    for (int i = 0; i < stream_count; i++)
+    {
+        stripes[i].target = source;
+        stripes[i].fd = fd;
+        stripes[i].version = response.version;
+    }
+
+    int result = run_stripes(stripes, stream_count, get_stripe);
+    if (close(fd) != 0 && result == 0)
+        result = -1;
+    if ((flags & REQUEST_KEEPALIVE) && reopen_connection(socket_desc) == -1)
+    {
+        unlink(stripe_path);
+        return handle_error("client: unable to reconnect after striped GET\n", 1);
+    }
+    if (result == 0 && rename(stripe_path, destination) != 0)
+        result = -1;
+    if (result != 0)
+    {
+        unlink(stripe_path);
+        return handle_error("client: striped GET failed\n", -1);
+    }
+
+    fprintf(stdout, "client: GET request successful\n");
     return 0;
 }
 
+// Helper Function:    read_part_version
+// -------------------------------------
+// Reads the version of the file a .part file's bytes came from
+//
+// version_path: record beside the .part file
+// version:     receives the version
+//
+// returns 0 on success, -1 if there is no usable record
+int read_part_version(const char *version_path, uint64_t *version)
+{
+    FILE *record = fopen(version_path, "r");
+    if (!record)
+        return -1;
+    int matched = fscanf(record, "%" SCNu64, version);
+    fclose(record);
+    return matched == 1 && *version != 0 ? 0 : -1;
+}
+
+// Helper Function:    write_part_version
+// --------------------------------------
+// Records the version of the file a download's bytes come from, so a later
+// attempt can ask to resume that version and no other
+//
+// returns 0 on success, -1 on failure
+int write_part_version(const char *version_path, uint64_t version)
+{
+    FILE *record = fopen(version_path, "w");
+    if (!record)
+        return -1;
+    int written = fprintf(record, "%" PRIu64 "\n", version) > 0;
+    return fclose(record) == 0 && written ? 0 : -1;
+}
+
 // Function:    handle_get
 // -------------------------
-// Handling outbound get requests
+// Handling outbound get requests: the server's response carries the file
+// size and the contents follow it. Downloads collect in destination.part;
+// if one is left over from an interrupted GET only the rest of the file is
+// requested. The version of the file the .part holds is kept beside it in
+// destination.part.version and quoted on resume (REQUEST_RESUME); if the
+// server's file has been replaced since, or there is no record, the
+// download starts over. Large files
+// are striped over RFS_STREAMS connections when more than one is asked for;
+// those collect in a hidden .destination.stripes file instead, which isn't
+// resumed but is emptied and reused by the next striped GET of destination.
+// With RFS_COMPRESS set the server may send the data compressed. Unless
+// RFS_CHECKSUM=0 the data is checked against the server's CRC32C, and a
+// download that fails it is cut back to where this attempt started.
 //
-// target:      target filename
+// source:      target filename on the server
+// destination: local filename
+// flags:       REQUEST_* flags
 // socket_desc: client socket fd
 //
-// returns 0 on success, 1 on file error, -1 on connection error
-int handle_get(char *target, int socket_desc)
+// returns 0 on success, -1 if the request failed, 1 if the connection was lost
+int handle_get(char *source, char *destination, uint16_t flags, int socket_desc)
 {
-    int received = receive_file(target, socket_desc);
+    // Don't bother the server if the download has nowhere to go
+    if (!check_directory(destination))
+        return handle_error("client: invalid destination directory for GET\n", -1);
+
+    if (stream_count > 1)
+    {
+        int result = handle_striped_get(source, destination, flags, socket_desc);
+        if (result != 2)
+            return result;
+    }
+
+    // Pick up where an interrupted download stopped, if its version is known
+    char part_path[BUFFER_SIZE + sizeof(PART_SUFFIX)];
+    char version_path[BUFFER_SIZE + sizeof(PART_SUFFIX) + sizeof(PART_VERSION_SUFFIX)];
+    struct stat info;
+    uint64_t offset = 0;
+    uint64_t part_version = 0;
+    if (strlen(source) >= TARGET_MAX || partial_path(destination, part_path, sizeof(part_path)) == -1 ||
+        snprintf(version_path, sizeof(version_path), "%s" PART_VERSION_SUFFIX, part_path) >= (int)sizeof(version_path))
+        return handle_error("client: name too long for GET\n", -1);
+    if (stat(part_path, &info) == 0 && S_ISREG(info.st_mode) && read_part_version(version_path, &part_version) == 0)
+        offset = (uint64_t)info.st_size;
+
+    response_t response;
+    for (;;)
+    {
+        if (offset > 0)
+            fprintf(stdout, "client: resuming %s at byte %" PRIu64 "\n", destination, offset);
+
+        // Keep the connection if the resume is refused, so the retry can reuse it
+        request_t request;
+        memset(&request, 0, sizeof(request));
+        request.op = OP_GET;
+        request.offset = offset;
+        request.resume_version = part_version;
+        request.flags = (offset > 0 ? (flags | REQUEST_KEEPALIVE | REQUEST_RESUME) : flags) |
+                        (compress_enabled ? REQUEST_COMPRESS : 0) |
+                        (checksum_enabled ? REQUEST_CHECKSUM : 0);
+        strcpy(request.target, source);
+        if (send_request(socket_desc, &request) == -1)
+            return handle_error("client: GET request could not be sent\n", 1);
+
+        if (receive_response(socket_desc, &response) == -1)
+            return handle_error("client: error getting server response for GET\n", 1);
+
+        // The leftover doesn't belong to this file any more, start over
+        if ((response.status == STATUS_BAD_RANGE || response.status == STATUS_CHANGED) && offset > 0)
+        {
+            fprintf(stdout, "client: %s changed on the server, starting over\n", source);
+            offset = 0;
+            continue;
+        }
+        break;
+    }
+
+    if (response.status != STATUS_OK)
+    {
+        fprintf(stderr, "server: %s\n", response.message);
+        return handle_error("client: GET request rejected by server\n", -1);
+    }
+
+    // A fresh download remembers where its bytes come from; without the record it just can't be resumed
+    if (offset == 0 && write_part_version(version_path, response.version) == -1)
+        unlink(version_path);
+
+    int received = receive_partial(destination, part_path, offset, response.size, socket_desc,
+                                   response_encoding(&response));
+    if (received == 0 || stat(part_path, &info) == -1)
+        unlink(version_path);
     switch (received)
     {
         case 0:
             break;
-        case 1:
-            return handle_error(NULL, socket_desc,
-                                "client: lost connection during GET\n",
-                                "File download failed");
-        case -1:
-            return handle_error(NULL, socket_desc,
-                                "client: error saving file during GET\n",
-                                "File download failed");
+        case 1: // Whatever arrived stays in the .part file for the next GET
+            return handle_error("client: lost connection during GET\n", 1);
+        case -1: // receive_partial drained the data, the connection is still aligned
+            return handle_error("client: error saving file during GET\n", -1);
+        case 3:
+            return handle_error("client: data failed its checksum during GET\n", -1);
         default:
-            return handle_error(NULL, socket_desc,
-                                "client: undefined error during GET\n",
-                                "File download failed");
+            return handle_error("client: undefined error during GET\n", 1);
     }
 
-    if(!send_msg("File download successful", socket_desc)){
-        return handle_error(NULL, socket_desc,
-                            "client: error reaching server to confirm file transfer in GET\n",
-                            NULL);
-
-    }
     fprintf(stdout, "client: GET request successful\n");
-    clean_up(NULL, socket_desc);
     return 0;
 }
 
@@ -192,109 +952,568 @@ int handle_get(char *target, int socket_desc)
 // Handling outbound rm requests
 //
 // target:      target filename
+// flags:       REQUEST_* flags
 // socket_desc: client socket fd
 //
-// returns 0 on success, 1 on file error, -1 on connection error
-int handle_rm(int socket_desc)
+// returns 0 on success, -1 if the request failed, 1 if the connection was lost
+int handle_rm(char *target, uint16_t flags, int socket_desc)
 {
-    char *response = receive_msg(socket_desc);
+    if (handle_outbound(OP_RM, target, 0, 0, 0, flags, socket_desc) == -1)
+        return handle_error("client: RM request could not be sent\n", 1);
+
+    response_t response;
+    if (receive_response(socket_desc, &response) == -1)
+        return handle_error("client: error getting server response after RM\n", 1);
+
+    fprintf(stdout, "server: %s\n", response.message);
+    return response.status == STATUS_OK ? 0 : -1;
+}
 
-    if (!response) {
-        return handle_error(NULL, socket_desc, "client: error getting server response after RM\n", NULL);
+// Function:    handle_command
+// ---------------------------
+// Runs one rfs command against an open connection
+//
+// argc/argv:   command words, e.g. {"GET", "remote", "local"}
+// flags:       REQUEST_* flags
+// socket_desc: client socket fd
+//
+// returns 0 on success, -1 if the request failed, 1 if the connection was lost,
+// 2 on a syntax error
+int handle_command(int argc, char *argv[], uint16_t flags, int socket_desc)
+{
+	if (argc >= 3 && strcmp(argv[0], "WRITE") == 0) // Uploading a file to the server
+        return handle_write(argv[1], argv[2], flags, socket_desc);
+	else if (argc >= 3 && strcmp(argv[0], "GET") == 0) // Requesting a file from the server
+        return handle_get(argv[1], argv[2], flags, socket_desc);
+	else if (argc >= 2 && strcmp(argv[0], "RM") == 0)
+        return handle_rm(argv[1], flags, socket_desc);
+
+    fprintf(stderr, "client no-op: rfs RM [target path]\n");
+    fprintf(stderr, "client no-op: rfs {GET,WRITE} [target path] [destination path]\n");
+    return 2;
+}
+
+// Function:    handle_session
+// ---------------------------
+// Runs a script of commands over one persistent connection. Each line holds
+// one command ("GET remote local", "WRITE local remote", "RM remote"); blank
+// lines and lines starting with '#' are skipped.
+//
+// script:      open command stream
+// socket_desc: client socket fd
+//
+// returns 0 if every command succeeded, -1 otherwise
+int handle_session(FILE *script, int socket_desc)
+{
+    char line[SESSION_LINE_MAX];
+    int failures = 0, completed = 0;
+
+    while (fgets(line, sizeof(line), script))
+    {
+        char *words[4];
+        int count = 0;
+        char *saveptr;
+
+        // Split the line into at most four words
+        for (char *word = strtok_r(line, " \t\r\n", &saveptr); word && count < 4;
+             word = strtok_r(NULL, " \t\r\n", &saveptr))
+            words[count++] = word;
+
+        if (count == 0 || words[0][0] == '#')
+            continue;
+
+        int result = handle_command(count, words, REQUEST_KEEPALIVE, socket_desc);
+        if (result == 1)
+        {
+            fprintf(stderr, "client: session lost after %d commands\n", completed);
+            return -1;
+        }
+        if (result != 0)
+            failures++;
+        completed++;
     }
 
-    fprintf(stdout, "server: %s\n", response);
-    clean_up(response, socket_desc);
-    return 0;
+    fprintf(stdout, "client: session finished, %d commands, %d failed\n", completed, failures);
+    return failures ? -1 : 0;
 }
 
-// Function:	main
-// -----------------
-// Modified main method to take in clargs
-int main(int argc, char *argv[])
+// Helper Function:    add_batch_item
+// ----------------------------------
+// Appends a file to a batch, growing the array as needed
+//
+// returns 0 on success, -1 if out of memory
+int add_batch_item(batch_t *batch, int *capacity, const char *source, const char *destination)
 {
-	// Validate number of arguments
-	if (argc < 3)
-	{
-		fprintf(stderr, "client: syntax error\n");
-		return -1;
-	}
+    if (batch->count == *capacity)
+    {
+        int grown = *capacity ? *capacity * 2 : 64;
+        batch_item_t *items = realloc(batch->items, (size_t)grown * sizeof(*items));
+        if (!items)
+            return -1;
+        batch->items = items;
+        *capacity = grown;
+    }
 
-    // Init client, get outbound socket
-	int socket_desc = client_init();
-	
-	// Handle different commands
-	if (strcmp(argv[1], "WRITE") == 0) //
+    batch_item_t *item = &batch->items[batch->count];
+    memset(item, 0, sizeof(*item));
+    item->source = strdup(source);
+    item->destination = strdup(destination);
+    if (!item->source || !item->destination)
     {
-        if (argc < 4) goto error;
+        SAFE_FREE(item->source);
+        SAFE_FREE(item->destination);
+        return -1;
+    }
+    item->result = 1;
+    snprintf(item->message, sizeof(item->message), "not sent");
+    batch->count++;
+    return 0;
+}
 
-        // Send target file to server
-        if(!send_msg(argv[3], socket_desc)){
-            return handle_error(NULL, socket_desc,
-                                "client: error sending target file for WRITE request\n",
-                                NULL);
+// Helper Function:    load_batch
+// ------------------------------
+// Collects the files of an MGET or MPUT. A plain argument names a file kept
+// under the same name on both sides; @manifest reads "source [destination]"
+// lines from a file, @- from stdin, skipping blank lines and '#' comments.
+//
+// argc/argv:   arguments after the command word
+// batch:       batch to fill in
+//
+// returns 0 on success, -1 if a manifest can't be read or memory runs out
+int load_batch(int argc, char *argv[], batch_t *batch)
+{
+    int capacity = 0;
 
+    for (int i = 0; i < argc; i++)
+    {
+        if (argv[i][0] != '@')
+        {
+            if (add_batch_item(batch, &capacity, argv[i], argv[i]) == -1)
+                return -1;
+            continue;
         }
 
-        // Initiate outbound handshake
-        if (!handle_outbound(argv[1], argv[3], socket_desc))
+        FILE *manifest = strcmp(argv[i], "@-") == 0 ? stdin : fopen(argv[i] + 1, "r");
+        if (!manifest)
         {
-            // Attempt to send the file
-            return handle_write(argv[2], socket_desc);
-        } else
+            fprintf(stderr, "client: unable to open manifest %s\n", argv[i] + 1);
+            return -1;
+        }
+
+        char line[SESSION_LINE_MAX];
+        int result = 0;
+        while (result == 0 && fgets(line, sizeof(line), manifest))
         {
-            return handle_error(NULL, socket_desc,
-                                "client: WRITE request aborted by server before file could be sent\n",
-                                NULL);
+            char *words[2];
+            int count = 0;
+            char *saveptr;
+
+            for (char *word = strtok_r(line, " \t\r\n", &saveptr); word && count < 2;
+                 word = strtok_r(NULL, " \t\r\n", &saveptr))
+                words[count++] = word;
+
+            if (count == 0 || words[0][0] == '#')
+                continue;
+            result = add_batch_item(batch, &capacity, words[0], words[count - 1]);
         }
-    } else if (strcmp(argv[1], "GET") == 0) // Requesting a file from the server
+        if (manifest != stdin)
+            fclose(manifest);
+        if (result == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Helper Function:    send_batch_request
+// --------------------------------------
+// Sends the request for one file of a batch, and for MPUT the file after it
+//
+// returns 0 once it is on the wire, -1 if it was refused locally and nothing
+// was sent, 1 if the connection can't be used any more
+int send_batch_request(batch_t *batch, batch_item_t *item, int socket_desc)
+{
+    char *target = batch->op == OP_GET ? item->source : item->destination;
+    if (strlen(target) >= TARGET_MAX)
     {
-        if (argc < 4) goto error;
+        snprintf(item->message, sizeof(item->message), "target name too long");
+        item->result = -1;
+        return -1;
+    }
 
-        // Send target file to server
-        if(!send_msg(argv[2], socket_desc)){
-            return handle_error(NULL, socket_desc,
-                                "client: error sending target file for GET request\n",
-                                NULL);
+    if (batch->op == OP_GET)
+    {
+        if (!check_directory(item->destination))
+        {
+            snprintf(item->message, sizeof(item->message), "invalid destination directory");
+            item->result = -1;
+            return -1;
+        }
+        uint16_t flags = REQUEST_KEEPALIVE | (compress_enabled ? REQUEST_COMPRESS : 0) |
+                         (checksum_enabled ? REQUEST_CHECKSUM : 0);
+        return handle_outbound(OP_GET, target, 0, 0, 0, flags, socket_desc) == -1 ? 1 : 0;
+    }
+
+    uint64_t file_size;
+    int fd = open_file(item->source, &file_size);
+    if (fd == -1)
+    {
+        snprintf(item->message, sizeof(item->message), "unable to open local file");
+        item->result = -1;
+        return -1;
+    }
+
+    uint16_t flags = REQUEST_KEEPALIVE | (checksum_enabled ? REQUEST_CHECKSUM : 0) |
+                     (compress_enabled && should_compress(item->source, fd, NULL, 0, file_size) ? REQUEST_COMPRESS : 0);
+    int sent = 1;
+    if (handle_outbound(OP_WRITE, target, file_size, 0, 0, flags, socket_desc) == 0)
+        sent = send_upload(fd, 0, file_size, flags, socket_desc, NULL);
+    close(fd);
+
+    // Once the size is on the wire a short file can't be resynchronised either
+    if (sent != 0)
+        return 1;
+    item->bytes = file_size;
+    return 0;
+}
+
+// Helper Function:    receive_batch_reply
+// ---------------------------------------
+// Reads the server's answer for one file of a batch, and for MGET the file
+//
+// returns 0 once the item has its result, 1 if the connection was lost
+int receive_batch_reply(batch_t *batch, batch_item_t *item, int socket_desc)
+{
+    response_t response;
+    if (receive_response(socket_desc, &response) == -1)
+        return 1;
 
+    snprintf(item->message, sizeof(item->message), "%s", response.message);
+    item->result = response.status == STATUS_OK ? 0 : -1;
+    if (batch->op != OP_GET || response.status != STATUS_OK)
+        return 0;
+
+    switch (receive_file(item->destination, response.size, socket_desc, response_encoding(&response)))
+    {
+        case 0:
+            item->bytes = response.size;
+            return 0;
+        case 1:
+            return 1;
+        case 3:
+            snprintf(item->message, sizeof(item->message), "data failed its checksum");
+            break;
+        default: // receive_file drained the data, the connection is still aligned
+            snprintf(item->message, sizeof(item->message), "error saving file");
+            break;
+    }
+    item->result = -1;
+    return 0;
+}
+
+// Helper Function:    batch_receiver
+// ----------------------------------
+// Thread body reading a batch connection's replies in the order its
+// requests went out, opening the window for the sender as each one lands
+void *batch_receiver(void *arg)
+{
+    batch_lane_t *lane = (batch_lane_t *)arg;
+    batch_t *batch = lane->batch;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&lane->lock);
+        while (lane->answered == lane->sent && !lane->finished)
+            pthread_cond_wait(&lane->cond, &lane->lock);
+        if (lane->answered == lane->sent)
+        {
+            pthread_mutex_unlock(&lane->lock);
+            break;
         }
+        batch_item_t *item = &batch->items[lane->order[lane->answered]];
+        int lost = lane->lost;
+        pthread_mutex_unlock(&lane->lock);
 
-        if (!handle_outbound(argv[1], argv[2], socket_desc))
+        if (lost || receive_batch_reply(batch, item, lane->socket_desc) == 1)
         {
-            return handle_get(argv[3], socket_desc);
-        } else
+            snprintf(item->message, sizeof(item->message), "connection lost");
+            item->result = 1;
+            lost = 1;
+        }
+
+        pthread_mutex_lock(&lane->lock);
+        if (lost && !lane->lost)
         {
-            return handle_error(NULL, socket_desc,
-                                "client: GET request aborted by server before file could be sent\n",
-                                NULL);
+            lane->lost = 1;
+            shutdown(lane->socket_desc, SHUT_RDWR); // Stops a sender stuck mid-file
         }
+        lane->answered++;
+        pthread_cond_broadcast(&lane->cond);
+        pthread_mutex_unlock(&lane->lock);
+    }
+    return NULL;
+}
 
-    } else if (strcmp(argv[1], "RM") == 0)
+// Helper Function:    batch_sender
+// --------------------------------
+// Thread body of one batch connection: connects, starts its receiver, then
+// claims files and sends their requests while the window has room
+void *batch_sender(void *arg)
+{
+    batch_lane_t *lane = (batch_lane_t *)arg;
+    batch_t *batch = lane->batch;
+    pthread_t receiver;
+
+    // Files this connection never claims are left to the others
+    lane->socket_desc = client_init();
+    if (lane->socket_desc < 0)
+        return NULL;
+    if (pthread_create(&receiver, NULL, batch_receiver, lane) != 0)
+    {
+        fprintf(stderr, "client: unable to start batch receiver\n");
+        close(lane->socket_desc);
+        return NULL;
+    }
+
+    for (;;)
     {
-        // Send target file to server
-        if(!send_msg(argv[2], socket_desc)){
-            return handle_error(NULL, socket_desc,
-                                "client: error sending target file for GET request\n",
-                                NULL);
+        pthread_mutex_lock(&lane->lock);
+        while (!lane->lost && lane->sent - lane->answered >= BATCH_WINDOW)
+            pthread_cond_wait(&lane->cond, &lane->lock);
+        int lost = lane->lost;
+        pthread_mutex_unlock(&lane->lock);
+        if (lost)
+            break;
 
+        pthread_mutex_lock(&batch->lock);
+        int index = batch->next < batch->count ? batch->next++ : -1;
+        pthread_mutex_unlock(&batch->lock);
+        if (index == -1)
+            break;
+
+        int sent = send_batch_request(batch, &batch->items[index], lane->socket_desc);
+        if (sent == -1)
+            continue;
+
+        // A request that failed on the way out is still answered, as lost, by the receiver
+        pthread_mutex_lock(&lane->lock);
+        lane->order[lane->sent++] = index;
+        if (sent == 1 && !lane->lost)
+        {
+            lane->lost = 1;
+            shutdown(lane->socket_desc, SHUT_RDWR);
         }
+        pthread_cond_broadcast(&lane->cond);
+        pthread_mutex_unlock(&lane->lock);
+        if (sent == 1)
+            break;
+    }
+
+    pthread_mutex_lock(&lane->lock);
+    lane->finished = 1;
+    pthread_cond_broadcast(&lane->cond);
+    pthread_mutex_unlock(&lane->lock);
+
+    pthread_join(receiver, NULL);
+    close(lane->socket_desc);
+    return NULL;
+}
+
+// Helper Function:    run_batch
+// -----------------------------
+// Moves the files of a loaded batch, then reports every file's result and
+// the totals
+//
+// returns 0 if every file succeeded, -1 otherwise
+int run_batch(batch_t *batch)
+{
+    batch_lane_t lanes[MAX_STREAMS];
+    pthread_t threads[MAX_STREAMS];
+    int started = 0, failures = 0;
+    uint64_t total_bytes = 0;
+    struct timespec start, end;
+
+    // Per-file lines replace per-transfer telemetry
+    set_progress_callback(NULL, NULL, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-        if (!handle_outbound(argv[1],argv[2], socket_desc))
+    int lane_count = batch_connections < batch->count ? batch_connections : batch->count;
+    for (; started < lane_count; started++)
+    {
+        batch_lane_t *lane = &lanes[started];
+        memset(lane, 0, sizeof(*lane));
+        lane->batch = batch;
+        lane->order = malloc((size_t)batch->count * sizeof(int));
+        pthread_mutex_init(&lane->lock, NULL);
+        pthread_cond_init(&lane->cond, NULL);
+        if (!lane->order || pthread_create(&threads[started], NULL, batch_sender, lane) != 0)
+        {
+            fprintf(stderr, "client: unable to start batch connection %d\n", started);
+            SAFE_FREE(lane->order);
+            pthread_mutex_destroy(&lane->lock);
+            pthread_cond_destroy(&lane->cond);
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+        SAFE_FREE(lanes[i].order);
+        pthread_mutex_destroy(&lanes[i].lock);
+        pthread_cond_destroy(&lanes[i].cond);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < batch->count; i++)
+    {
+        batch_item_t *item = &batch->items[i];
+        if (item->result == 0)
         {
-            return handle_rm(socket_desc);
-        } else
+            fprintf(stdout, "client: %s -> %s ok, %" PRIu64 " bytes\n", item->source, item->destination, item->bytes);
+            total_bytes += item->bytes;
+        }
+        else
         {
-            return handle_error(NULL, socket_desc, "client: RM request aborted by server\n", NULL);
+            fprintf(stderr, "client: %s -> %s failed: %s\n", item->source, item->destination, item->message);
+            failures++;
         }
     }
 
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stdout, "client: %s finished, %d files, %d failed, %" PRIu64 " bytes in %.2f s, %.1f MB/s, "
+            "%.0f files/s over %d connections\n", batch->op == OP_GET ? "MGET" : "MPUT", batch->count, failures,
+            total_bytes, elapsed, elapsed > 0 ? (double)total_bytes / elapsed / 1e6 : 0,
+            elapsed > 0 ? batch->count / elapsed : 0, started);
+    return failures ? -1 : 0;
+}
 
-    fprintf(stderr, "client no-op: rfs RM [target path]\n");
+// Function:    handle_batch
+// -------------------------
+// Runs an MGET or MPUT: many files over batch_connections connections, each
+// pipelining up to BATCH_WINDOW requests, so a batch costs a few connections
+// instead of one process and one connection per file. Files are sent as
+// plain GETs and WRITEs with RFS_COMPRESS and RFS_CHECKSUM honoured; nothing
+// is resumed, striped or deduplicated, and files in a batch are independent,
+// in no particular order.
+//
+// op:          OP_GET for MGET, OP_WRITE for MPUT
+// argc/argv:   files and @manifests after the command word
+//
+// returns 0 if every file succeeded, -1 otherwise
+int handle_batch(uint8_t op, int argc, char *argv[])
+{
+    batch_t batch = { .op = op, .lock = PTHREAD_MUTEX_INITIALIZER };
+    int result = -1;
+
+    if (load_batch(argc, argv, &batch) == -1 || batch.count == 0)
+        fprintf(stderr, "client: %s has no files to move\n", op == OP_GET ? "MGET" : "MPUT");
+    else
+        result = run_batch(&batch);
+
+    for (int i = 0; i < batch.count; i++)
+    {
+        SAFE_FREE(batch.items[i].source);
+        SAFE_FREE(batch.items[i].destination);
+    }
+    SAFE_FREE(batch.items);
+    return result;
+}
+
+// Function:	main
+// -----------------
+// Modified main method to take in clargs
+//
+// rfs SESSION [script] runs many commands over one connection, reading the
+// script from stdin when no file is given
+//
+// rfs MGET|MPUT file... @manifest... moves many files over a few pipelined
+// connections; manifests hold "source [destination]" lines
+//
+// RFS_CHUNK in the environment sets the transfer I/O chunk size, e.g. RFS_CHUNK=8M
+// RFS_STREAMS sets how many connections a large GET or WRITE is striped over,
+// and an MGET or MPUT is spread over
+// RFS_DELTA=1 sends WRITEs of files the server already holds as deltas
+// RFS_COMPRESS=1 compresses WRITEs and lets the server compress GETs
+// RFS_DEDUP=1 offers WRITEs by content hash, skipping files the server already holds
+// RFS_CHECKSUM=0 stops GETs and WRITEs carrying a CRC32C of their data
+int main(int argc, char *argv[])
+{
+	// Validate number of arguments
+	if (argc < 3 && !(argc == 2 && strcmp(argv[1], "SESSION") == 0))
+	{
+		fprintf(stderr, "client: syntax error\n");
+		return -1;
+	}
+
+	const char *chunk = getenv("RFS_CHUNK");
+	uint64_t chunk_size;
+	if (chunk && (parse_size(chunk, &chunk_size) == -1 || set_transfer_chunk(chunk_size) == -1))
+	{
+		fprintf(stderr, "client: invalid RFS_CHUNK %s\n", chunk);
+		return -1;
+	}
+
+	const char *streams = getenv("RFS_STREAMS");
+	if (streams)
+	{
+		stream_count = atoi(streams);
+		if (stream_count < 1 || stream_count > MAX_STREAMS)
+		{
+			fprintf(stderr, "client: RFS_STREAMS must be between 1 and %d\n", MAX_STREAMS);
+			return -1;
+		}
+		batch_connections = stream_count;
+	}
+
+	const char *delta = getenv("RFS_DELTA");
+	delta_enabled = delta && strcmp(delta, "0") != 0;
+
+	const char *compress = getenv("RFS_COMPRESS");
+	compress_enabled = compress && strcmp(compress, "0") != 0;
+
+	const char *dedup = getenv("RFS_DEDUP");
+	dedup_enabled = dedup && strcmp(dedup, "0") != 0;
+
+	const char *checksum = getenv("RFS_CHECKSUM");
+	checksum_enabled = !checksum || strcmp(checksum, "0") != 0;
+
+	// Bars only on a terminal that reports its width; a log still gets the rates
+	struct winsize window;
+	if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0)
+		terminal_width = window.ws_col;
+	set_progress_callback(show_progress, &terminal_width, PROGRESS_INTERVAL_MS);
+
+	FILE *script = NULL;
+	if (strcmp(argv[1], "SESSION") == 0)
+	{
+		script = argc > 2 ? fopen(argv[2], "r") : stdin;
+		if (!script)
+		{
+			fprintf(stderr, "client: unable to open session script %s\n", argv[2]);
+			return -1;
+		}
+	}
+
+    // sendfile(2) can't take MSG_NOSIGNAL, report a dropped server as an error instead
+	signal(SIGPIPE, SIG_IGN);
+
+	if (strcmp(argv[1], "MGET") == 0 || strcmp(argv[1], "MPUT") == 0)
+		return handle_batch(strcmp(argv[1], "MGET") == 0 ? OP_GET : OP_WRITE, argc - 2, argv + 2) == 0 ? 0 : -1;
+
+    // Init client, get outbound socket
+	int socket_desc = client_init();
+	if (socket_desc < 0)
+		return -1;
+
+	int result;
+	if (script)
+	{
+		result = handle_session(script, socket_desc);
+		if (script != stdin)
+			fclose(script);
+	}
+	else
+		result = handle_command(argc - 1, argv + 1, 0, socket_desc);
 
-	// Syntax error
-    error:
-    fprintf(stderr, "client no-op: rfs {GET,WRITE} [target path] [destination path]\n");
 	clean_up(NULL, socket_desc);
-	
-	return -1;
+	return result == 0 ? 0 : -1;
 }
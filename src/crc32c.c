@@ -0,0 +1,239 @@
+/*
+ * crc32c.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * CRC32C (Castagnoli) checksums for end-to-end transfer integrity
+ */
+
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CRC32C_X86
+#endif
+
+#define CRC32C_POLY 0x82f63b78u // Castagnoli polynomial, bit-reflected
+#define CRC32C_LONG 8192        // Bytes per lane in a long three-lane pass
+#define CRC32C_SHORT 256        // Bytes per lane in a short three-lane pass
+
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_update)(uint32_t crc, const unsigned char *data, size_t len);
+static const char *crc_name;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+// Multipliers moving a lane's CRC past the lanes after it (see shift_constant)
+static uint32_t long_one, long_two, short_one, short_two;
+
+// Helper Function:    load64
+// --------------------------
+// Unaligned load
+static uint64_t load64(const unsigned char *in)
+{
+    uint64_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+// Helper Function:    crc32c_table
+// --------------------------------
+// Portable kernel: eight table lookups per 8 bytes on little-endian
+// machines, one per byte otherwise. Works on the raw register, without the
+// inversions crc32c applies.
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *data, size_t len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t word = load64(data) ^ crc;
+        crc = crc_table[7][word & 0xff] ^ crc_table[6][(word >> 8) & 0xff] ^
+              crc_table[5][(word >> 16) & 0xff] ^ crc_table[4][(word >> 24) & 0xff] ^
+              crc_table[3][(word >> 32) & 0xff] ^ crc_table[2][(word >> 40) & 0xff] ^
+              crc_table[1][(word >> 48) & 0xff] ^ crc_table[0][word >> 56];
+    }
+#endif
+    while (len--)
+        crc = crc_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+// Helper Function:    multiply_mod
+// --------------------------------
+// Multiplies two bit-reflected polynomials modulo the CRC polynomial
+//
+// a: nonzero factor
+//
+// returns a * b mod P
+static uint32_t multiply_mod(uint32_t a, uint32_t b)
+{
+    uint32_t mask = (uint32_t)1 << 31, product = 0;
+    for (;;)
+    {
+        if (a & mask)
+        {
+            product ^= b;
+            if ((a & (mask - 1)) == 0)
+                break;
+        }
+        mask >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+// Helper Function:    shift_constant
+// ----------------------------------
+// x^(8n - 33) mod P. A 32x32 carry-less product with it leaves the CRC
+// register times x^(8n) once the crc32 instruction reduces it, which is the
+// register moved past n zero bytes; the 33 makes up for the extra x the
+// reflected product carries and the x^32 the instruction multiplies in.
+static uint32_t shift_constant(size_t bytes)
+{
+    uint64_t exponent = 8 * (uint64_t)bytes - 33;
+    uint32_t result = (uint32_t)1 << 31, power = (uint32_t)1 << 30; // x^0, x^1
+    while (exponent)
+    {
+        if (exponent & 1)
+            result = multiply_mod(power, result);
+        power = multiply_mod(power, power);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+#ifdef CRC32C_X86
+// Helper Function:    crc32c_sse42
+// --------------------------------
+// One crc32 instruction per 8 bytes
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t len)
+{
+    uint64_t wide = crc;
+    for (; len >= 8; data += 8, len -= 8)
+        wide = _mm_crc32_u64(wide, load64(data));
+    crc = (uint32_t)wide;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+
+// Helper Function:    shift_crc
+// -----------------------------
+// Moves a raw CRC register past the bytes a shift_constant stands for
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t shift_crc(uint32_t crc, uint32_t constant)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi32_si128((int)constant), 0);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+// Helper Function:    crc32c_lanes
+// --------------------------------
+// Runs three crc32 chains over adjacent stretches at once, hiding the
+// instruction's three-cycle latency, then joins them: the first two are
+// shifted past the stretches after them and folded into the third.
+//
+// returns the raw register after data, and advances *data/*len past what it consumed
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_lanes(uint32_t crc, const unsigned char **data, size_t *len, size_t lane,
+                             uint32_t shift_one, uint32_t shift_two)
+{
+    const unsigned char *in = *data;
+    while (*len >= 3 * lane)
+    {
+        uint64_t first = crc, second = 0, third = 0;
+        const unsigned char *end = in + lane;
+        do {
+            first = _mm_crc32_u64(first, load64(in));
+            second = _mm_crc32_u64(second, load64(in + lane));
+            third = _mm_crc32_u64(third, load64(in + 2 * lane));
+            in += 8;
+        } while (in < end);
+
+        crc = shift_crc((uint32_t)first, shift_two) ^ shift_crc((uint32_t)second, shift_one) ^ (uint32_t)third;
+        in += 2 * lane;
+        *len -= 3 * lane;
+    }
+    *data = in;
+    return crc;
+}
+
+// Helper Function:    crc32c_pclmul
+// ---------------------------------
+// Three lanes over long stretches, then short ones, then one chain for the rest
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc32c_pclmul(uint32_t crc, const unsigned char *data, size_t len)
+{
+    crc = crc32c_lanes(crc, &data, &len, CRC32C_LONG, long_one, long_two);
+    crc = crc32c_lanes(crc, &data, &len, CRC32C_SHORT, short_one, short_two);
+    return crc32c_sse42(crc, data, len);
+}
+#endif
+
+// Helper Function:    crc32c_init
+// -------------------------------
+// Builds the tables and picks the fastest kernel the CPU supports
+static void crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++)
+    {
+        uint32_t crc = n;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++)
+        for (int k = 1; k < 8; k++)
+            crc_table[k][n] = (crc_table[k - 1][n] >> 8) ^ crc_table[0][crc_table[k - 1][n] & 0xff];
+
+    crc_update = crc32c_table;
+    crc_name = "table";
+
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc_update = crc32c_sse42;
+        crc_name = "sse4.2";
+        if (__builtin_cpu_supports("pclmul"))
+        {
+            long_one = shift_constant(CRC32C_LONG);
+            long_two = shift_constant(2 * CRC32C_LONG);
+            short_one = shift_constant(CRC32C_SHORT);
+            short_two = shift_constant(2 * CRC32C_SHORT);
+            crc_update = crc32c_pclmul;
+            crc_name = "sse4.2+pclmul";
+        }
+    }
+#endif
+}
+
+// Function:    crc32c
+// -------------------
+// Extends a CRC32C over more bytes. Start with 0; checksumming a buffer in
+// pieces gives the same result as checksumming it whole.
+//
+// crc: checksum of the bytes so far
+// data/len: next bytes
+//
+// returns checksum including data
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return ~crc_update(~crc, (const unsigned char *)data, len);
+}
+
+// Function:    crc32c_implementation
+// ----------------------------------
+// Names the kernel crc32c picked for this CPU
+//
+// returns "sse4.2+pclmul", "sse4.2" or "table"
+const char *crc32c_implementation(void)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc_name;
+}
@@ -0,0 +1,715 @@
+/*
+ * delta.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Rolling-checksum deltas for uploads that rewrite part of a file
+ */
+
+#include "delta.h"
+#include "messenger.h"
+#include <errno.h>
+#include <fcntl.h>
+
+#define SIGNATURE_BATCH 4096 // Entries buffered per send while signing
+#define NO_MATCH UINT64_MAX
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+
+// Type:        block_table_t
+// --------------------------
+// Open-addressed index from weak checksum to the blocks carrying it
+typedef struct block_slot {
+    uint32_t weak;
+    uint32_t used;
+    uint64_t index;
+} block_slot_t;
+
+typedef struct block_table {
+    block_slot_t *slots;
+    uint32_t bits;
+} block_table_t;
+
+// Helper Function:    put_u32 / put_u64 / get_u32 / get_u64
+// ----------------------------------------------------------
+// Big-endian field encoding for the signature and delta streams
+static void put_u32(unsigned char *out, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(out, &value, sizeof(value));
+}
+
+static void put_u64(unsigned char *out, uint64_t value)
+{
+    value = hton64(value);
+    memcpy(out, &value, sizeof(value));
+}
+
+static uint32_t get_u32(const unsigned char *in)
+{
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return ntohl(value);
+}
+
+static uint64_t get_u64(const unsigned char *in)
+{
+    uint64_t value;
+    memcpy(&value, in, sizeof(value));
+    return ntoh64(value);
+}
+
+// Helper Function:    rotl64 / mix64
+// ----------------------------------
+// Bit mixing for strong_checksum
+static uint64_t rotl64(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t mix64(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= PRIME2;
+    value ^= value >> 29;
+    value *= PRIME3;
+    value ^= value >> 32;
+    return value;
+}
+
+// Helper Function:    load_le64
+// -----------------------------
+// Reads 8 bytes as a little-endian word whatever the host's byte order
+static uint64_t load_le64(const unsigned char *in)
+{
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+// Helper Function:    digest_add
+// ------------------------------
+// Folds the strong checksum of the next block of a file into its digest
+static uint64_t digest_add(uint64_t digest, uint64_t block_hash)
+{
+    return (rotl64(digest, 23) ^ block_hash) * PRIME1 + PRIME3;
+}
+
+// Function:    delta_block_size
+// -----------------------------
+// Picks the signature block size for a file, about the square root of its size
+//
+// returns block size in bytes
+uint32_t delta_block_size(uint64_t file_size)
+{
+    uint32_t block_size = DELTA_MIN_BLOCK;
+    while (block_size < DELTA_MAX_BLOCK && (uint64_t)block_size * block_size < file_size)
+        block_size <<= 1;
+    return block_size;
+}
+
+// Function:    weak_checksum
+// --------------------------
+// rsync-style rolling checksum of a block
+//
+// returns checksum, low 16 bits the byte sum and high 16 bits the weighted sum
+uint32_t weak_checksum(const unsigned char *data, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        a += data[i];
+        b += (uint32_t)(len - i) * data[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+// Function:    roll_checksum
+// --------------------------
+// Slides a weak checksum one byte along
+//
+// returns checksum of the window one byte further on
+uint32_t roll_checksum(uint32_t sum, unsigned char out, unsigned char in, size_t len)
+{
+    uint32_t a = ((sum & 0xffff) - out + in) & 0xffff;
+    uint32_t b = ((sum >> 16) - (uint32_t)len * out + a) & 0xffff;
+    return a | (b << 16);
+}
+
+// Function:    strong_checksum
+// ----------------------------
+// 64-bit hash of a block, the same on every platform
+//
+// returns hash
+uint64_t strong_checksum(const void *data, size_t len)
+{
+    const unsigned char *cursor = (const unsigned char *)data;
+    uint64_t hash = PRIME3 ^ ((uint64_t)len * PRIME1);
+
+    for (; len >= 8; cursor += 8, len -= 8)
+    {
+        hash ^= rotl64(load_le64(cursor) * PRIME2, 31) * PRIME1;
+        hash = rotl64(hash, 27) * PRIME1 + PRIME3;
+    }
+
+    uint64_t tail = 0;
+    for (size_t i = 0; i < len; i++)
+        tail |= (uint64_t)cursor[i] << (8 * i);
+    hash ^= rotl64(tail * PRIME2, 31) * PRIME1;
+
+    return mix64(hash);
+}
+
+// Function:    signature_size
+// ---------------------------
+// Bytes in the signature stream of a file
+//
+// returns size of the stream
+uint64_t signature_size(uint64_t file_size)
+{
+    return SIGNATURE_HEADER_SIZE + file_size / delta_block_size(file_size) * SIGNATURE_ENTRY_SIZE;
+}
+
+// Function:    send_signature
+// ---------------------------
+// Checksums every whole block of a file and streams the signature
+//
+// fd: file to sign
+// file_size: bytes in the file
+// socket_desc: destination socket
+//
+// returns 0 on success, -1 on file read errors, 1 for connection errors
+int send_signature(int fd, uint64_t file_size, int socket_desc)
+{
+    uint32_t block_size = delta_block_size(file_size);
+    uint64_t count = file_size / block_size;
+
+    unsigned char *block = malloc(block_size);
+    unsigned char *batch = malloc(SIGNATURE_BATCH * SIGNATURE_ENTRY_SIZE);
+    if (!block || !batch)
+    {
+        fprintf(stderr, "delta.send_signature: memory allocation failed\n");
+        free(block);
+        free(batch);
+        return -1;
+    }
+
+    posix_fadvise(fd, 0, (off_t)file_size, POSIX_FADV_SEQUENTIAL);
+
+    int result = 0;
+    unsigned char header[SIGNATURE_HEADER_SIZE];
+    put_u32(header, block_size);
+    put_u64(header + 4, count);
+    if (send_all(socket_desc, header, sizeof(header)) == -1)
+        result = 1;
+
+    size_t filled = 0;
+    for (uint64_t i = 0; i < count && result == 0; i++)
+    {
+        if (pread_all(fd, block, block_size, i * block_size) == -1)
+        {
+            fprintf(stderr, "delta.send_signature: couldn't read block %llu\n", (unsigned long long)i);
+            result = -1;
+            break;
+        }
+
+        unsigned char *entry = batch + filled * SIGNATURE_ENTRY_SIZE;
+        put_u32(entry, weak_checksum(block, block_size));
+        put_u64(entry + 4, strong_checksum(block, block_size));
+
+        if (++filled == SIGNATURE_BATCH || i + 1 == count)
+        {
+            if (send_all(socket_desc, batch, filled * SIGNATURE_ENTRY_SIZE) == -1)
+                result = 1;
+            filled = 0;
+        }
+    }
+
+    SAFE_FREE(block);
+    SAFE_FREE(batch);
+    return result;
+}
+
+// Function:    receive_signature
+// ------------------------------
+// Reads and decodes a signature stream
+//
+// socket_desc: origin socket
+// size: bytes in the stream, as announced by the server
+// signature: signature_t to populate, released with free_signature
+//
+// returns 0 on success, -1 on a malformed stream (the rest is drained), 1 for connection errors
+int receive_signature(int socket_desc, uint64_t size, signature_t *signature)
+{
+    memset(signature, 0, sizeof(*signature));
+
+    unsigned char header[SIGNATURE_HEADER_SIZE];
+    if (size < SIGNATURE_HEADER_SIZE)
+        return drain_stream(socket_desc, size) == -1 ? 1 : -1;
+    if (recv_all(socket_desc, header, sizeof(header)) == -1)
+        return 1;
+    size -= SIGNATURE_HEADER_SIZE;
+
+    signature->block_size = get_u32(header);
+    signature->count = get_u64(header + 4);
+    if (signature->block_size < DELTA_MIN_BLOCK || signature->block_size > DELTA_MAX_BLOCK ||
+        size % SIGNATURE_ENTRY_SIZE != 0 || size / SIGNATURE_ENTRY_SIZE != signature->count)
+    {
+        fprintf(stderr, "delta.receive_signature: malformed signature\n");
+        return drain_stream(socket_desc, size) == -1 ? 1 : -1;
+    }
+
+    unsigned char *batch = malloc(SIGNATURE_BATCH * SIGNATURE_ENTRY_SIZE);
+    signature->blocks = calloc(signature->count ? signature->count : 1, sizeof(block_signature_t));
+    if (!batch || !signature->blocks)
+    {
+        fprintf(stderr, "delta.receive_signature: memory allocation failed for %llu blocks\n",
+                (unsigned long long)signature->count);
+        free(batch);
+        free_signature(signature);
+        return drain_stream(socket_desc, size) == -1 ? 1 : -1;
+    }
+
+    for (uint64_t i = 0; i < signature->count; )
+    {
+        uint64_t remaining = signature->count - i;
+        size_t entries = remaining < SIGNATURE_BATCH ? (size_t)remaining : SIGNATURE_BATCH;
+        if (recv_all(socket_desc, batch, entries * SIGNATURE_ENTRY_SIZE) == -1)
+        {
+            free(batch);
+            free_signature(signature);
+            return 1;
+        }
+        for (size_t j = 0; j < entries; j++, i++)
+        {
+            signature->blocks[i].weak = get_u32(batch + j * SIGNATURE_ENTRY_SIZE);
+            signature->blocks[i].strong = get_u64(batch + j * SIGNATURE_ENTRY_SIZE + 4);
+        }
+    }
+
+    SAFE_FREE(batch);
+    return 0;
+}
+
+// Function:    free_signature
+// ---------------------------
+// Releases a decoded signature
+void free_signature(signature_t *signature)
+{
+    SAFE_FREE(signature->blocks);
+    signature->count = 0;
+}
+
+// Helper Function:    slot_of
+// ---------------------------
+// Home slot of a weak checksum in a block table
+static uint64_t slot_of(const block_table_t *table, uint32_t weak)
+{
+    return (uint32_t)(weak * 2654435761u) >> (32 - table->bits);
+}
+
+// Helper Function:    build_table
+// -------------------------------
+// Indexes every block of a signature by weak checksum
+//
+// returns 0 on success, -1 on allocation failure
+static int build_table(const signature_t *signature, block_table_t *table)
+{
+    table->bits = 4;
+    while (table->bits < 31 && ((uint64_t)1 << table->bits) < signature->count * 2)
+        table->bits++;
+
+    table->slots = calloc((size_t)1 << table->bits, sizeof(block_slot_t));
+    if (!table->slots)
+        return -1;
+
+    uint64_t mask = ((uint64_t)1 << table->bits) - 1;
+    for (uint64_t i = 0; i < signature->count; i++)
+    {
+        uint64_t slot = slot_of(table, signature->blocks[i].weak);
+        while (table->slots[slot].used)
+            slot = (slot + 1) & mask;
+        table->slots[slot].weak = signature->blocks[i].weak;
+        table->slots[slot].used = 1;
+        table->slots[slot].index = i;
+    }
+    return 0;
+}
+
+// Helper Function:    find_block
+// ------------------------------
+// Looks for a block of the signed copy equal to a window of the new file,
+// preferring the block that continues the previous copy
+//
+// weak: weak checksum of the window
+// window: block_size bytes of the new file
+// expected: block after the last one copied, or NO_MATCH
+//
+// returns matching block index, or NO_MATCH
+static uint64_t find_block(const block_table_t *table, const signature_t *signature,
+                           uint32_t weak, const unsigned char *window, uint64_t expected)
+{
+    uint64_t strong = 0;
+    int have_strong = 0;
+
+    if (expected < signature->count && signature->blocks[expected].weak == weak)
+    {
+        strong = strong_checksum(window, signature->block_size);
+        have_strong = 1;
+        if (signature->blocks[expected].strong == strong)
+            return expected;
+    }
+
+    uint64_t mask = ((uint64_t)1 << table->bits) - 1;
+    for (uint64_t slot = slot_of(table, weak); table->slots[slot].used; slot = (slot + 1) & mask)
+    {
+        if (table->slots[slot].weak != weak)
+            continue;
+        if (!have_strong)
+        {
+            strong = strong_checksum(window, signature->block_size);
+            have_strong = 1;
+        }
+        if (signature->blocks[table->slots[slot].index].strong == strong)
+            return table->slots[slot].index;
+    }
+    return NO_MATCH;
+}
+
+// Helper Function:    put_copy
+// ----------------------------
+// Writes a COPY instruction
+//
+// returns 0 on success, -1 on write errors
+static int put_copy(FILE *out, uint64_t first, uint32_t count)
+{
+    unsigned char instruction[13];
+    instruction[0] = DELTA_COPY;
+    put_u64(instruction + 1, first);
+    put_u32(instruction + 9, count);
+    return fwrite(instruction, sizeof(instruction), 1, out) == 1 ? 0 : -1;
+}
+
+// Helper Function:    put_data
+// ----------------------------
+// Writes DATA instructions carrying len new bytes
+//
+// returns 0 on success, -1 on write errors
+static int put_data(FILE *out, const unsigned char *data, uint64_t len)
+{
+    while (len > 0)
+    {
+        uint32_t chunk = len < DELTA_MAX_LITERAL ? (uint32_t)len : DELTA_MAX_LITERAL;
+        unsigned char instruction[5];
+        instruction[0] = DELTA_DATA;
+        put_u32(instruction + 1, chunk);
+        if (fwrite(instruction, sizeof(instruction), 1, out) != 1 ||
+            fwrite(data, chunk, 1, out) != 1)
+            return -1;
+        data += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+// Function:    make_delta
+// -----------------------
+// Writes the delta turning the signed copy into data. Every block-sized
+// window of data is looked up by its rolling checksum; runs of matching
+// blocks become COPY instructions and everything between them DATA.
+//
+// data/size: new contents of the file
+// signature: signature of the server's copy
+// base_version: file version the signature was taken from
+// out: stream receiving the delta
+//
+// returns 0 on success, -1 on write errors or allocation failure
+int make_delta(const unsigned char *data, uint64_t size, const signature_t *signature,
+               uint64_t base_version, FILE *out)
+{
+    uint32_t block_size = signature->block_size;
+    block_table_t table;
+    if (build_table(signature, &table) == -1)
+    {
+        fprintf(stderr, "delta.make_delta: memory allocation failed for %llu blocks\n",
+                (unsigned long long)signature->count);
+        return -1;
+    }
+
+    unsigned char header[DELTA_HEADER_SIZE];
+    put_u64(header, base_version);
+    put_u32(header + 8, block_size);
+    int failed = fwrite(header, sizeof(header), 1, out) != 1;
+
+    uint64_t copy_first = 0, copy_count = 0; // Pending run of copied blocks
+    uint64_t literal = 0;                    // Start of the new bytes not yet written
+    uint64_t position = 0;
+    uint32_t sum = 0;
+    int have_sum = 0;
+
+    while (!failed && position + block_size <= size)
+    {
+        if (!have_sum)
+        {
+            sum = weak_checksum(data + position, block_size);
+            have_sum = 1;
+        }
+
+        uint64_t expected = copy_count ? copy_first + copy_count : NO_MATCH;
+        uint64_t match = find_block(&table, signature, sum, data + position, expected);
+        if (match != NO_MATCH)
+        {
+            if (position > literal || (copy_count && (match != expected || copy_count == UINT32_MAX)))
+            {
+                if (copy_count)
+                    failed |= put_copy(out, copy_first, (uint32_t)copy_count) == -1;
+                failed |= put_data(out, data + literal, position - literal) == -1;
+                copy_count = 0;
+            }
+            if (copy_count == 0)
+                copy_first = match;
+            copy_count++;
+
+            position += block_size;
+            literal = position;
+            have_sum = 0;
+            continue;
+        }
+
+        if (position + block_size < size)
+            sum = roll_checksum(sum, data[position], data[position + block_size], block_size);
+        position++;
+
+        if (position - literal >= DELTA_MAX_LITERAL)
+        {
+            if (copy_count)
+                failed |= put_copy(out, copy_first, (uint32_t)copy_count) == -1;
+            failed |= put_data(out, data + literal, position - literal) == -1;
+            copy_count = 0;
+            literal = position;
+        }
+    }
+
+    if (copy_count)
+        failed |= put_copy(out, copy_first, (uint32_t)copy_count) == -1;
+    failed |= put_data(out, data + literal, size - literal) == -1;
+
+    uint64_t digest = 0;
+    for (uint64_t offset = 0; offset < size; offset += block_size)
+        digest = digest_add(digest, strong_checksum(data + offset,
+                            size - offset < block_size ? (size_t)(size - offset) : block_size));
+
+    unsigned char end[17];
+    end[0] = DELTA_END;
+    put_u64(end + 1, size);
+    put_u64(end + 9, digest);
+    failed |= fwrite(end, sizeof(end), 1, out) != 1;
+
+    SAFE_FREE(table.slots);
+    if (failed)
+    {
+        fprintf(stderr, "delta.make_delta: couldn't write the delta\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Type:        rebuild_t
+// ----------------------
+// Output side of apply_delta: one block of the rebuilt file is gathered at a
+// time, so the digest covers the same blocks make_delta hashed
+typedef struct rebuild {
+    int fd;
+    unsigned char *block;
+    uint32_t block_size;
+    uint32_t filled;
+    uint64_t written;
+    uint64_t digest;
+} rebuild_t;
+
+// Helper Function:    flush_block
+// -------------------------------
+// Hashes and writes the gathered bytes
+//
+// returns 0 on success, -1 on write errors
+static int flush_block(rebuild_t *rebuild)
+{
+    if (rebuild->filled == 0)
+        return 0;
+
+    rebuild->digest = digest_add(rebuild->digest, strong_checksum(rebuild->block, rebuild->filled));
+    if (pwrite_all(rebuild->fd, rebuild->block, rebuild->filled, rebuild->written) == -1)
+    {
+        perror("delta.apply_delta: write failed");
+        return -1;
+    }
+    rebuild->written += rebuild->filled;
+    rebuild->filled = 0;
+    return 0;
+}
+
+// Helper Function:    append_bytes
+// --------------------------------
+// Adds bytes to the rebuilt file
+//
+// returns 0 on success, -1 on write errors
+static int append_bytes(rebuild_t *rebuild, const unsigned char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t room = rebuild->block_size - rebuild->filled;
+        size_t chunk = len < room ? len : room;
+        memcpy(rebuild->block + rebuild->filled, data, chunk);
+        rebuild->filled += (uint32_t)chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (rebuild->filled == rebuild->block_size && flush_block(rebuild) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// Helper Function:    take
+// ------------------------
+// Reads the next len bytes of the delta stream, refusing to run past its end
+//
+// returns 0 on success, -1 if the delta is shorter than claimed, 1 for connection errors
+static int take(int socket_desc, void *buf, size_t len, uint64_t delta_size, uint64_t *consumed)
+{
+    if (delta_size - *consumed < len)
+    {
+        fprintf(stderr, "delta.apply_delta: instruction runs past the end of the delta\n");
+        return -1;
+    }
+    if (recv_all(socket_desc, buf, len) == -1)
+        return 1;
+    *consumed += len;
+    return 0;
+}
+
+// Function:    apply_delta
+// ------------------------
+// Rebuilds a file from its previous version and a delta read off a socket.
+// The result is only good once END has checked its size and digest.
+//
+// base_fd: previous version of the file
+// base_size: bytes in base_fd
+// base_version: file version of base_fd
+// out_fd: receives the rebuilt file from offset 0
+// socket_desc: origin socket
+// delta_size: bytes in the delta stream
+// consumed: receives the number of delta bytes read, so the caller can drain the rest
+//
+// returns 0 on success, -1 on a file error or malformed delta, 1 for connection
+// errors, 2 if the delta was made against another version of the file
+int apply_delta(int base_fd, uint64_t base_size, uint64_t base_version, int out_fd,
+                int socket_desc, uint64_t delta_size, uint64_t *consumed)
+{
+    *consumed = 0;
+
+    unsigned char header[DELTA_HEADER_SIZE];
+    int result = take(socket_desc, header, sizeof(header), delta_size, consumed);
+    if (result != 0)
+        return result;
+
+    if (get_u64(header) != base_version)
+        return 2;
+
+    uint32_t block_size = get_u32(header + 8);
+    if (block_size != delta_block_size(base_size))
+    {
+        fprintf(stderr, "delta.apply_delta: block size %u doesn't match the signature\n", block_size);
+        return -1;
+    }
+    uint64_t base_blocks = base_size / block_size;
+
+    rebuild_t rebuild = { .fd = out_fd, .block_size = block_size };
+    size_t scratch_size = block_size > DELTA_MAX_LITERAL ? block_size : DELTA_MAX_LITERAL;
+    unsigned char *scratch = malloc(scratch_size);
+    rebuild.block = malloc(block_size);
+    if (!scratch || !rebuild.block)
+    {
+        fprintf(stderr, "delta.apply_delta: memory allocation failed\n");
+        free(scratch);
+        free(rebuild.block);
+        return -1;
+    }
+
+    posix_fadvise(base_fd, 0, (off_t)base_size, POSIX_FADV_RANDOM);
+
+    for (;;)
+    {
+        unsigned char instruction[16];
+        if ((result = take(socket_desc, instruction, 1, delta_size, consumed)) != 0)
+            break;
+
+        if (instruction[0] == DELTA_COPY)
+        {
+            if ((result = take(socket_desc, instruction, 12, delta_size, consumed)) != 0)
+                break;
+            uint64_t first = get_u64(instruction);
+            uint32_t count = get_u32(instruction + 8);
+            if (count > base_blocks || first > base_blocks - count)
+            {
+                fprintf(stderr, "delta.apply_delta: copy of blocks past the end of the file\n");
+                result = -1;
+                break;
+            }
+            for (uint64_t i = first; i < first + count && result == 0; i++)
+            {
+                if (pread_all(base_fd, scratch, block_size, i * block_size) == -1)
+                {
+                    perror("delta.apply_delta: couldn't read the previous version");
+                    result = -1;
+                }
+                else
+                    result = append_bytes(&rebuild, scratch, block_size);
+            }
+            if (result != 0)
+                break;
+        }
+        else if (instruction[0] == DELTA_DATA)
+        {
+            if ((result = take(socket_desc, instruction, 4, delta_size, consumed)) != 0)
+                break;
+            uint32_t len = get_u32(instruction);
+            if (len == 0 || len > DELTA_MAX_LITERAL)
+            {
+                fprintf(stderr, "delta.apply_delta: bad data length %u\n", len);
+                result = -1;
+                break;
+            }
+            if ((result = take(socket_desc, scratch, len, delta_size, consumed)) != 0 ||
+                (result = append_bytes(&rebuild, scratch, len)) != 0)
+                break;
+        }
+        else if (instruction[0] == DELTA_END)
+        {
+            if ((result = take(socket_desc, instruction, 16, delta_size, consumed)) != 0 ||
+                (result = flush_block(&rebuild)) != 0)
+                break;
+            if (*consumed != delta_size || rebuild.written != get_u64(instruction) ||
+                rebuild.digest != get_u64(instruction + 8))
+            {
+                fprintf(stderr, "delta.apply_delta: rebuilt file doesn't match the client's\n");
+                result = -1;
+            }
+            break;
+        }
+        else
+        {
+            fprintf(stderr, "delta.apply_delta: unknown instruction %u\n", instruction[0]);
+            result = -1;
+            break;
+        }
+    }
+
+    SAFE_FREE(scratch);
+    SAFE_FREE(rebuild.block);
+    return result;
+}
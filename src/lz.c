@@ -0,0 +1,234 @@
+/*
+ * lz.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Fast LZ77 block codec for compressed transfers
+ */
+
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_HASH_BITS 13
+#define LZ_MAX_OFFSET 65535
+#define LZ_SKIP_SHIFT 6 // Unmatched bytes before the search starts stepping faster
+
+// Helper Function:    read32 / read64
+// -----------------------------------
+// Unaligned loads
+static uint32_t read32(const uint8_t *in)
+{
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+static uint64_t read64(const uint8_t *in)
+{
+    uint64_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+// Helper Function:    hash4
+// -------------------------
+// Hash table slot for the 4 bytes at a position
+static uint32_t hash4(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Helper Function:    match_length
+// --------------------------------
+// Counts how far two positions agree, stopping at end
+static size_t match_length(const uint8_t *a, const uint8_t *b, const uint8_t *end)
+{
+    const uint8_t *start = b;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (b + 8 <= end)
+    {
+        uint64_t diff = read64(a) ^ read64(b);
+        if (diff)
+            return (size_t)(b - start) + (__builtin_ctzll(diff) >> 3);
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (b < end && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return (size_t)(b - start);
+}
+
+// Helper Function:    put_length
+// ------------------------------
+// Writes the extension bytes of a length whose nibble was 15
+static uint8_t *put_length(uint8_t *out, size_t len)
+{
+    while (len >= 255)
+    {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = (uint8_t)len;
+    return out;
+}
+
+// Helper Function:    put_sequence
+// --------------------------------
+// Writes one sequence, with match_len 0 for the final literals-only one
+//
+// returns the new output position, NULL if it wouldn't fit before out_end
+static uint8_t *put_sequence(uint8_t *out, uint8_t *out_end, const uint8_t *literals, size_t literal_len,
+                             size_t offset, size_t match_len)
+{
+    size_t worst = 1 + literal_len / 255 + 1 + literal_len + (match_len ? 2 + match_len / 255 + 1 : 0);
+    if (worst > (size_t)(out_end - out))
+        return NULL;
+
+    uint8_t *token = out++;
+    *token = (uint8_t)((literal_len >= 15 ? 15 : literal_len) << 4);
+    if (literal_len >= 15)
+        out = put_length(out, literal_len - 15);
+    memcpy(out, literals, literal_len);
+    out += literal_len;
+
+    if (match_len)
+    {
+        *out++ = (uint8_t)(offset & 0xff);
+        *out++ = (uint8_t)(offset >> 8);
+        size_t extra = match_len - LZ_MIN_MATCH;
+        *token |= (uint8_t)(extra >= 15 ? 15 : extra);
+        if (extra >= 15)
+            out = put_length(out, extra - 15);
+    }
+    return out;
+}
+
+// Function:    lz_compress
+// ------------------------
+// Compresses a block. Each position is looked up by its next 4 bytes in a
+// table of the last position with the same hash; the search steps faster
+// the longer it goes without a match, so incompressible data costs little.
+//
+// source/len: bytes to compress, at most LZ_CHUNK
+// dest: output buffer
+// capacity: bytes available in dest
+//
+// returns compressed size, 0 if it wouldn't fit in capacity
+size_t lz_compress(const void *source, size_t len, void *dest, size_t capacity)
+{
+    const uint8_t *src = (const uint8_t *)source;
+    const uint8_t *in = src, *anchor = src, *end = src + len;
+    uint8_t *out = (uint8_t *)dest, *out_end = out + capacity;
+    uint32_t table[1 << LZ_HASH_BITS];
+
+    // Unfilled slots point at position 0, which the byte comparison rejects
+    memset(table, 0, sizeof(table));
+
+    while (len >= LZ_MIN_MATCH && in <= end - LZ_MIN_MATCH)
+    {
+        uint32_t sequence = read32(in);
+        uint32_t slot = hash4(sequence);
+        const uint8_t *candidate = src + table[slot];
+        table[slot] = (uint32_t)(in - src);
+
+        if (candidate < in && in - candidate <= LZ_MAX_OFFSET && read32(candidate) == sequence)
+        {
+            size_t match_len = LZ_MIN_MATCH + match_length(candidate + LZ_MIN_MATCH, in + LZ_MIN_MATCH, end);
+            out = put_sequence(out, out_end, anchor, (size_t)(in - anchor), (size_t)(in - candidate), match_len);
+            if (!out)
+                return 0;
+            in += match_len;
+            anchor = in;
+            continue;
+        }
+
+        in += 1 + ((size_t)(in - anchor) >> LZ_SKIP_SHIFT);
+    }
+
+    out = put_sequence(out, out_end, anchor, (size_t)(end - anchor), 0, 0);
+    return out ? (size_t)(out - (uint8_t *)dest) : 0;
+}
+
+// Helper Function:    get_length
+// ------------------------------
+// Reads the extension bytes of a length whose nibble was 15
+//
+// returns 0 on success, -1 if the block ends first
+static int get_length(const uint8_t **in, const uint8_t *end, size_t *len)
+{
+    uint8_t byte;
+    do {
+        if (*in >= end)
+            return -1;
+        byte = *(*in)++;
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+// Function:    lz_decompress
+// --------------------------
+// Expands a block, checking every length and offset against both buffers so
+// corrupt input can't read or write out of bounds
+//
+// source/len: compressed block
+// dest: output buffer
+// capacity: bytes available in dest
+// produced: receives the expanded size
+//
+// returns 0 on success, -1 on a malformed block
+int lz_decompress(const void *source, size_t len, void *dest, size_t capacity, size_t *produced)
+{
+    const uint8_t *in = (const uint8_t *)source, *end = in + len;
+    uint8_t *start = (uint8_t *)dest, *out = start, *out_end = start + capacity;
+
+    while (in < end)
+    {
+        uint8_t token = *in++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && get_length(&in, end, &literal_len) == -1)
+            return -1;
+        if (literal_len > (size_t)(end - in) || literal_len > (size_t)(out_end - out))
+            return -1;
+        memcpy(out, in, literal_len);
+        in += literal_len;
+        out += literal_len;
+
+        if (in == end) // Final sequence
+            break;
+
+        if (end - in < 2)
+            return -1;
+        size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - start))
+            return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(&in, end, &match_len) == -1)
+            return -1;
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(out_end - out))
+            return -1;
+
+        // Overlapping matches repeat the last offset bytes, so copy forwards
+        const uint8_t *from = out - offset;
+        if (offset >= match_len)
+            memcpy(out, from, match_len);
+        else
+            for (size_t i = 0; i < match_len; i++)
+                out[i] = from[i];
+        out += match_len;
+    }
+
+    *produced = (size_t)(out - start);
+    return 0;
+}
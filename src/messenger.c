@@ -7,289 +7,1845 @@
  * Consolidation of TCP operations
  */
 
+#define _GNU_SOURCE // splice(2), F_SETPIPE_SZ
 #include "messenger.h"
+#include "lz.h"
+#include "crc32c.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <strings.h>
 
-// Helper Function:    data_per_column
+transfer_config_t transfer_config = { DEFAULT_SEND_CHUNK, DEFAULT_RECEIVE_CHUNK, SEND_SENDFILE, NULL, NULL, 0 };
+
+// Live shared mappings, one per inode being sent
+static file_mapping_t *mappings;
+static pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Function:    hton64
+// -------------------
+// Converts a 64-bit value to network byte order
+uint64_t hton64(uint64_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return value;
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+// Function:    ntoh64
+// -------------------
+// Converts a 64-bit value from network byte order
+uint64_t ntoh64(uint64_t value)
+{
+    return hton64(value);
+}
+
+// Function:    set_transfer_chunk
+// -------------------------------
+// Sets both the send and receive chunk sizes
+//
+// bytes: chunk size, between MIN_TRANSFER_CHUNK and MAX_TRANSFER_CHUNK
+//
+// returns 0 on success, -1 if bytes is out of range
+int set_transfer_chunk(uint64_t bytes)
+{
+    if (bytes < MIN_TRANSFER_CHUNK || bytes > MAX_TRANSFER_CHUNK)
+    {
+        fprintf(stderr, "messenger.set_transfer_chunk: chunk size must be between %d and %d bytes\n",
+                MIN_TRANSFER_CHUNK, MAX_TRANSFER_CHUNK);
+        return -1;
+    }
+    transfer_config.send_chunk = (size_t)bytes;
+    transfer_config.receive_chunk = (size_t)bytes;
+    return 0;
+}
+
+// Function:    parse_size
+// -----------------------
+// Parses a byte count with an optional K, M or G suffix (powers of 1024)
+//
+// text: e.g. "4096", "512K", "8M"
+// size: destination for the parsed value
+//
+// returns 0 on success, -1 if text isn't a valid size
+int parse_size(const char *text, uint64_t *size)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || *text == '-')
+        return -1;
+
+    int shift = 0;
+    switch (*end)
+    {
+        case '\0':          break;
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default:            return -1;
+    }
+    if (*end != '\0' || value > (UINT64_MAX >> shift))
+        return -1;
+
+    *size = (uint64_t)value << shift;
+    return 0;
+}
+
+// Function:    set_progress_callback
+// ----------------------------------
+// Installs the callback receiving progress reports of every transfer
+//
+// callback: called with each report, NULL to stop reporting
+// context: handed to the callback unchanged
+// interval_ms: shortest gap between reports while a transfer runs
+void set_progress_callback(progress_callback_t callback, void *context, unsigned interval_ms)
+{
+    transfer_config.progress_context = context;
+    transfer_config.progress_interval = interval_ms / 1000.0;
+    transfer_config.progress = callback;
+}
+
+// Helper Function:    seconds_since
+// ---------------------------------
+// Monotonic time elapsed since start
+//
+// returns seconds
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Helper Function:    progress_report
+// -----------------------------------
+// Fills in the timing of a report and hands it to the callback
+static void progress_report(transfer_progress_t *progress, double elapsed)
+{
+    progress->elapsed = elapsed;
+    progress->rate = elapsed > 0 ? (double)progress->bytes / elapsed : 0;
+    progress->next_report = elapsed + transfer_config.progress_interval;
+    transfer_config.progress(progress, transfer_config.progress_context);
+}
+
+// Function:    progress_start
+// ---------------------------
+// Begins tracking a transfer, reporting it to the callback if there is one
+//
+// progress: tracker for the transfer
+// total: bytes the transfer will move
+void progress_start(transfer_progress_t *progress, uint64_t total)
+{
+    memset(progress, 0, sizeof(*progress));
+    progress->total = total;
+    if (!transfer_config.progress)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &progress->start);
+    progress_report(progress, 0);
+}
+
+// Function:    progress_advance
+// -----------------------------
+// Counts bytes moved, reporting only once the interval since the last report
+// has passed, so the hot loops pay one clock read per chunk at most
+void progress_advance(transfer_progress_t *progress, uint64_t bytes)
+{
+    progress->bytes += bytes;
+    if (!transfer_config.progress)
+        return;
+
+    double elapsed = seconds_since(&progress->start);
+    if (elapsed >= progress->next_report)
+        progress_report(progress, elapsed);
+}
+
+// Function:    progress_finish
+// ----------------------------
+// Sends the final report of a transfer, complete or not
+void progress_finish(transfer_progress_t *progress)
+{
+    if (!transfer_config.progress)
+        return;
+    progress->done = 1;
+    progress_report(progress, seconds_since(&progress->start));
+}
+
+// Function:    send_all
+// ---------------------
+// Sends exactly len bytes, retrying on short writes
+//
+// socket_desc: file descriptor for destination socket
+// buf: data to send
+// len: number of bytes
+//
+// returns 0 on success, -1 on failure
+int send_all(int socket_desc, const void *buf, size_t len)
+{
+    const char *cursor = (const char *)buf;
+
+    while (len > 0)
+    {
+        ssize_t result = send(socket_desc, cursor, len, MSG_NOSIGNAL);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        cursor += result;
+        len -= (size_t)result;
+    }
+    return 0;
+}
+
+// Function:    recv_all
+// ---------------------
+// Reads exactly len bytes, retrying until the whole range has arrived
+//
+// socket_desc: file descriptor for origin socket
+// buf: destination buffer
+// len: number of bytes
+//
+// returns 0 on success, -1 on failure or if the peer disconnected
+int recv_all(int socket_desc, void *buf, size_t len)
+{
+    char *cursor = (char *)buf;
+
+    while (len > 0)
+    {
+        ssize_t result = recv(socket_desc, cursor, len, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (result == 0) // Peer hung up mid-frame
+            return -1;
+        cursor += result;
+        len -= (size_t)result;
+    }
+    return 0;
+}
+
+// Function:    send_frame
+// -----------------------
+// Sends a single frame, header and payload in one write so small control
+// messages leave as a single segment
+//
+// socket_desc: file descriptor for destination socket
+// type: MSG_* frame type
+// flags: frame flags
+// payload: frame body, may be NULL when length is 0
+// length: size of payload in bytes
+//
+// returns 0 on success, -1 on failure
+int send_frame(int socket_desc, uint8_t type, uint8_t flags, const void *payload, uint32_t length)
+{
+    if (length > FRAME_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "messenger.send_frame: payload of %u bytes exceeds frame limit\n", length);
+        return -1;
+    }
+
+    // Encode header
+    unsigned char header[FRAME_HEADER_SIZE] = {0};
+    uint32_t wire_length = htonl(length);
+    header[0] = type;
+    header[1] = flags;
+    memcpy(header + 4, &wire_length, sizeof(wire_length));
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAME_HEADER_SIZE;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = length;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = length ? 2 : 1;
+
+    // Gather write, then finish any remainder with send_all
+    size_t total = FRAME_HEADER_SIZE + (size_t)length;
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket_desc, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0)
+        return -1;
+    if ((size_t)sent == total)
+        return 0;
+
+    if ((size_t)sent < FRAME_HEADER_SIZE)
+    {
+        if (send_all(socket_desc, header + sent, FRAME_HEADER_SIZE - sent) == -1)
+            return -1;
+        sent = FRAME_HEADER_SIZE;
+    }
+    return send_all(socket_desc, (const char *)payload + (sent - FRAME_HEADER_SIZE), total - sent);
+}
+
+// Function:    decode_frame_header
+// --------------------------------
+// Decodes the fixed header of a frame into type, flags and length
+//
+// header: FRAME_HEADER_SIZE bytes as read from the wire
+// frame: frame_t to populate
+void decode_frame_header(const unsigned char *header, frame_t *frame)
+{
+    uint32_t wire_length;
+
+    frame->type = header[0];
+    frame->flags = header[1];
+    memcpy(&wire_length, header + 4, sizeof(wire_length));
+    frame->length = ntohl(wire_length);
+}
+
+// Function:    receive_frame
+// --------------------------
+// Reads one complete frame from a socket
+//
+// socket_desc: file descriptor for origin socket
+// frame: frame_t to populate
+//
+// returns 0 on success, -1 on failure
+int receive_frame(int socket_desc, frame_t *frame)
+{
+    unsigned char header[FRAME_HEADER_SIZE];
+
+    frame->payload = frame->inline_payload;
+    frame->length = 0;
+
+    if (recv_all(socket_desc, header, FRAME_HEADER_SIZE) == -1)
+        return -1;
+
+    decode_frame_header(header, frame);
+
+    if (frame->length > FRAME_MAX_PAYLOAD)
+    {
+        fprintf(stderr, "messenger.receive_frame: oversized frame (%u bytes) on socket %d\n", frame->length, socket_desc);
+        return -1;
+    }
+
+    // Only spill to the heap for payloads too large for the inline buffer
+    if (frame->length > FRAME_INLINE_SIZE)
+    {
+        frame->payload = (char *)malloc(frame->length + 1);
+        if (!frame->payload)
+        {
+            fprintf(stderr, "messenger.receive_frame: memory allocation failed\n");
+            frame->payload = frame->inline_payload;
+            return -1;
+        }
+    }
+
+    if (recv_all(socket_desc, frame->payload, frame->length) == -1)
+    {
+        free_frame(frame);
+        return -1;
+    }
+    frame->payload[frame->length] = '\0';
+
+    return 0;
+}
+
+// Function:    free_frame
+// -----------------------
+// Releases any heap storage held by a frame
+void free_frame(frame_t *frame)
+{
+    if (frame->payload && frame->payload != frame->inline_payload)
+        free(frame->payload);
+    frame->payload = frame->inline_payload;
+    frame->length = 0;
+}
+
+// Function:    file_version
+// -------------------------
+// Identifies one version of a file. Files are replaced by rename, so a new
+// version always has a new inode or modification time.
+//
+// info: stat of the file
+//
+// returns version, never 0
+uint64_t file_version(const struct stat *info)
+{
+    uint64_t identity[4] = { (uint64_t)info->st_dev, (uint64_t)info->st_ino,
+                             (uint64_t)info->st_mtim.tv_sec, (uint64_t)info->st_mtim.tv_nsec };
+    uint64_t hash = 14695981039346656037ULL;
+
+    // FNV-1a over the identity
+    for (size_t i = 0; i < sizeof(identity); i++)
+        hash = (hash ^ ((const unsigned char *)identity)[i]) * 1099511628211ULL;
+    return hash ? hash : 1;
+}
+
+// Function:    open_file
+// ----------------------
+// Opens a file for transmission and reports its size
+//
+// filename: string indicating relative filepath
+// file_size: destination for the size of the file in bytes
+//
+// returns fd on success, -1 if the file can't be opened or isn't a regular file
+int open_file(const char *filename, uint64_t *file_size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "messenger.open_file: error opening file %s\n", filename);
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode))
+    {
+        fprintf(stderr, "messenger.open_file: %s is not a regular file\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    *file_size = (uint64_t)info.st_size;
+    return fd;
+}
+
+// Function:    check_directory
+// ----------------------------
+// Tests whether the directory a file would be saved into exists
+//
+// filename: string file name, optionally prefixed by a relative path
+//
+// returns 1 if the outer directory exists (or none is given), 0 otherwise
+int check_directory(const char *filename)
+{
+	// Find outer directory
+	char directory_name[BUFFER_SIZE];
+	const char *last_slash = strrchr(filename, '/');
+
+	// No relative path, the file lands in the working directory
+	if (!last_slash)
+		return 1;
+
+	// Truncate outer directory
+	size_t last_slash_index = last_slash - filename;
+	if (last_slash_index >= sizeof(directory_name))
+		return 0;
+	if (last_slash_index == 0) // File in the root directory
+		return 1;
+	memcpy(directory_name, filename, last_slash_index);
+	directory_name[last_slash_index] = '\0';
+#ifdef DEBUG
+	fprintf(stdout, "DEBUG messenger.check_directory: outer directory provided: %s\n", directory_name);
+#endif
+
+	// Test if outer directory exists and is a directory
+	struct stat info;
+	if (stat(directory_name, &info) != 0)
+	{
+		fprintf(stderr, "messenger.check_directory: directory %s doesn't exist\n", directory_name);
+		return 0;
+	}
+	if (!S_ISDIR(info.st_mode))
+	{
+		fprintf(stderr, "messenger.check_directory: %s is not a directory\n", directory_name);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Function:    drain_stream
+// -------------------------
+// Reads and discards bytes from a socket, used to keep the stream aligned
+// when an announced transfer can't be stored
+//
+// socket_desc: file descriptor for origin socket
+// size: number of bytes to discard
+//
+// returns 0 on success, -1 if the connection failed
+int drain_stream(int socket_desc, uint64_t size)
+{
+	char buffer[DRAIN_BUFFER_SIZE];
+
+	while (size > 0)
+	{
+		size_t chunk = size < DRAIN_BUFFER_SIZE ? (size_t)size : DRAIN_BUFFER_SIZE;
+		if (recv_all(socket_desc, buffer, chunk) == -1)
+			return -1;
+		size -= chunk;
+	}
+	return 0;
+}
+
+// Function:    map_shared_file
+// ----------------------------
+// Maps a whole file read-only, reusing the live mapping of the same inode if
+// there is one, and hints the kernel to read it ahead sequentially
+//
+// fd: open file
+//
+// returns referenced mapping to pass to unmap_shared_file, NULL if it can't be mapped
+file_mapping_t *map_shared_file(int fd)
+{
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size <= 0)
+        return NULL;
+    uint64_t file_size = (uint64_t)info.st_size;
+
+    pthread_mutex_lock(&mappings_lock);
+    file_mapping_t *mapping = mappings;
+    while (mapping && (mapping->device != info.st_dev || mapping->inode != info.st_ino || mapping->size != file_size))
+        mapping = mapping->next;
+
+    if (mapping)
+    {
+        mapping->refs++;
+        pthread_mutex_unlock(&mappings_lock);
+        return mapping;
+    }
+
+    // First sender of this inode maps it
+    mapping = malloc(sizeof(file_mapping_t));
+    void *data = mapping ? mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (data == MAP_FAILED)
+    {
+        pthread_mutex_unlock(&mappings_lock);
+        SAFE_FREE(mapping);
+        return NULL;
+    }
+    madvise(data, file_size, MADV_SEQUENTIAL);
+
+    mapping->device = info.st_dev;
+    mapping->inode = info.st_ino;
+    mapping->size = file_size;
+    mapping->data = (char *)data;
+    mapping->refs = 1;
+    mapping->next = mappings;
+    mappings = mapping;
+    pthread_mutex_unlock(&mappings_lock);
+
+    return mapping;
+}
+
+// Function:    unmap_shared_file
+// ------------------------------
+// Drops a reference taken by map_shared_file, unmapping after the last one
+void unmap_shared_file(file_mapping_t *mapping)
+{
+    pthread_mutex_lock(&mappings_lock);
+    if (--mapping->refs > 0)
+    {
+        pthread_mutex_unlock(&mappings_lock);
+        return;
+    }
+
+    file_mapping_t **link = &mappings;
+    while (*link != mapping)
+        link = &(*link)->next;
+    *link = mapping->next;
+    pthread_mutex_unlock(&mappings_lock);
+
+    munmap(mapping->data, mapping->size);
+    SAFE_FREE(mapping);
+}
+
+// Helper Function:    checksum_range
+// ----------------------------------
+// Extends a CRC32C with length bytes of a file read back from offset, for
+// data the kernel moved without showing it to user space. The bytes were
+// just sent or written, so they come from the page cache.
+//
+// fd: file the bytes are in, open for reading
+// buffer/buffer_size: scratch space for the reads
+// offset/length: range to checksum
+// checksum: running CRC32C to extend
+//
+// returns 0 on success, -1 on read errors
+static int checksum_range(int fd, char *buffer, size_t buffer_size, uint64_t offset, uint64_t length,
+                          uint32_t *checksum)
+{
+    while (length > 0)
+    {
+        size_t piece = length < buffer_size ? (size_t)length : buffer_size;
+        if (pread_all(fd, buffer, piece, offset) == -1)
+            return -1;
+        *checksum = crc32c(*checksum, buffer, piece);
+        offset += piece;
+        length -= piece;
+    }
+    return 0;
+}
+
+// Function:    checksum_file
+// --------------------------
+// Extends a CRC32C with a range of a file, read in transfer_config.send_chunk
+// pieces, for bytes a transfer's checksum covers but the transfer doesn't
+// carry, such as those kept from before a resume
+//
+// fd: file open for reading
+// offset/length: range to checksum
+// checksum: running CRC32C to extend
+//
+// returns 0 on success, -1 on read errors
+int checksum_file(int fd, uint64_t offset, uint64_t length, uint32_t *checksum)
+{
+    if (length == 0)
+        return 0;
+
+    size_t buffer_size = transfer_config.send_chunk;
+    char *buffer = (char *)malloc(buffer_size);
+    if (!buffer)
+    {
+        fprintf(stderr, "messenger.checksum_file: memory allocation failed\n");
+        return -1;
+    }
+    int result = checksum_range(fd, buffer, buffer_size, offset, length, checksum);
+    SAFE_FREE(buffer);
+    return result;
+}
+
+// Helper Function:    send_mapped
+// -------------------------------
+// Sends a range of a file from its shared mapping, asking the kernel to fault
+// in the next chunk while the current one is being sent
+//
+// fd/offset/length/socket_desc/checksum: as for send_file_range
+// total_bytes_transferred: running count, advanced as data is sent
+// progress: telemetry of the transfer
+//
+// returns 0 on success, 1 for connection errors, 2 if the range can't be mapped
+int send_mapped(int fd, uint64_t offset, uint64_t length, int socket_desc, uint64_t *total_bytes_transferred,
+                transfer_progress_t *progress, uint32_t *checksum)
+{
+    file_mapping_t *mapping = map_shared_file(fd);
+    if (!mapping)
+        return 2;
+    if (offset > mapping->size || length > mapping->size - offset)
+    {
+        unmap_shared_file(mapping);
+        return 2;
+    }
+
+    size_t chunk_size = transfer_config.send_chunk;
+    int result = 0;
+    while (*total_bytes_transferred < length)
+    {
+        uint64_t remaining = length - *total_bytes_transferred;
+        size_t piece = remaining < chunk_size ? (size_t)remaining : chunk_size;
+        char *chunk = mapping->data + offset + *total_bytes_transferred;
+
+        // Read ahead of the socket
+        if (remaining > piece)
+        {
+            uint64_t ahead = remaining - piece;
+            madvise(chunk + piece, ahead < chunk_size ? (size_t)ahead : chunk_size, MADV_WILLNEED);
+        }
+
+        if (checksum)
+            *checksum = crc32c(*checksum, chunk, piece);
+
+        if (send_all(socket_desc, chunk, piece) == -1)
+        {
+            fprintf(stderr, "\nmessenger.send_file: Error sending data from fd %d to socket %d\n", fd, socket_desc);
+            result = 1;
+            break;
+        }
+
+        *total_bytes_transferred += piece;
+        progress_advance(progress, piece);
+    }
+
+    unmap_shared_file(mapping);
+    return result;
+}
+
+// Function:	send_file
+// ----------------------
+// Transmits file_size bytes from the start of an open file to the provided socket
+//
+// fd: file descriptor opened with open_file
+// file_size: number of bytes announced to the peer
+// socket_desc: file descriptor for the socket
+//
+// returns: 0 on success, -1 on file read errors, 1 for connection errors
+int send_file(int fd, uint64_t file_size, int socket_desc)
+{
+	return send_file_range(fd, 0, file_size, socket_desc, NULL);
+}
+
+// Function:	send_file_range
+// ----------------------------
+// Transmits length bytes of an open file, starting at offset, to the provided
+// socket. Uses sendfile(2) in transfer_config.send_chunk pieces so the data
+// never enters user space, or, with transfer_config.send_mode set to SEND_MMAP,
+// sends from a mapping shared by every concurrent sender of the file, with
+// sendfile for a file that can't be mapped. Only the server sets SEND_MMAP,
+// since only its files are replaced by rename, so a client's own files are
+// never mapped. A buffered pread/send loop of the same chunk size finishes
+// whatever sendfile can't handle. The fd's file position is left alone.
+//
+// fd: file descriptor opened with open_file
+// offset: first byte to send
+// length: number of bytes announced to the peer
+// socket_desc: file descriptor for the socket
+// checksum: running CRC32C to extend with the bytes as they are sent, or
+//           NULL. Bytes sendfile moved are read back from the page cache
+//           to checksum them.
+//
+// returns: 0 on success, -1 on file read errors, 1 for connection errors
+int send_file_range(int fd, uint64_t offset, uint64_t length, int socket_desc, uint32_t *checksum)
+{
+
+#ifdef DEBUG
+	fprintf(stdout, "DEBUG: messenger.send_file: attempting transfer of fd %d from %" PRIu64 " to socket %d\n", fd, offset, socket_desc);
+#endif
+
+	size_t chunk_size = transfer_config.send_chunk;
+	uint64_t total_bytes_transferred = 0;
+	transfer_progress_t progress;
+	progress_start(&progress, length);
+	int result = 0;
+
+	// Checksummed bytes are read back into this buffer, as is anything sendfile can't send
+	char *buffer = NULL;
+	if (checksum && !(buffer = (char *)malloc(chunk_size)))
+	{
+		fprintf(stderr, "\nmessenger.send_file: memory allocation failed\n");
+		result = -1;
+	}
+
+	// Shared mapping, when asked for
+	if (result == 0 && transfer_config.send_mode == SEND_MMAP)
+	{
+		if (send_mapped(fd, offset, length, socket_desc, &total_bytes_transferred, &progress, checksum) == 1)
+			result = 1;
+	}
+	else if (result == 0) // Tell the kernel to read ahead aggressively for sendfile
+		posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_SEQUENTIAL);
+
+	// Zero-copy path: let the kernel move pages from the file to the socket
+	while (result == 0 && total_bytes_transferred < length)
+	{
+		uint64_t remaining = length - total_bytes_transferred;
+		off_t position = (off_t)(offset + total_bytes_transferred);
+		ssize_t bytes_sent = sendfile(socket_desc, fd, &position, remaining < chunk_size ? (size_t)remaining : chunk_size);
+		if (bytes_sent < 0)
+		{
+			if (errno == EINTR) continue;
+
+			// The fd doesn't support sendfile, finish with the buffered loop
+			if ((errno == EINVAL || errno == ENOSYS) && total_bytes_transferred == 0)
+				break;
+
+			if (errno == EIO)
+			{
+				fprintf(stderr, "\nmessenger.send_file: error reading from fd %d\n", fd);
+				result = -1;
+			}
+			else
+			{
+				fprintf(stderr, "\nmessenger.send_file: Error sending data from fd %d to socket %d\n", fd, socket_desc);
+				result = 1;
+			}
+			break;
+		}
+		if (bytes_sent == 0 || // File shrank mid-transfer
+		    (checksum && checksum_range(fd, buffer, chunk_size, offset + total_bytes_transferred, bytes_sent,
+		                                checksum) == -1))
+		{
+			fprintf(stderr, "\nmessenger.send_file: unexpected end of fd %d\n", fd);
+			result = -1;
+			break;
+		}
+
+		total_bytes_transferred += bytes_sent;
+		progress_advance(&progress, bytes_sent);
+	}
+
+	// Buffered iteration through whatever sendfile couldn't handle
+	if (result == 0 && total_bytes_transferred < length && !buffer && !(buffer = (char *)malloc(chunk_size)))
+	{
+		fprintf(stderr, "\nmessenger.send_file: memory allocation failed\n");
+		result = -1;
+	}
+	while (result == 0 && total_bytes_transferred < length)
+	{
+		uint64_t remaining = length - total_bytes_transferred;
+		ssize_t bytes_read = pread(fd, buffer, remaining < chunk_size ? (size_t)remaining : chunk_size,
+		                           (off_t)(offset + total_bytes_transferred));
+		if (bytes_read <= 0) // File shrank or became unreadable mid-transfer
+		{
+			if (bytes_read < 0 && errno == EINTR) continue;
+			fprintf(stderr, "\nmessenger.send_file: error reading from fd %d\n", fd);
+			result = -1;
+			break;
+		}
+		if (checksum)
+			*checksum = crc32c(*checksum, buffer, bytes_read);
+
+		// Mechanism to handle when all bytes aren't sent at once
+		if (send_all(socket_desc, buffer, bytes_read) == -1)
+		{
+			fprintf(stderr, "\nmessenger.send_file: Error sending data from fd %d to socket %d\n", fd, socket_desc);
+			result = 1;
+			break;
+		}
+
+		total_bytes_transferred += bytes_read;
+		progress_advance(&progress, bytes_read);
+	}
+
+	// Every path ends here, so the final report goes out for a failed transfer too
+	SAFE_FREE(buffer);
+	progress_finish(&progress);
+
+#ifdef DEBUG
+	if (result == 0)
+		fprintf(stdout, "DEBUG: messenger.send_file: fd %d successfully sent to socket %d\n", fd, socket_desc);
+#endif
+	return result;
+}
+
+// Function:    send_checksum
+// --------------------------
+// Sends the CRC32C trailer that ends a checksummed transfer
+//
+// returns 0 on success, -1 on failure
+int send_checksum(int socket_desc, uint32_t checksum)
+{
+    uint32_t wire_checksum = htonl(checksum);
+    return send_all(socket_desc, &wire_checksum, sizeof(wire_checksum));
+}
+
+// Function:    receive_checksum
+// -----------------------------
+// Reads the CRC32C trailer of a checksummed transfer and compares it with
+// the receiver's own
+//
+// returns 0 if they match, 1 if the connection failed, 3 if they differ
+int receive_checksum(int socket_desc, uint32_t checksum)
+{
+    uint32_t wire_checksum;
+    if (recv_all(socket_desc, &wire_checksum, sizeof(wire_checksum)) == -1)
+        return 1;
+    if (ntohl(wire_checksum) != checksum)
+    {
+        fprintf(stderr, "\nmessenger.receive_checksum: sender's CRC32C %08x, received data %08x\n",
+                ntohl(wire_checksum), checksum);
+        return 3;
+    }
+    return 0;
+}
+
+// Function:    pwrite_all
+// -----------------------
+// Writes exactly len bytes to a file descriptor at offset, leaving its file
+// position alone
+//
+// returns 0 on success, -1 on failure
+int pwrite_all(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const char *cursor = (const char *)buf;
+
+    while (len > 0)
+    {
+        ssize_t result = pwrite(fd, cursor, len, (off_t)offset);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        cursor += result;
+        offset += (uint64_t)result;
+        len -= (size_t)result;
+    }
+    return 0;
+}
+
+// Function:    pread_all
+// ----------------------
+// Reads exactly len bytes of a file at offset, leaving its file position alone
+//
+// returns 0 on success, -1 on failure or if the file ends first
+int pread_all(int fd, void *buf, size_t len, uint64_t offset)
+{
+    char *cursor = (char *)buf;
+
+    while (len > 0)
+    {
+        ssize_t result = pread(fd, cursor, len, (off_t)offset);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0)
+            return -1;
+        cursor += result;
+        offset += (uint64_t)result;
+        len -= (size_t)result;
+    }
+    return 0;
+}
+
+// Helper Function:    splice_to_file
+// ----------------------------------
+// Moves bytes from a socket into a file through a pipe with splice(2), so the
+// data is never copied into user space on its way in. Checksummed bytes are
+// read back from the page cache once they have landed.
+//
+// socket_desc: origin socket
+// fd: destination file
+// offset: file position the first byte lands at
+// file_size: number of bytes to move
+// total_bytes_received: running count, advanced as data lands in the file
+// progress: telemetry of the transfer
+// checksum: running CRC32C to extend with the bytes, or NULL
+//
+// returns 0 on success, 1 for connection errors, -1 on file errors,
+// 2 if splice isn't usable and nothing has been consumed yet
+int splice_to_file(int socket_desc, int fd, uint64_t offset, uint64_t file_size, uint64_t *total_bytes_received,
+                   transfer_progress_t *progress, uint32_t *checksum)
+{
+    // Bytes can only be checksummed if they can be read back
+    if (checksum && (fcntl(fd, F_GETFL) & O_ACCMODE) == O_WRONLY)
+        return 2;
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1)
+        return 2;
+
+    // A deeper pipe means fewer round trips through the kernel; the kernel may
+    // cap the request at fs.pipe-max-size, so splice whatever it granted
+    size_t chunk_size = transfer_config.receive_chunk;
+    int granted = fcntl(pipe_fds[1], F_SETPIPE_SZ, (int)chunk_size);
+    if (granted == -1)
+        granted = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+    if (granted > 0)
+        chunk_size = (size_t)granted;
+
+    char *buffer = NULL;
+    if (checksum && !(buffer = (char *)malloc(chunk_size)))
+    {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return 2;
+    }
+
+    int result = 0;
+    while (*total_bytes_received < file_size)
+    {
+        uint64_t remaining = file_size - *total_bytes_received;
+        ssize_t in_pipe = splice(socket_desc, NULL, pipe_fds[1], NULL,
+                                 remaining < chunk_size ? (size_t)remaining : chunk_size,
+                                 SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_pipe < 0)
+        {
+            if (errno == EINTR) continue;
+            result = ((errno == EINVAL || errno == ENOSYS) && *total_bytes_received == 0) ? 2 : 1;
+            break;
+        }
+        if (in_pipe == 0) // Sender disconnected mid-stream
+        {
+            fprintf(stderr, "\nreceive_file: sender disconnected mid-stream\n");
+            result = 1;
+            break;
+        }
+
+        // Empty the pipe into the file
+        ssize_t drained = 0;
+        while (drained < in_pipe)
+        {
+            loff_t position = (loff_t)(offset + *total_bytes_received + drained);
+            ssize_t out_pipe = splice(pipe_fds[0], NULL, fd, &position, in_pipe - drained,
+                                      SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out_pipe < 0 && errno == EINTR) continue;
+            if (out_pipe <= 0)
+            {
+                result = -1;
+                break;
+            }
+            drained += out_pipe;
+        }
+        if (result == 0 && checksum &&
+            checksum_range(fd, buffer, chunk_size, offset + *total_bytes_received, in_pipe, checksum) == -1)
+            result = -1;
+        if (result)
+        {
+            // Account for what the socket already gave up so the caller can drain the rest
+            *total_bytes_received += in_pipe;
+            break;
+        }
+
+        *total_bytes_received += in_pipe;
+        progress_advance(progress, in_pipe);
+    }
+
+    SAFE_FREE(buffer);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return result;
+}
+
+// Function:    open_staging_file
+// ------------------------------
+// Creates a hidden temporary file in the same directory as filename, so it
+// can later be renamed over it atomically. The file takes the permissions of
+// the file it will replace, or 0644 for a new one.
+//
+// filename: final destination
+// staging_path: receives the temporary file's path
+// len: size of staging_path
+//
+// returns fd open for writing, -1 on failure
+int open_staging_file(const char *filename, char *staging_path, size_t len)
+{
+    const char *last_slash = strrchr(filename, '/');
+    int directory_length = last_slash ? (int)(last_slash - filename + 1) : 0;
+    const char *base = filename + directory_length;
+
+    if (snprintf(staging_path, len, "%.*s.%s.XXXXXX", directory_length, filename, base) >= (int)len)
+        return -1;
+
+    int fd = mkstemp(staging_path);
+    if (fd == -1)
+        return -1;
+
+    struct stat info;
+    mode_t mode = stat(filename, &info) == 0 ? (info.st_mode & 07777) : 0644;
+    fchmod(fd, mode);
+    return fd;
+}
+
+// Function:    receive_stream
+// ---------------------------
+// Moves file_size bytes from a socket into an open file starting at offset,
+// with positional writes so several streams may fill one file at once. Data
+// is spliced from the socket into the file where the kernel allows it, with
+// a recv/pwrite loop using a transfer_config.receive_chunk buffer as the
+// fallback. Spliced data is checksummed by reading it back from the page
+// cache, so fd should be open for reading too.
+//
+// fd: destination file
+// offset: file position the first byte lands at
+// file_size: number of bytes announced by the peer
+// socket_desc: file descriptor for socket
+// total_bytes_received: receives the number of bytes taken off the socket
+// checksum: running CRC32C to extend with the bytes as they arrive, or NULL
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors
+int receive_stream(int fd, uint64_t offset, uint64_t file_size, int socket_desc, uint64_t *total_bytes_received,
+                   uint32_t *checksum)
+{
+    size_t chunk_size = transfer_config.receive_chunk;
+    transfer_progress_t progress;
+    progress_start(&progress, file_size);
+    *total_bytes_received = 0;
+
+    // Zero-copy path
+    int result = splice_to_file(socket_desc, fd, offset, file_size, total_bytes_received, &progress, checksum);
+
+    // Fallback when splice can't be used on these descriptors
+    char *buffer = NULL;
+    if (result == 2)
+    {
+        result = 0;
+        buffer = (char *)malloc(chunk_size);
+        if (!buffer)
+        {
+            fprintf(stderr, "receive_file: memory allocation failed\n");
+            result = -1;
+        }
+    }
+
+    // While there is unreceived file volume
+    while (buffer && result == 0 && *total_bytes_received < file_size)
+	{
+        // Attempt to buffer file, never reading past the end of the transfer
+        uint64_t remaining = file_size - *total_bytes_received;
+		ssize_t bytes_received = recv(socket_desc, buffer, remaining < chunk_size ? (size_t)remaining : chunk_size, 0);
+        if (bytes_received < 0)
+		{
+			if (errno == EINTR) continue;
+			fprintf(stderr, "\nreceive_file: error occurred receiving data\n");
+			result = 1;
+			break;
+		}
+
+        // If the stream is interrupted
+		if (bytes_received == 0)
+		{
+			fprintf(stderr, "\nreceive_file: sender disconnected mid-stream\n");
+			result = 1;
+			break;
+		}
+
+		// Write the received data to file
+		uint64_t position = offset + *total_bytes_received;
+		*total_bytes_received += bytes_received;
+		if (pwrite_all(fd, buffer, bytes_received, position) == -1)
+		{
+			result = -1;
+			break;
+		}
+		if (checksum)
+			*checksum = crc32c(*checksum, buffer, bytes_received);
+
+        progress_advance(&progress, bytes_received);
+	}
+    SAFE_FREE(buffer);
+    progress_finish(&progress);
+    return result;
+}
+
+// Helper Function:    compressed_name
 // -----------------------------------
-// Find the amount of data in the file proportional to a single column in stdout
+// Recognises file types that are already compressed
 //
-// file_size: size of file in bytes
-//
-// returns transfer volume per column in a progress bar
-double data_per_column(const uint32_t file_size)
+// returns 1 if the name ends in a compressed format's extension, 0 otherwise
+static int compressed_name(const char *filename)
 {
-    struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    int window_width = w.ws_col; // Number of columns in the window
-	double column_volume = (double)file_size / (double)window_width; // data volume per column
-#ifdef DEBUG
-	fprintf(stdout, "\nmessenger.data_per_column: %d columns in this window, data per column: %lf\n", window_width, column_volume);
-#endif
-    return column_volume;
+    static const char *extensions[] = {
+        ".gz", ".tgz", ".bz2", ".xz", ".zst", ".lz4", ".zip", ".7z", ".rar",
+        ".jpg", ".jpeg", ".png", ".gif", ".webp", ".mp3", ".mp4", ".mkv", ".mov", ".webm"
+    };
+    const char *dot = strrchr(filename, '.');
+    if (!dot || strchr(dot, '/'))
+        return 0;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+        if (strcasecmp(dot, extensions[i]) == 0)
+            return 1;
+    return 0;
 }
 
-// Helper Function:    print_progress_bar
-// -------------------------------
-// Prints '#'s proportionate to download/upload progress
-// Works by iteratively subtracting a volume of data proportional to the amount of
-// download progress since the last time it was called and printing an '#' to
-// represent the fraction of the total file downloaded so far
+// Function:    should_compress
+// ----------------------------
+// Decides whether a transfer is worth compressing: small files and known
+// compressed formats are sent raw, and otherwise the first chunk is
+// compressed as a sample and has to shrink by at least an eighth
 //
-// previous_progress: represents amount of progress since progress bar last updated
-// column_volume: write volume proportional to 1*'#'
-void print_progress_bar(double *previous_progress, const double column_volume)
+// filename: name of the file, for its extension
+// fd: open file, read when data is NULL
+// data: contents in memory, or NULL
+// offset/length: range to be sent
+//
+// returns 1 to compress, 0 to send raw
+int should_compress(const char *filename, int fd, const char *data, uint64_t offset, uint64_t length)
 {
-#ifdef DEBUG
-    fprintf(stdout, "\nDEBUG messenger.print_progress_bar: previous_progress %lf\n", *previous_progress);
-#endif
+    if (length < COMPRESS_MIN_SIZE || compressed_name(filename))
+        return 0;
 
-    while (*previous_progress > column_volume)
-    {
-        fprintf(stdout, "#");
-        *previous_progress -= column_volume;
-        fflush(stdout);
-    }
+    size_t sample_size = length < LZ_CHUNK ? (size_t)length : LZ_CHUNK;
+    char *sample = malloc(sample_size * 2);
+    if (!sample)
+        return 0;
+
+    int worth = 0;
+    if (data)
+        memcpy(sample, data + offset, sample_size);
+    if (data || pread_all(fd, sample, sample_size, offset) == 0)
+        worth = lz_compress(sample, sample_size, sample + sample_size, sample_size - sample_size / 8) != 0;
+
+    SAFE_FREE(sample);
+    return worth;
 }
 
-// Function:	send_file
-// ----------------------
-// Opens a file and transmits it byte by byte to the provided socket
+// Function:    send_compressed
+// ----------------------------
+// Transmits length bytes as a compressed stream, one LZ_CHUNK at a time.
+// Chunks that don't shrink are sent as they are.
 //
-// filename: string indicating relative filepath
+// fd: file descriptor to read from when data is NULL
+// data: contents in memory, or NULL
+// offset: first byte to send
+// length: number of bytes announced to the peer
 // socket_desc: file descriptor for the socket
+// wire_bytes: receives the number of bytes actually sent, or NULL
+// checksum: running CRC32C to extend with the file bytes sent, or NULL
 //
-// returns: 0 on success, -1 on memory allocation failure, 1 for other errors
-int send_file(char *filename, int socket_desc)
+// returns: 0 on success, -1 on file read errors, 1 for connection errors
+int send_compressed(int fd, const char *data, uint64_t offset, uint64_t length, int socket_desc,
+                    uint64_t *wire_bytes, uint32_t *checksum)
 {
+    char *raw = data ? NULL : malloc(LZ_CHUNK);
+    unsigned char *packet = malloc(COMPRESSED_CHUNK_HEADER + LZ_CHUNK);
+    if ((!data && !raw) || !packet)
+    {
+        fprintf(stderr, "\nmessenger.send_compressed: memory allocation failed\n");
+        free(raw);
+        free(packet);
+        return -1;
+    }
 
-#ifdef DEBUG
-	fprintf(stdout, "DEBUG: messenger.send_file: attempting transfer of %s to socket %d\n", filename, socket_desc);
-#endif
+    transfer_progress_t progress;
+    uint64_t total_bytes_transferred = 0, sent = 0;
+    int result = 0;
+    progress_start(&progress, length);
 
-    // Open target file
-	char buffer[BUFFER_SIZE];
-	FILE* fp = fopen(filename, "rb");
-	if (!fp)
-	{
-		fprintf(stderr, "messenger.send_file: error opening file %s\n", filename);
-		return -1;
-	}
+    if (!data)
+        posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_SEQUENTIAL);
+
+    while (total_bytes_transferred < length)
+    {
+        uint64_t remaining = length - total_bytes_transferred;
+        size_t piece = remaining < LZ_CHUNK ? (size_t)remaining : LZ_CHUNK;
+        const char *chunk = data ? data + offset + total_bytes_transferred : raw;
+
+        if (!data && pread_all(fd, raw, piece, offset + total_bytes_transferred) == -1)
+        {
+            fprintf(stderr, "\nmessenger.send_compressed: error reading from fd %d\n", fd);
+            result = -1;
+            break;
+        }
+        if (checksum)
+            *checksum = crc32c(*checksum, chunk, piece);
+
+        size_t stored = lz_compress(chunk, piece, packet + COMPRESSED_CHUNK_HEADER, piece - 1);
+        if (stored == 0)
+        {
+            memcpy(packet + COMPRESSED_CHUNK_HEADER, chunk, piece);
+            stored = piece;
+        }
+        uint32_t wire_raw = htonl((uint32_t)piece), wire_stored = htonl((uint32_t)stored);
+        memcpy(packet, &wire_raw, 4);
+        memcpy(packet + 4, &wire_stored, 4);
+
+        if (send_all(socket_desc, packet, COMPRESSED_CHUNK_HEADER + stored) == -1)
+        {
+            fprintf(stderr, "\nmessenger.send_compressed: error sending to socket %d\n", socket_desc);
+            result = 1;
+            break;
+        }
+
+        sent += COMPRESSED_CHUNK_HEADER + stored;
+        total_bytes_transferred += piece;
+        progress_advance(&progress, piece);
+    }
 
-	// Get and send file size
-	fseek(fp, 0, SEEK_END);
-	uint32_t file_size = (uint32_t) ftell(fp);
-	rewind(fp);
+    SAFE_FREE(raw);
+    SAFE_FREE(packet);
+    progress_finish(&progress);
+    if (wire_bytes)
+        *wire_bytes = sent;
+    return result;
+}
 
-    // Discovering column volume
-    double column_volume = data_per_column(file_size);
+// Helper Function:    receive_chunk_header
+// ----------------------------------------
+// Reads and checks the header of the next compressed chunk
+//
+// remaining: file bytes still expected
+//
+// returns 0 on success, -1 on a connection error or malformed header
+static int receive_chunk_header(int socket_desc, uint64_t remaining, uint32_t *raw_len, uint32_t *stored_len)
+{
+    unsigned char header[COMPRESSED_CHUNK_HEADER];
+    if (recv_all(socket_desc, header, sizeof(header)) == -1)
+        return -1;
 
-    // Query information about the requested directory
-    int directory_confirmation;
-    if (recv(socket_desc, &directory_confirmation, sizeof(int), 0) == -1)
+    memcpy(raw_len, header, 4);
+    memcpy(stored_len, header + 4, 4);
+    *raw_len = ntohl(*raw_len);
+    *stored_len = ntohl(*stored_len);
+    if (*raw_len == 0 || *raw_len > LZ_CHUNK || *raw_len > remaining || *stored_len > *raw_len)
     {
-        fprintf(stderr, "messenger.send_file: error confirming filepath validity for %s\n", filename);
-        fclose(fp);
-        return 1;
+        fprintf(stderr, "\nmessenger.receive_compressed: malformed chunk header\n");
+        return -1;
     }
+    return 0;
+}
 
-    // If the directory is malformed
-    if (!directory_confirmation)
+// Function:    receive_compressed
+// -------------------------------
+// Counterpart of send_compressed: expands file_size bytes of a compressed
+// stream into an open file starting at offset
+//
+// fd: destination file
+// offset: file position the first byte lands at
+// file_size: number of file bytes announced by the peer
+// socket_desc: file descriptor for socket
+// total_bytes_received: receives the number of file bytes taken off the socket
+// checksum: running CRC32C to extend with the expanded bytes, or NULL
+//
+// returns: 0 on success, -1 on file errors or a chunk that doesn't expand,
+// 1 for connection errors or a malformed stream
+int receive_compressed(int fd, uint64_t offset, uint64_t file_size, int socket_desc, uint64_t *total_bytes_received,
+                       uint32_t *checksum)
+{
+    *total_bytes_received = 0;
+    char *packet = malloc(LZ_CHUNK);
+    char *raw = malloc(LZ_CHUNK);
+    if (!packet || !raw)
     {
-        fprintf(stderr, "messenger.send_file: invalid destination filepath %s\n", filename);
-        fclose(fp);
-        return 1;
+        fprintf(stderr, "receive_compressed: memory allocation failed\n");
+        free(packet);
+        free(raw);
+        return -1;
     }
 
-    // Send file size so the host can track transfer continuity
-    file_size = htonl(file_size);
-	if (send(socket_desc, &file_size, sizeof(file_size), 0) == -1)
-	{
-		fprintf(stderr, "messenger.send_file: error sending file size to socket %d\n", socket_desc);
-		fclose(fp);
-		return 1;
-	}
+    transfer_progress_t progress;
+    int result = 0;
+    progress_start(&progress, file_size);
 
-	// File transfer progress display information
-	int bytes_read;
-	int total_bytes_transferred = 0;
-	double previous_progress = 0;
-    // Indent for progress bar
-    fprintf(stdout, "\n");
+    while (*total_bytes_received < file_size)
+    {
+        uint32_t raw_len, stored_len;
+        if (receive_chunk_header(socket_desc, file_size - *total_bytes_received, &raw_len, &stored_len) == -1 ||
+            recv_all(socket_desc, packet, stored_len) == -1)
+        {
+            result = 1;
+            break;
+        }
 
-	// Buffered iteration through the file
-	while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, fp)) > 0)
-	{
-		// Mechanism to handle when all bytes aren't sent at once
-		int bytes_sent = 0;
-		while (bytes_sent < bytes_read)
-		{
-			// Attempt to send the buffer
-			int result = send(socket_desc, buffer + bytes_sent, bytes_read - bytes_sent, 0);
-			if (result == -1) // If sending failed
-			{
-				fprintf(stderr, "\nmessenger.send_file: Error sending data from file %s to socket %d\n", filename, socket_desc);
-				fclose(fp);
-				return 1;
-			}
-			// Increment the amount of bytes sent
-			bytes_sent += result;		
-		}
+        size_t produced = stored_len;
+        const char *chunk = packet;
+        if (stored_len < raw_len)
+        {
+            chunk = raw;
+            if (lz_decompress(packet, stored_len, raw, raw_len, &produced) == -1)
+                produced = 0;
+        }
 
-		// Handle progress bar logic
-		total_bytes_transferred += bytes_read;
-		previous_progress += (double)bytes_read;
-        print_progress_bar(&previous_progress, column_volume);
-	}
+        // The chunk is consumed either way, so the stream stays aligned
+        uint64_t position = offset + *total_bytes_received;
+        *total_bytes_received += raw_len;
+        if (produced != raw_len)
+        {
+            fprintf(stderr, "\nreceive_compressed: corrupt chunk at byte %" PRIu64 "\n", position - offset);
+            result = -1;
+            break;
+        }
+        if (pwrite_all(fd, chunk, raw_len, position) == -1)
+        {
+            result = -1;
+            break;
+        }
+        if (checksum)
+            *checksum = crc32c(*checksum, chunk, raw_len);
 
-    // Add newline after progress bar terminates
-    fprintf(stdout, "\n");
+        progress_advance(&progress, raw_len);
+    }
 
-#ifdef DEBUG
-	fprintf(stdout, "DEBUG: messenger.send_file: file %s successfully sent to socket %d\n", filename, socket_desc);
-#endif
-	fclose(fp);
-	return 0;
+    SAFE_FREE(packet);
+    SAFE_FREE(raw);
+    progress_finish(&progress);
+    return result;
+}
+
+// Function:    drain_compressed
+// -----------------------------
+// Reads and discards the rest of a compressed stream
+//
+// size: file bytes still expected
+//
+// returns 0 on success, -1 if the connection failed or the stream is malformed
+int drain_compressed(int socket_desc, uint64_t size)
+{
+    while (size > 0)
+    {
+        uint32_t raw_len, stored_len;
+        if (receive_chunk_header(socket_desc, size, &raw_len, &stored_len) == -1 ||
+            drain_stream(socket_desc, stored_len) == -1)
+            return -1;
+        size -= raw_len;
+    }
+    return 0;
+}
+
+// Function:    drain_transfer
+// ---------------------------
+// Discards the rest of a transfer, raw or compressed, and its checksum trailer
+//
+// size: file bytes still expected
+// encoding: TRANSFER_* flags of the data
+//
+// returns 0 on success, -1 if the connection failed
+int drain_transfer(int socket_desc, uint64_t size, int encoding)
+{
+    int drained = (encoding & TRANSFER_COMPRESSED) ? drain_compressed(socket_desc, size)
+                                                   : drain_stream(socket_desc, size);
+    if (drained == 0 && (encoding & TRANSFER_CHECKSUM))
+        drained = drain_stream(socket_desc, CHECKSUM_SIZE);
+    return drained;
+}
+
+// Helper Function:    receive_transfer
+// ------------------------------------
+// Receives a raw or compressed transfer into an open file, checking it
+// against its trailer when it carries one
+//
+// checksum: CRC32C of the bytes the trailer covers ahead of this data, 0 if none
+//
+// returns as receive_stream, or 3 if the data failed its checksum; on -1 the
+// rest of the transfer and its trailer are still unread
+static int receive_transfer(int fd, uint64_t offset, uint64_t file_size, int socket_desc,
+                            uint64_t *total_bytes_received, int encoding, uint32_t checksum)
+{
+    uint32_t *running = (encoding & TRANSFER_CHECKSUM) ? &checksum : NULL;
+    int result = (encoding & TRANSFER_COMPRESSED)
+               ? receive_compressed(fd, offset, file_size, socket_desc, total_bytes_received, running)
+               : receive_stream(fd, offset, file_size, socket_desc, total_bytes_received, running);
+
+    if (result == 0 && running)
+        result = receive_checksum(socket_desc, checksum);
+    return result;
 }
 
 // Function:	receive_file
 // -------------------------
-// Receives a file over TCP and saves it locally,
+// Receives file_size bytes over TCP and saves them locally through
+// receive_stream, or receive_compressed for a compressed transfer, checking
+// the data against its CRC32C when it carries one. The data lands in a temporary file beside the target which
+// is renamed over it only once complete, so readers keep seeing the previous
+// version during the transfer and a failed transfer never leaves a torn file.
+// If the file can't be opened or written the remaining bytes are drained so
+// the connection stays usable.
 // 
 // filename: string file name
+// file_size: number of bytes announced by the peer
 // socket_desc: file descriptor for socket
+// encoding: TRANSFER_* flags of the data
 //
-// returns: 0 on success, -1 on 
-int receive_file(char *filename, int socket_desc)
+// returns: 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum (nothing is stored)
+int receive_file(char *filename, uint64_t file_size, int socket_desc, int encoding)
 {
 
 #ifdef DEBUG
 	fprintf(stdout, "messenger.receive_file: attempting retrieval of %s from socket %d\n", filename, socket_desc);
 #endif
 
-	// Find outer directory
-	char directory_name[BUFFER_SIZE];
-	char *last_slash = strrchr(filename, '/');
-	
-	// If there is a specified relative path
-	if (last_slash)
+    // Stage into a temporary file next to the target
+	char staging_path[BUFFER_SIZE + 16];
+	int fd = open_staging_file(filename, staging_path, sizeof(staging_path));
+	if (fd == -1)
 	{
-		// Truncate outer directory
-		int last_slash_index = last_slash - filename;
-		strcpy(directory_name, filename);
-		directory_name[last_slash_index] = '\0';
+		fprintf(stderr, "receive_file: error opening file %s\n", filename);
+		return drain_transfer(socket_desc, file_size, encoding) == -1 ? 1 : -1;
+	}
+
 #ifdef DEBUG
-		fprintf(stdout, "DEBUG messenger.receive_file: outer directory provided: %s\n", directory_name);
+	fprintf(stdout, "DEBUG receive_file: file size of %" PRIu64 "\n", file_size);
 #endif
 
-		// Test if outer directory exists
-		struct stat info;
-		if (stat(directory_name, &info) != 0)
-		{
-            fprintf(stderr, "messenger.receive_file: directory queried at socket %d doesn't exist\n", socket_desc); // stat related error
+	uint64_t total_bytes_received;
+	int result = receive_transfer(fd, 0, file_size, socket_desc, &total_bytes_received, encoding, 0);
+	int unread = result == -1; // The transfer stopped short of its end
 
-            int message = 0;
-            if (send(socket_desc, &message, sizeof(message), 0) == -1)
-                fprintf(stderr, "messenger.receive_file: error notifying client of directory discovery failure\n");
-            return -1;
-		}
-		
-		// If the provided path isn't a directory, abort
-		if (!S_ISDIR(info.st_mode))
-		{
-			fprintf(stderr, "receive_file: directory queried at socket %d is not a path\n", socket_desc);
-            int message = 0;
-            if (send(socket_desc, &message, sizeof(message), 0) == -1)
-                fprintf(stderr, "messenger.receive_file: error notifying client of directory discovery failure\n");
-            return -1;
-		}
-	}
+    if (close(fd) != 0 && result == 0)
+        result = -1;
+
+    // Publish the complete file in one step, or throw the partial one away
+    if (result == 0 && rename(staging_path, filename) != 0)
+        result = -1;
+    if (result != 0)
+        unlink(staging_path);
+
+    // Keep the stream aligned after a local write failure
+    if (result == -1)
+    {
+		fprintf(stderr, "receive_file: error writing file %s\n", filename);
+        if (unread && drain_transfer(socket_desc, file_size - total_bytes_received, encoding) == -1)
+            return 1;
+        return -1;
+    }
 
 #ifdef DEBUG
-	fprintf(stdout, "DEBUG receive_file: proceeding to download to %s at socket %d\n", filename, socket_desc);
+	if (result == 0)
+		fprintf(stdout, "DEBUG: messenger.receive_file: file %s successfully received from socket %d\n", filename, socket_desc);
 #endif
 
-    // Signal that the directory exists.
-    int message = 1;
-    if (send(socket_desc, &message, sizeof(message), 0) == -1)
+	return result;
+}
+
+// Function:	receive_range
+// --------------------------
+// Receives one range of a striped transfer into path at offset, creating the
+// file if needed but never truncating or renaming it, so every stripe of the
+// transfer can write into the same file at once. On a local write failure the
+// remaining bytes are drained so the connection stays usable.
+//
+// path: file collecting the transfer
+// offset: file position of the range
+// size: number of bytes announced by the peer
+// socket_desc: file descriptor for socket
+// encoding: TRANSFER_* flags of the data
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum
+int receive_range(const char *path, uint64_t offset, uint64_t size, int socket_desc, int encoding)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		fprintf(stderr, "receive_file: error opening file %s\n", path);
+		return drain_transfer(socket_desc, size, encoding) == -1 ? 1 : -1;
+	}
+
+	uint64_t total_bytes_received;
+	int result = receive_transfer(fd, offset, size, socket_desc, &total_bytes_received, encoding, 0);
+	int unread = result == -1; // The transfer stopped short of its end
+
+    if (close(fd) != 0 && result == 0)
+        result = -1;
+
+    // Keep the stream aligned after a local write failure
+    if (result == -1)
     {
-        fprintf(stderr, "messenger.receive_file: error notifying client of directory discovery failure\n");
+		fprintf(stderr, "receive_file: error writing file %s\n", path);
+        if (unread && drain_transfer(socket_desc, size - total_bytes_received, encoding) == -1)
+            return 1;
+        return -1;
     }
 
-    // Open file
-	FILE* fp = fopen(filename, "wb");
-	if (!fp)
+	return result;
+}
+
+// Function:    partial_path
+// -------------------------
+// Builds the name of the file a resumable download collects into
+//
+// filename: final destination
+// part_path: receives filename with PART_SUFFIX appended
+// len: size of part_path
+//
+// returns 0 on success, -1 if the name doesn't fit
+int partial_path(const char *filename, char *part_path, size_t len)
+{
+    return snprintf(part_path, len, "%s" PART_SUFFIX, filename) >= (int)len ? -1 : 0;
+}
+
+// Function:    upload_path
+// ------------------------
+// Builds the name of the hidden file a resumable upload collects into, beside
+// its destination. Unlike open_staging_file the name is fixed by the upload
+// ID, so a later request can find the bytes an earlier one left behind.
+//
+// filename: final destination
+// upload_id: client's upload ID
+// path: receives the upload file's path
+// len: size of path
+//
+// returns 0 on success, -1 if the name doesn't fit
+int upload_path(const char *filename, uint64_t upload_id, char *path, size_t len)
+{
+    const char *last_slash = strrchr(filename, '/');
+    int directory_length = last_slash ? (int)(last_slash - filename + 1) : 0;
+
+    return snprintf(path, len, "%.*s.%s.upload-%016" PRIx64, directory_length, filename,
+                    filename + directory_length, upload_id) >= (int)len ? -1 : 0;
+}
+
+// Function:	receive_partial
+// ----------------------------
+// Receives the remainder of a transfer that already has offset bytes in
+// part_path, appending file_size more bytes. The partial file is renamed over
+// filename once complete. If the connection drops, whatever arrived stays in
+// the partial file so a later call can resume from its size; on a local write
+// failure the remaining bytes are drained so the connection stays usable.
+// The checksum of a resumed transfer covers the file from its first byte, so
+// the bytes kept from before the resume are checked along with the new ones.
+//
+// filename: final destination
+// part_path: file collecting the transfer, e.g. from partial_path or upload_path
+// offset: bytes of the partial file to keep, the rest is discarded
+// file_size: number of bytes announced by the peer
+// socket_desc: file descriptor for socket
+// encoding: TRANSFER_* flags of the data
+//
+// returns: 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum (the partial file is removed, since the
+// damage may lie in the bytes kept from before)
+int receive_partial(char *filename, const char *part_path, uint64_t offset, uint64_t file_size, int socket_desc,
+                    int encoding)
+{
+	int fd = open(part_path, O_RDWR | O_CREAT, 0644);
+
+	// Anything past offset was never acknowledged to the sender, drop it; what
+	// is kept counts towards the checksum
+	uint32_t checksum = 0;
+	if (fd != -1 && (ftruncate(fd, (off_t)offset) == -1 ||
+	                 ((encoding & TRANSFER_CHECKSUM) && checksum_file(fd, 0, offset, &checksum) == -1)))
 	{
-		fprintf(stderr, "receive_file: error opening file %s\n", filename);
-		return -1;
+		close(fd);
+		fd = -1;
 	}
-
-	// Receive file volume
-	int file_size;
-	if (recv(socket_desc, &file_size, sizeof(file_size), 0) == -1)
+	if (fd == -1)
 	{
-		fprintf(stderr, "receive_file: error receiving file size of %s\n", filename);
-		fclose(fp);
-		return 1;
+		fprintf(stderr, "receive_file: error opening file %s\n", part_path);
+		return drain_transfer(socket_desc, file_size, encoding) == -1 ? 1 : -1;
 	}
-    file_size = ntohl(file_size);
 
-#ifdef DEBUG
-	fprintf(stdout, "DEBUG receive_file: file size of %d\n", file_size);
-#endif
+	uint64_t total_bytes_received;
+	int result = receive_transfer(fd, offset, file_size, socket_desc, &total_bytes_received, encoding, checksum);
+	int unread = result == -1; // The transfer stopped short of its end
 
-	// Use variables to keep track of file completion status
-	char buffer[BUFFER_SIZE];
-	int total_bytes_received = 0;
-    double column_volume = data_per_column(file_size);
-    double previous_progress = 0;
+	// Bytes that failed their checksum mustn't be resumed from
+	if (result == 3)
+		unlink(part_path);
 
-    // Newline to start progress bar
-    fprintf(stdout, "\n");
+    if (close(fd) != 0 && result == 0)
+        result = -1;
 
-    // While there is unreceived file volume
-    while (total_bytes_received < file_size)
-	{
-        // Attempt to buffer file
-		int bytes_received = recv(socket_desc, buffer, BUFFER_SIZE, 0);
-        if (bytes_received < 0)
-		{
-			fprintf(stderr, "\nreceive_file: error occurred receiving data\n");
-			fclose(fp);
-			return 1;
-		}
+    // Publish the completed download; a dropped one is kept for the next attempt
+    if (result == 0 && rename(part_path, filename) != 0)
+        result = -1;
 
-        // If the stream is interrupted
-		if (bytes_received == 0)
-		{
-			fprintf(stderr, "\nreceive_file: sender disconnected mid-stream\n");
-			fclose(fp);
-			return 1;
-		}
+    if (result == -1)
+    {
+		fprintf(stderr, "receive_file: error writing file %s\n", part_path);
+        if (unread && drain_transfer(socket_desc, file_size - total_bytes_received, encoding) == -1)
+            return 1;
+        return -1;
+    }
 
-		// Write the received data to file
-		fwrite(buffer, sizeof(char), bytes_received, fp);
+	return result;
+}
 
-        // Handle progress bar logic
-		total_bytes_received += bytes_received;
-        previous_progress += (double)bytes_received;
+// Function:    send_request
+// -------------------------
+// Sends a request header: everything the server needs to act in one frame
+//
+// socket_desc: file descriptor for destination socket
+// request: populated request_t
+//
+// returns 0 on success, -1 on failure
+int send_request(int socket_desc, const request_t *request)
+{
+    unsigned char payload[REQUEST_HEADER_MAX + TARGET_MAX];
+    size_t target_length = strlen(request->target);
+    size_t header_length = REQUEST_FIXED_SIZE;
+    uint16_t wire_flags = htons(request->flags);
+    uint64_t wire_size = hton64(request->size);
+    uint64_t wire_offset = hton64(request->offset);
 
-        print_progress_bar(&previous_progress, column_volume);
-	}
+    if (target_length == 0 || target_length >= TARGET_MAX)
+    {
+        fprintf(stderr, "messenger.send_request: invalid target length %zu\n", target_length);
+        return -1;
+    }
 
-    // Print last section of bar
-    fprintf(stdout, "\n");
+    payload[0] = RFS_PROTOCOL_VERSION;
+    payload[1] = request->op;
+    memcpy(payload + 2, &wire_flags, sizeof(wire_flags));
+    memcpy(payload + 4, &wire_size, sizeof(wire_size));
+    memcpy(payload + 12, &wire_offset, sizeof(wire_offset));
+    if (request->flags & REQUEST_UPLOAD)
+    {
+        uint64_t wire_id = hton64(request->upload_id);
+        memcpy(payload + header_length, &wire_id, sizeof(wire_id));
+        header_length += UPLOAD_ID_SIZE;
+    }
+    if (request->flags & REQUEST_HASH)
+    {
+        memcpy(payload + header_length, request->content_hash, CONTENT_HASH_SIZE);
+        header_length += CONTENT_HASH_SIZE;
+    }
+    if (request->flags & REQUEST_RESUME)
+    {
+        uint64_t wire_version = hton64(request->resume_version);
+        memcpy(payload + header_length, &wire_version, sizeof(wire_version));
+        header_length += VERSION_SIZE;
+    }
+    memcpy(payload + header_length, request->target, target_length);
 
-#ifdef DEBUG
-	fprintf(stdout, "DEBUG: client.send_file: file %s successfully sent to socket %d\n", filename, socket_desc);
-#endif
+    return send_frame(socket_desc, MSG_REQUEST, 0, payload, (uint32_t)(header_length + target_length));
+}
 
-	fclose(fp);
-	return 0;
+// Function:    decode_request
+// ---------------------------
+// Decodes and validates the payload of a MSG_REQUEST frame
+//
+// payload: frame payload
+// length: payload length in bytes
+// request: request_t to populate
+//
+// returns 0 on success, -1 on malformed request
+int decode_request(const char *payload, uint32_t length, request_t *request)
+{
+    uint16_t wire_flags;
+    uint64_t wire_size;
+    uint64_t wire_offset;
+    uint32_t header_length = REQUEST_FIXED_SIZE;
+
+    if (length < REQUEST_FIXED_SIZE)
+        return -1;
+
+    request->version = (uint8_t)payload[0];
+    request->op = (uint8_t)payload[1];
+    memcpy(&wire_flags, payload + 2, sizeof(wire_flags));
+    memcpy(&wire_size, payload + 4, sizeof(wire_size));
+    memcpy(&wire_offset, payload + 12, sizeof(wire_offset));
+    request->flags = ntohs(wire_flags);
+    request->size = ntoh64(wire_size);
+    request->offset = ntoh64(wire_offset);
+    request->upload_id = 0;
+    request->resume_version = 0;
+
+    if (request->version != RFS_PROTOCOL_VERSION)
+    {
+        fprintf(stderr, "messenger.decode_request: unsupported protocol version %u\n", request->version);
+        return -1;
+    }
+
+    if (request->flags & REQUEST_UPLOAD)
+    {
+        uint64_t wire_id;
+        if (length < REQUEST_FIXED_SIZE + UPLOAD_ID_SIZE)
+            return -1;
+        memcpy(&wire_id, payload + REQUEST_FIXED_SIZE, sizeof(wire_id));
+        request->upload_id = ntoh64(wire_id);
+        header_length += UPLOAD_ID_SIZE;
+    }
+
+    if (request->flags & REQUEST_HASH)
+    {
+        if (length < header_length + CONTENT_HASH_SIZE)
+            return -1;
+        memcpy(request->content_hash, payload + header_length, CONTENT_HASH_SIZE);
+        header_length += CONTENT_HASH_SIZE;
+    }
+
+    if (request->flags & REQUEST_RESUME)
+    {
+        uint64_t wire_version;
+        if (length < header_length + VERSION_SIZE)
+            return -1;
+        memcpy(&wire_version, payload + header_length, sizeof(wire_version));
+        request->resume_version = ntoh64(wire_version);
+        header_length += VERSION_SIZE;
+    }
+
+    if (length <= header_length || length - header_length >= TARGET_MAX)
+        return -1;
+    memcpy(request->target, payload + header_length, length - header_length);
+    request->target[length - header_length] = '\0';
+
+    // Reject targets containing embedded NULs
+    if (strlen(request->target) != length - header_length)
+        return -1;
+
+    return 0;
+}
+
+// Function:    receive_request
+// ----------------------------
+// Receives and validates a request header
+//
+// socket_desc: file descriptor for origin socket
+// request: request_t to populate
+//
+// returns 0 on success, -1 on failure or malformed request
+int receive_request(int socket_desc, request_t *request)
+{
+    frame_t frame;
+
+    if (receive_frame(socket_desc, &frame) == -1)
+        return -1;
+
+    if (frame.type != MSG_REQUEST || decode_request(frame.payload, frame.length, request) == -1)
+    {
+        fprintf(stderr, "messenger.receive_request: malformed request on socket %d\n", socket_desc);
+        free_frame(&frame);
+        return -1;
+    }
+
+    free_frame(&frame);
+    return 0;
+}
+
+// Function:    send_response
+// --------------------------
+// Sends the server's single verdict on a request
+//
+// socket_desc: file descriptor for destination socket
+// status: STATUS_* code
+// size: size of the data that follows (GET), 0 otherwise
+// message: optional human readable message, may be NULL
+//
+// returns 0 on success, -1 on failure
+int send_response(int socket_desc, int32_t status, uint64_t size, const char *message)
+{
+    return send_versioned_response(socket_desc, status, size, 0, 0, message);
+}
+
+// Function:    send_versioned_response
+// --------------------------------------
+// Sends a response that also reports the version of the file it concerns
+//
+// socket_desc: file descriptor for destination socket
+// status: STATUS_* code
+// size: size of the data that follows (GET), 0 otherwise
+// version: file_version of the file, 0 if none
+// flags: RESPONSE_* flags for the frame header
+// message: optional human readable message, may be NULL
+//
+// returns 0 on success, -1 on failure
+int send_versioned_response(int socket_desc, int32_t status, uint64_t size, uint64_t version, uint8_t flags,
+                            const char *message)
+{
+    unsigned char payload[RESPONSE_FIXED_SIZE + RESPONSE_MESSAGE_MAX];
+    size_t message_length = message ? strlen(message) : 0;
+    uint32_t wire_status = htonl((uint32_t)status);
+    uint64_t wire_size = hton64(size);
+    uint64_t wire_version = hton64(version);
+
+    if (message_length >= RESPONSE_MESSAGE_MAX)
+        message_length = RESPONSE_MESSAGE_MAX - 1;
+
+    memcpy(payload, &wire_status, sizeof(wire_status));
+    memcpy(payload + 4, &wire_size, sizeof(wire_size));
+    memcpy(payload + 12, &wire_version, sizeof(wire_version));
+    if (message_length)
+        memcpy(payload + RESPONSE_FIXED_SIZE, message, message_length);
+
+    return send_frame(socket_desc, MSG_RESPONSE, flags, payload, (uint32_t)(RESPONSE_FIXED_SIZE + message_length));
+}
+
+// Function:    receive_response
+// -----------------------------
+// Receives the server's verdict on a request
+//
+// socket_desc: file descriptor for origin socket
+// response: response_t to populate
+//
+// returns 0 on success, -1 on failure or malformed response
+int receive_response(int socket_desc, response_t *response)
+{
+    frame_t frame;
+    uint32_t wire_status;
+    uint64_t wire_size;
+    uint64_t wire_version;
+
+    if (receive_frame(socket_desc, &frame) == -1)
+        return -1;
+
+    if (frame.type != MSG_RESPONSE || frame.length < RESPONSE_FIXED_SIZE
+        || frame.length - RESPONSE_FIXED_SIZE >= RESPONSE_MESSAGE_MAX)
+    {
+        fprintf(stderr, "messenger.receive_response: malformed response on socket %d\n", socket_desc);
+        free_frame(&frame);
+        return -1;
+    }
+
+    memcpy(&wire_status, frame.payload, sizeof(wire_status));
+    memcpy(&wire_size, frame.payload + 4, sizeof(wire_size));
+    memcpy(&wire_version, frame.payload + 12, sizeof(wire_version));
+    response->status = (int32_t)ntohl(wire_status);
+    response->size = ntoh64(wire_size);
+    response->version = ntoh64(wire_version);
+    response->flags = frame.flags;
+    memcpy(response->message, frame.payload + RESPONSE_FIXED_SIZE, frame.length - RESPONSE_FIXED_SIZE);
+    response->message[frame.length - RESPONSE_FIXED_SIZE] = '\0';
+    free_frame(&frame);
+
+    return 0;
 }
 
 // Function:	send_msg
 // ---------------------
-// Sends a simple message over TCP
+// Sends a simple message over TCP as a MSG_TEXT frame
 //
 // msg: string containing message
 // socket_desc: file descriptor for destination socket
@@ -297,7 +1853,7 @@ int receive_file(char *filename, int socket_desc)
 // returns 1 on success, 0 on failure
 int send_msg(char *msg, int socket_desc)
 {
-	if (send(socket_desc, msg, BUFFER_SIZE, 0) < 0)
+	if (send_frame(socket_desc, MSG_TEXT, 0, msg, (uint32_t)strlen(msg)) < 0)
 		return 0;
 	else
 		return 1;
@@ -305,22 +1861,34 @@ int send_msg(char *msg, int socket_desc)
 
 // Function:	receive_msg
 // ------------------------
-// Receives a simple message over TCP and returns a dynamically allocated string
+// Receives a MSG_TEXT frame and returns it as a dynamically allocated string
 //
-// msg: string containing message
 // socket_desc: file descriptor for origin socket
 //
-// returns msg
+// returns msg on success, NULL on failure
 char* receive_msg(int socket_desc)
 {
-	char *msg = (char *)malloc(BUFFER_SIZE);
-	
-	if (recv(socket_desc, msg, BUFFER_SIZE, 0) < 0)
-        free(msg);
-	else
-        return msg;
+	frame_t frame;
+	char *msg;
+
+	if (receive_frame(socket_desc, &frame) == -1)
+		return NULL;
+
+	if (frame.type != MSG_TEXT)
+	{
+		fprintf(stderr, "messenger.receive_msg: expected text frame, got type %u\n", frame.type);
+		free_frame(&frame);
+		return NULL;
+	}
 
-    return NULL;
+	// Hand heap payloads straight to the caller, copy inline ones out
+	if (frame.payload != frame.inline_payload)
+		return frame.payload;
+
+	msg = (char *)malloc(frame.length + 1);
+	if (msg)
+		memcpy(msg, frame.payload, frame.length + 1);
+	return msg;
 }
 
 // Function:    server_init
@@ -342,6 +1910,10 @@ int server_init()
     }
     printf("Socket created successfully\n");
 
+    // Allow an immediate restart while old connections sit in TIME_WAIT
+    int reuse = 1;
+    setsockopt(socket_desc, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     // Set port and IP:
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(DEFAULT_PORT);
@@ -357,7 +1929,7 @@ int server_init()
     printf("Done with binding\n");
 
     // Listen for clients:
-    if(listen(socket_desc, 1) < 0){
+    if(listen(socket_desc, SOMAXCONN) < 0){
         printf("Error while listening\n");
         close(socket_desc);
         return -1;
@@ -8,6 +8,9 @@
  */
 #include "queue.h"
 
+// Nodes come from a pool rather than malloc, since every push and pop creates or frees one
+static slab_t node_slab = SLAB_INITIALIZER(node_t);
+
 // Function:	create_node
 // ------------------------
 // Creates a new free-floating node
@@ -17,12 +20,7 @@
 // returns: node_t* in a single-element circular queue
 node_t* create_node(void* data)
 {
-	node_t* new_node = (node_t *)malloc(sizeof(node_t));
-	if (new_node == NULL)
-	{
-		printf("Error allocating memory in queue.create_node()\n");
-		exit(1);
-	}
+	node_t* new_node = (node_t *)slab_alloc(&node_slab);
 	new_node->next = new_node;
 	new_node->prev = new_node;
 	new_node->data = data;
@@ -85,6 +83,7 @@ void push_queue(queue_t* queue, void* element)
 		new_node->next = back_node->next;
 		new_node->prev = back_node;
 		
+		back_node->next->prev = new_node; // Close the circle at the front
 		back_node->next = new_node;
 		queue->back = new_node;
 	}
@@ -111,7 +110,7 @@ void remove_node(queue_t* queue, node_t* node)
 	// Returns an empty queue
 	if (get_queue_size(queue) == 1)
 	{
-		SAFE_FREE(node);
+		slab_free(&node_slab, node);
 		queue->front = NULL;
 		queue->back = NULL;
 		queue->size = 0;
@@ -138,7 +137,7 @@ void remove_node(queue_t* queue, node_t* node)
 	{
 		queue->back = prev_node;
 	}
-    free(node);
+    slab_free(&node_slab, node);
 }
 
 // Function:	pop_queue
@@ -154,6 +153,16 @@ void* pop_queue(queue_t* queue)
     return data;
 }
 
+// Function:	get_node_stats
+// ---------------------------
+// Copies the pool counters for node_t allocations
+//
+// stats: destination for the counters
+void get_node_stats(slab_stats_t* stats)
+{
+	get_slab_stats(&node_slab, stats);
+}
+
 // Function:    destroy_queue
 // --------------------------
 // Destroys a queue
@@ -168,4 +177,89 @@ void destroy_queue(queue_t* queue)
     free(queue);
 }
 
+// Function:	create_mpsc_queue
+// ------------------------------
+// Creates an empty lock-free multi-producer single-consumer queue
+//
+// returns: mpsc_queue_t* holding only its stub node
+mpsc_queue_t* create_mpsc_queue(void)
+{
+	mpsc_queue_t* new_queue = (mpsc_queue_t *)malloc(sizeof(mpsc_queue_t));
+	if (new_queue == NULL)
+	{
+		printf("Error allocating memory in queue.create_mpsc_queue()\n");
+		exit(1);
+	}
+
+	node_t* stub = create_node(NULL);
+	stub->next = NULL;
+	new_queue->head = stub;
+	new_queue->tail = stub;
+
+	return new_queue;
+}
+
+// Function:	push_mpsc_queue
+// ----------------------------
+// Appends an element; safe to call from any number of threads at once
+//
+// queue: some mpsc_queue_t
+// element: some data element of anonymous type
+void push_mpsc_queue(mpsc_queue_t* queue, void* element)
+{
+	node_t* new_node = create_node(element);
+	new_node->next = NULL;
+
+	// Claim the tail, then publish the node to the consumer through the old tail
+	node_t* prev_node = __atomic_exchange_n(&queue->tail, new_node, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev_node->next, new_node, __ATOMIC_SEQ_CST);
+}
+
+// Function:	peek_mpsc_queue
+// ----------------------------
+// Returns the oldest element without removing it; consumer only
+//
+// queue: some mpsc_queue_t
+//
+// returns: oldest element, NULL if the queue is empty or a push is still linking
+void* peek_mpsc_queue(mpsc_queue_t* queue)
+{
+	node_t* next_node = __atomic_load_n(&queue->head->next, __ATOMIC_SEQ_CST);
+	return next_node ? next_node->data : NULL;
+}
 
+// Function:	pop_mpsc_queue
+// ---------------------------
+// Removes and returns the oldest element; consumer only
+//
+// queue: some mpsc_queue_t
+//
+// returns: oldest element, NULL if the queue is empty or a push is still linking
+void* pop_mpsc_queue(mpsc_queue_t* queue)
+{
+	node_t* stub = queue->head;
+	node_t* next_node = __atomic_load_n(&stub->next, __ATOMIC_ACQUIRE);
+	if (next_node == NULL)
+		return NULL;
+
+	// The popped node becomes the new stub
+	void* data = next_node->data;
+	next_node->data = NULL;
+	queue->head = next_node;
+	slab_free(&node_slab, stub);
+
+	return data;
+}
+
+// Function:    destroy_mpsc_queue
+// -------------------------------
+// Destroys an mpsc queue and frees any elements left in it; no pushes may be in flight
+void destroy_mpsc_queue(mpsc_queue_t* queue)
+{
+	void* data;
+	while ((data = pop_mpsc_queue(queue)) != NULL)
+		free(data);
+
+	slab_free(&node_slab, queue->head);
+	free(queue);
+}
@@ -10,125 +10,777 @@
  *   Custom implementation of server.c from provided template
  */
 
+#define _GNU_SOURCE // accept4(2)
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <inttypes.h>
 #include "messenger.h"
 #include "waitingroom.h"
+#include "cache.h"
+#include "delta.h"
+#include "store.h"
+#include "crc32c.h"
+#include "uploads.h"
 
-int socket_desc, client_sock;
+#define MAX_SESSIONS 4096          // Connections the acceptor will hold while they send headers
+#define SESSION_IDLE_TIMEOUT 30    // Default seconds a session may sit idle before it is closed
+#define TRANSFER_STALL_TIMEOUT 30  // Default seconds a worker waits on a stalled client before dropping it
+#define POLL_INTERVAL_MS 1000      // Granularity of the idle sweep
+#define MAX_EVENTS 64              // Events drained per epoll_wait
 
-// Function:    clean_up
-// ---------------------
-// Frees allocated memory for inbound requests
-//
-// cmd:         command issued
-// target:      target filename
-// client:      socket file descriptor
-void clean_up(char *cmd, char *target, int client)
-{
-    SAFE_FREE(cmd);
-    SAFE_FREE(target);
-    close(client);
-}
+// Type:        connection_t
+// -------------------------
+// A connection owned by the acceptor, either new or parked between session
+// requests, assembling its next request header without blocking
+typedef struct connection {
+    int socket_desc;
+    time_t last_active;
+    node_t *node;                       // Position in the connection list
+    uint32_t received;                  // Bytes of the current frame read so far
+    uint32_t length;                    // Payload length, once the frame header is in
+    unsigned char header[FRAME_HEADER_SIZE];
+    char payload[REQUEST_HEADER_MAX + TARGET_MAX];
+} connection_t;
+
+int socket_desc;
+
+queue_t *connections; // Connections owned by the acceptor loop
+int epoll_desc;
+int park_pipe[2]; // Workers hand keep-alive sockets back to the acceptor through this pipe
+int idle_timeout = SESSION_IDLE_TIMEOUT;
+int stall_timeout = TRANSFER_STALL_TIMEOUT;
+int worker_count = 0; // Waiting room pool size, 0 for one per core
+int handler_ttl_seconds = 0; // Idle file handler lifetime, 0 for the waiting room default
+int upload_ttl_seconds = 0; // Untouched upload file lifetime, 0 for UPLOAD_TTL
+
+// Markers distinguishing the listener and park pipe from connections in epoll events
+static int listener_marker, park_marker;
 
 // Function:    handle_error
 // -------------------------
-// Error message and cleanup for processes following handshake
+// Error message and reply for a failed request. The connection stays aligned,
+// so the caller may keep the session open.
 //
-// cmd:         command issued
-// target:      target filename
 // client:      socket file descriptor
 // msg:         error message
+// status:      STATUS_* code reported to the client
 // client_msg:  message sent to client
 //
-// returns -1 to indicate error state
-int handle_error(char *cmd, char *target, int client, char *msg, char *client_msg)
+// returns -1 to indicate error state, 1 if the reply couldn't be sent
+int handle_error(int client, char *msg, int32_t status, char *client_msg)
 {
     if (msg)
         fprintf(stderr, "%s\n", msg);
-    if (client_msg)
-        send_msg(client_msg, client);
-
-    clean_up(cmd, target, client);
+    if (send_response(client, status, 0, client_msg) == -1)
+        return 1;
     return -1;
 }
 
+// Function:    handle_lost
+// ------------------------
+// Error message for a request that left the connection unusable
+//
+// msg:         error message
+//
+// returns 1 to indicate the connection must be closed
+int handle_lost(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    return 1;
+}
+
+// Helper Function:    log_progress
+// --------------------------------
+// Progress callback installed by -p, logging how far each transfer has got
+// and its rate
+void log_progress(transfer_progress_t *progress, void *context)
+{
+    (void)context;
+    if (progress->bytes == 0 && !progress->done) // Nothing to say about a transfer just started
+        return;
+    fprintf(stdout, "\nserver: transfer %s, %" PRIu64 " of %" PRIu64 " bytes, %.2f s, %.1f MB/s\n",
+            progress->done ? "done" : "running", progress->bytes, progress->total, progress->elapsed,
+            progress->rate / 1e6);
+}
+
+// Helper Function:    request_encoding
+// ------------------------------------
+// TRANSFER_* flags of the data following a WRITE header
+int request_encoding(request_t *request)
+{
+    return ((request->flags & REQUEST_COMPRESS) ? TRANSFER_COMPRESSED : 0) |
+           ((request->flags & REQUEST_CHECKSUM) ? TRANSFER_CHECKSUM : 0);
+}
+
+// Helper Function:    receive_upload
+// ----------------------------------
+// Receives the next stretch of a resumable upload into its upload file,
+// which is renamed over the target once the last byte lands and kept for a
+// later resume if the connection drops. The upload is registered as being
+// written before its size is taken, so the reaper can't remove the file
+// from under it.
+//
+// client_socket:   socket fd
+// request:         decoded WRITE header with REQUEST_UPLOAD
+// incoming:        bytes following the header
+//
+// returns 0 on success, -1 on file errors, 1 for connection errors,
+// 2 if the offset is ahead of what the server holds (the data is drained),
+// 3 if the data failed its checksum
+int receive_upload(int client_socket, request_t *request, uint64_t incoming)
+{
+    char path[TARGET_MAX + 32];
+    struct stat info;
+    int encoding = request_encoding(request);
+
+    if (upload_path(request->target, request->upload_id, path, sizeof(path)) == -1 || upload_begin(path) == -1)
+        return drain_transfer(client_socket, incoming, encoding) == -1 ? 1 : -1;
+
+    // Only bytes the server actually holds can be built on
+    int result;
+    uint64_t committed = stat(path, &info) == 0 ? (uint64_t)info.st_size : 0;
+    if (request->offset > committed)
+        result = drain_transfer(client_socket, incoming, encoding) == -1 ? 1 : 2;
+    else
+        result = receive_partial(request->target, path, request->offset, incoming, client_socket, encoding);
+
+    upload_end(path, 0, 0, 0);
+    if (result == 0) // Published, nothing left to track
+        upload_forget(path);
+    return result;
+}
+
+// Helper Function:    receive_stripe
+// ----------------------------------
+// Stores one range of a striped upload in its upload file, where COMMIT will
+// find it once every range has arrived. The range is recorded only if all of
+// it was stored intact.
+//
+// client_socket:   socket fd
+// request:         decoded WRITE header with REQUEST_STRIPE
+//
+// returns 0 on success, -1 on file errors, 1 for connection errors,
+// 3 if the data failed its checksum
+int receive_stripe(int client_socket, request_t *request)
+{
+    char path[TARGET_MAX + 32];
+    int encoding = request_encoding(request);
+
+    if (upload_path(request->target, request->upload_id, path, sizeof(path)) == -1 || upload_begin(path) == -1)
+        return drain_transfer(client_socket, request->size, encoding) == -1 ? 1 : -1;
+
+    int result = receive_range(path, request->offset, request->size, client_socket, encoding);
+    upload_end(path, request->offset, request->size, result == 0);
+    return result;
+}
+
+// Set by a handler whose request replaced its target, for handle_inbound to
+// file the new contents once the client has its answer
+static __thread int ingest_pending;
+
+// Helper Function:    defer_ingest
+// --------------------------------
+// Marks the target of the running request as freshly written, so it is filed
+// in the content store, when the server keeps one, after the reply has gone
+// out. Hashing a large file takes far longer than receiving it, so it must
+// not hold up the client.
+void defer_ingest(void)
+{
+    ingest_pending = content_store.enabled;
+}
+
+// Helper Function:    ingest_file
+// -------------------------------
+// Files a freshly written target in the content store, so identical uploads
+// share their bytes. Runs on the worker that wrote it, which still holds the
+// file against other writers as store_ingest requires.
+//
+// target:          file just written
+void ingest_file(const char *target)
+{
+    if (store_ingest(target) == 1)
+        fprintf(stdout, "\nserver: %s matches stored content, deduplicated\n", target);
+}
+
 // Function:    handle_write
 // -------------------------
-// Server process handling write request
+// Server process handling write request. The file data follows the request
+// header directly, so the only reply is the final verdict. Requests carrying
+// an upload ID send only the bytes from offset onwards and are kept across
+// dropped connections until complete; stripes of a parallel upload are only
+// stored, and published later by COMMIT. Plain and resumable WRITEs may
+// arrive as a compressed stream (REQUEST_COMPRESS). Data followed by a
+// CRC32C (REQUEST_CHECKSUM) that doesn't match it is never published.
 //
 // client_socket:   socket fd
-// target:          target filename
+// request:         decoded request header
 //
 // returns 0 on success, 1 on lost connection, -1 for file saving errors
-int handle_write(int client_socket, char *target)
+int handle_write(int client_socket, request_t *request)
 {
-    int received = receive_file(target, client_socket);
+    uint64_t incoming = request->size;
+    int encoding = request_encoding(request);
+    if ((request->flags & REQUEST_UPLOAD) && !(request->flags & REQUEST_STRIPE))
+    {
+        // Without a sane offset there's no telling how much data follows
+        if (request->offset > request->size)
+            return handle_lost("\nserver.handle_write: upload offset past the end of the file\n");
+        incoming = request->size - request->offset;
+    }
+
+    // Refuse early if the destination directory is missing, draining the upload
+    if (!check_directory(request->target))
+    {
+        if (drain_transfer(client_socket, incoming, encoding) == -1)
+            return handle_lost("\nserver.handle_write: lost connection during WRITE\n");
+        return handle_error(client_socket,
+                            "\nserver.handle_write: invalid destination directory for WRITE\n",
+                            STATUS_BAD_PATH, "Destination directory does not exist");
+    }
+
+    // A stripe is meaningless without the upload it belongs to, and is always sent raw
+    if ((request->flags & REQUEST_STRIPE) && (!(request->flags & REQUEST_UPLOAD) || (encoding & TRANSFER_COMPRESSED)))
+    {
+        if (drain_transfer(client_socket, incoming, encoding) == -1)
+            return handle_lost("\nserver.handle_write: lost connection during WRITE\n");
+        return handle_error(client_socket, NULL, STATUS_BAD_REQUEST, "Stripe must be an uncompressed upload");
+    }
+
+    int received = (request->flags & REQUEST_STRIPE) ? receive_stripe(client_socket, request)
+                 : (request->flags & REQUEST_UPLOAD) ? receive_upload(client_socket, request, incoming)
+                 : receive_file(request->target, request->size, client_socket, encoding);
     switch (received) {
-        case 0:
+        case 0: // The new version is in place, stop serving the old one
+            if (!(request->flags & REQUEST_STRIPE))
+            {
+                cache_invalidate(request->target);
+                defer_ingest();
+            }
             break;
         case 1:
-            return handle_error(NULL, target, client_socket,
-                                "\nserver.handle_write: lost connection during WRITE\n",
-                                "File write failed");
+            return handle_lost("\nserver.handle_write: lost connection during WRITE\n");
+        case 2:
+            return handle_error(client_socket, NULL,
+                                STATUS_BAD_RANGE, "Upload offset is past the committed bytes");
+        case 3:
+            return handle_error(client_socket,
+                                "\nserver.handle_write: WRITE data failed its checksum\n",
+                                STATUS_CORRUPT, "Data failed its checksum");
         case -1:
-            return handle_error(NULL, NULL, client_socket,
+            return handle_error(client_socket,
                                 "\nserver.handle_write: error saving file during WRITE\n",
-                                "File write failed");
+                                STATUS_IO_ERROR, "File write failed");
         default:
-            return handle_error(NULL, target, client_socket,
+            return handle_error(client_socket,
                                 "\nserver.handle_write: undefined error during WRITE\n",
-                                "File write failed");
+                                STATUS_IO_ERROR, "File write failed");
+    }
+
+    // Report the outcome to the client; a stripe is acknowledged with the bytes it stored
+    uint64_t stored = (request->flags & REQUEST_STRIPE) ? request->size : 0;
+    if (send_response(client_socket, STATUS_OK, stored, "File written successfully") == -1)
+        return handle_lost("server.handle_write: file transfer success message aborted\n");
+    return 0;
+}
+
+// Function:    handle_status
+// --------------------------
+// Server process reporting how many bytes of a resumable upload it holds, so
+// the client knows where to continue from, or without an upload ID the size
+// and version of the target, so a striped GET can split it up
+//
+// client_socket:   socket fd
+// request:         decoded request header
+//
+// returns 0 on success, -1 if the target or upload can't be found, 1 on lost connection
+int handle_status(int client_socket, request_t *request)
+{
+    char path[TARGET_MAX + 32];
+    struct stat info;
+
+    if (!(request->flags & REQUEST_UPLOAD))
+    {
+        if (stat(request->target, &info) == -1 || !S_ISREG(info.st_mode))
+            return handle_error(client_socket, NULL, STATUS_NOT_FOUND, "File not found");
+        if (send_versioned_response(client_socket, STATUS_OK, (uint64_t)info.st_size,
+                                    file_version(&info), 0, NULL) == -1)
+            return handle_lost("\nserver.handle_status: lost connection during STATUS\n");
+        return 0;
     }
 
-    // Get update from client
-    if (!send_msg("File written successfully", client_socket)) {
-        return handle_error(NULL, target, client_socket,
-                            "server.handle_inbound: file transfer success message aborted\n",
-                            NULL);
+    if (upload_path(request->target, request->upload_id, path, sizeof(path)) == -1)
+        return handle_error(client_socket, NULL, STATUS_BAD_PATH, "Target name too long for an upload");
+
+    uint64_t committed = stat(path, &info) == 0 ? (uint64_t)info.st_size : 0;
+    if (send_response(client_socket, STATUS_OK, committed, NULL) == -1)
+        return handle_lost("\nserver.handle_status: lost connection during STATUS\n");
+    return 0;
+}
+
+// Function:    handle_commit
+// --------------------------
+// Server process publishing a striped upload once the client has had every
+// stripe acknowledged. The stripes ran side by side as shared requests on
+// the file; this is the one step that replaces it. The upload is published
+// only if the ranges stored intact cover the whole file, so a stripe that
+// never arrived can't turn into a run of zeros.
+//
+// client_socket:   socket fd
+// request:         decoded request header with REQUEST_UPLOAD, size of the whole file
+//
+// returns 0 on success, -1 if the upload is missing or incomplete, 1 on lost connection
+int handle_commit(int client_socket, request_t *request)
+{
+    char path[TARGET_MAX + 32];
+    struct stat info;
+
+    if (!(request->flags & REQUEST_UPLOAD) ||
+        upload_path(request->target, request->upload_id, path, sizeof(path)) == -1)
+        return handle_error(client_socket, NULL, STATUS_BAD_REQUEST, "COMMIT needs an upload ID");
+
+    if (stat(path, &info) == -1)
+        return handle_error(client_socket, NULL, STATUS_NOT_FOUND, "Upload not found");
+    if ((uint64_t)info.st_size != request->size || upload_claim(path, request->size) == -1)
+        return handle_error(client_socket, NULL, STATUS_BAD_RANGE, "Upload is incomplete");
+
+    // The upload is no longer tracked, so one that can't be published is thrown away
+    if (rename(path, request->target) != 0)
+    {
+        unlink(path);
+        return handle_error(client_socket,
+                            "\nserver.handle_commit: error publishing upload during COMMIT\n",
+                            STATUS_IO_ERROR, "File write failed");
     }
+    cache_invalidate(request->target);
+    defer_ingest();
+
+    if (send_response(client_socket, STATUS_OK, 0, "File written successfully") == -1)
+        return handle_lost("\nserver.handle_commit: lost connection during COMMIT\n");
     return 0;
 }
 
-// Function:    handle_get
-// -----------------------
-// Server process handling get request
+// Function:    handle_signature
+// -----------------------------
+// Server process sending the block signature of a file, the first half of a
+// delta WRITE. The response carries the file's version, which the delta must
+// quote back.
 //
 // client_socket:   socket fd
-// target:          target filename
+// request:         decoded request header
 //
-// returns 0 on success, 1 on lost connection, -1 for file saving errors
-int handle_get(int client_socket, char *target)
+// returns 0 on success, -1 if the file can't be found, 1 on lost connection
+int handle_signature(int client_socket, request_t *request)
 {
-    int sent = send_file(target, client_socket);
-    switch (sent) // Error handling
+    uint64_t file_size;
+    struct stat info;
+    int fd = open_file(request->target, &file_size);
+    if (fd == -1)
+        return handle_error(client_socket, NULL, STATUS_NOT_FOUND, "File not found");
+    uint64_t version = fstat(fd, &info) == 0 ? file_version(&info) : 0;
+
+    if (send_versioned_response(client_socket, STATUS_OK, signature_size(file_size), version, 0, NULL) == -1)
+    {
+        close(fd);
+        return handle_lost("\nserver.handle_signature: lost connection during SIGNATURE\n");
+    }
+
+    int sent = send_signature(fd, file_size, client_socket);
+    close(fd);
+    if (sent != 0) // The size is already on the wire, so the stream can't be resynchronised
+        return handle_lost("\nserver.handle_signature: error sending signature\n");
+    return 0;
+}
+
+// Function:    handle_delta
+// -------------------------
+// Server process rebuilding a file from its current version and the delta
+// the client made against its signature. The result is staged beside the
+// target and renamed over it only once its size and digest check out.
+//
+// client_socket:   socket fd
+// request:         decoded request header, size bytes of delta follow
+//
+// returns 0 on success, -1 if the delta couldn't be applied, 1 on lost connection
+int handle_delta(int client_socket, request_t *request)
+{
+    uint64_t file_size;
+    struct stat info;
+    int fd = open_file(request->target, &file_size);
+    if (fd == -1)
+    {
+        if (drain_stream(client_socket, request->size) == -1)
+            return handle_lost("\nserver.handle_delta: lost connection during DELTA\n");
+        return handle_error(client_socket, NULL, STATUS_NOT_FOUND, "File not found");
+    }
+    uint64_t version = fstat(fd, &info) == 0 ? file_version(&info) : 0;
+
+    char staging_path[TARGET_MAX + 16];
+    int staging = open_staging_file(request->target, staging_path, sizeof(staging_path));
+    if (staging == -1)
+    {
+        close(fd);
+        if (drain_stream(client_socket, request->size) == -1)
+            return handle_lost("\nserver.handle_delta: lost connection during DELTA\n");
+        return handle_error(client_socket,
+                            "\nserver.handle_delta: error staging file during DELTA\n",
+                            STATUS_IO_ERROR, "File write failed");
+    }
+
+    uint64_t consumed;
+    int applied = apply_delta(fd, file_size, version, staging, client_socket, request->size, &consumed);
+    close(fd);
+    if (close(staging) != 0 && applied == 0)
+        applied = -1;
+    if (applied == 0 && rename(staging_path, request->target) != 0)
+        applied = -1;
+    if (applied != 0)
+        unlink(staging_path);
+
+    // Keep the stream aligned whenever the delta was abandoned part way
+    if ((applied == -1 || applied == 2) && drain_stream(client_socket, request->size - consumed) == -1)
+        applied = 1;
+
+    switch (applied)
     {
         case 0:
+            cache_invalidate(request->target);
+            defer_ingest();
             break;
         case 1:
-            return handle_error(NULL, target, client_socket,
-                         "\nserver.handle_inbound: lost connection during GET\n",
-                        NULL);
-        case -1:
-            return handle_error(NULL, target, client_socket,
-                                "\nserver.handle_inbound: error opening file during GET\n",
-                                NULL);
+            return handle_lost("\nserver.handle_delta: lost connection during DELTA\n");
+        case 2:
+            return handle_error(client_socket, NULL, STATUS_CHANGED, "File changed since its signature was taken");
         default:
-            return handle_error(NULL, target, client_socket,
-                                "\nserver.handle_inbound: undefined error during GET\n",
-                                NULL);
+            return handle_error(client_socket,
+                                "\nserver.handle_delta: error applying delta during DELTA\n",
+                                STATUS_IO_ERROR, "Delta could not be applied");
     }
 
-    // Confirm receipt with client
-    char *response = receive_msg(client_socket);
-    if (!response) {
-        return handle_error(NULL, target, client_socket,
-                            "\nserver.handle_inbound: error getting server response about target %s\n",
-                            NULL);
+    fprintf(stdout, "\nserver: %s rebuilt from a %" PRIu64 " byte delta\n", request->target, request->size);
+    if (send_response(client_socket, STATUS_OK, 0, "File written successfully") == -1)
+        return handle_lost("\nserver.handle_delta: lost connection during DELTA\n");
+    return 0;
+}
+
+// Function:    handle_link
+// ------------------------
+// Server process storing a file from content it already holds, named by the
+// hash the client announced, so no file data crosses the network. Without a
+// content store, or without the content, the client is told to WRITE it.
+//
+// client_socket:   socket fd
+// request:         decoded request header with REQUEST_HASH, size of the file
+//
+// returns 0 on success, -1 if the content isn't held, 1 on lost connection
+int handle_link(int client_socket, request_t *request)
+{
+    if (!(request->flags & REQUEST_HASH))
+        return handle_error(client_socket, NULL, STATUS_BAD_REQUEST, "LINK needs a content hash");
+    if (!check_directory(request->target))
+        return handle_error(client_socket,
+                            "\nserver.handle_link: invalid destination directory for LINK\n",
+                            STATUS_BAD_PATH, "Destination directory does not exist");
+
+    switch (store_link(request->content_hash, request->size, request->target))
+    {
+        case 0:
+            cache_invalidate(request->target);
+            break;
+        case 1:
+            return handle_error(client_socket, NULL, STATUS_NOT_FOUND, "Content not held");
+        default:
+            return handle_error(client_socket,
+                                "\nserver.handle_link: error linking stored content during LINK\n",
+                                STATUS_IO_ERROR, "File write failed");
     }
 
-    // Print message from client
-    fprintf(stdout, "\nclient: %s\n", response);
+    fprintf(stdout, "\nserver: %s stored from held content, %" PRIu64 " bytes not transferred\n",
+            request->target, request->size);
+    if (send_response(client_socket, STATUS_OK, 0, "File written successfully") == -1)
+        return handle_lost("\nserver.handle_link: lost connection during LINK\n");
+    return 0;
+}
+
+// Helper Function:    load_file
+// -----------------------------
+// Reads a whole file into memory for the content cache
+//
+// fd:              open file
+// file_size:       bytes to read
+//
+// returns malloc'd contents, NULL if the file couldn't be read in full
+char *load_file(int fd, uint64_t file_size)
+{
+    char *data = malloc(file_size);
+    if (!data)
+        return NULL;
+
+    uint64_t loaded = 0;
+    while (loaded < file_size)
+    {
+        ssize_t bytes_read = pread(fd, data + loaded, file_size - loaded, (off_t)loaded);
+        if (bytes_read < 0 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0) // File shrank or became unreadable
+        {
+            SAFE_FREE(data);
+            return NULL;
+        }
+        loaded += bytes_read;
+    }
+    return data;
+}
+
+// Helper Function:    resolve_range
+// ---------------------------------
+// Works out which bytes of a file a GET asked for. A zero size means through
+// the end of the file, and ranges running past the end are clipped to it.
+//
+// request:         decoded request header
+// file_size:       current size of the file
+// length:          receives the number of bytes to send from request->offset
+//
+// returns 0 on success, -1 if the offset lies past the end of the file
+int resolve_range(request_t *request, uint64_t file_size, uint64_t *length)
+{
+    if (request->offset > file_size)
+        return -1;
+
+    uint64_t available = file_size - request->offset;
+    *length = (request->size == 0 || request->size > available) ? available : request->size;
+    return 0;
+}
+
+// Helper Function:    start_checksum
+// ----------------------------------
+// Starts the CRC32C a checksummed GET ends with. That of a resumed GET
+// (REQUEST_RESUME) covers the file from its first byte, so the client can
+// check the bytes it kept from before as well as the ones sent now.
+//
+// request:     decoded request header
+// fd/data:     open file, or its contents in memory when data isn't NULL
+// checksum:    receives the CRC32C of the bytes ahead of the range it covers
+//
+// returns 0 on success, -1 if the file can't be read
+int start_checksum(request_t *request, int fd, const char *data, uint32_t *checksum)
+{
+    *checksum = 0;
+    if (!(request->flags & REQUEST_RESUME))
+        return 0;
+    if (data)
+    {
+        *checksum = crc32c(0, data, request->offset);
+        return 0;
+    }
+    return checksum_file(fd, 0, request->offset, checksum);
+}
+
+// Helper Function:    send_compressed_reply
+// -----------------------------------------
+// Answers a GET with a compressed stream, for a client that asked for one and
+// data that shrinks, checksumming the raw bytes on the way if asked to
+//
+// client_socket:   socket fd
+// request:         decoded request header
+// fd/data:         open file, or its contents in memory when data isn't NULL
+// length:          bytes of the range to send
+// version:         file_version of the contents
+//
+// returns 0 on success, 1 on lost connection
+int send_compressed_reply(int client_socket, request_t *request, int fd, const char *data,
+                          uint64_t length, uint64_t version)
+{
+    uint64_t wire_bytes;
+    uint32_t checksum;
+    uint32_t *running = (request->flags & REQUEST_CHECKSUM) ? &checksum : NULL;
+    uint8_t flags = RESPONSE_COMPRESSED | (running ? RESPONSE_CHECKSUM : 0);
+    if (running && start_checksum(request, fd, data, running) == -1)
+        return handle_error(client_socket, "\nserver.handle_get: error reading file during GET\n",
+                            STATUS_IO_ERROR, "File read failed");
+
+    if (send_versioned_response(client_socket, STATUS_OK, length, version, flags, NULL) == -1 ||
+        send_compressed(fd, data, request->offset, length, client_socket, &wire_bytes, running) != 0 ||
+        (running && send_checksum(client_socket, checksum) == -1))
+        return handle_lost("\nserver.handle_get: lost connection during GET\n");
+
+    fprintf(stdout, "\nserver: %s sent, %" PRIu64 " bytes compressed to %" PRIu64 "\n",
+            request->target, length, wire_bytes);
+    return 0;
+}
+
+// Helper Function:    send_contents
+// ---------------------------------
+// Answers a GET from file contents already in memory, followed by their
+// CRC32C if asked for. The whole file's CRC32C is known already; only that
+// of a range is computed (from the first byte for a resumed GET).
+//
+// client_socket:   socket fd
+// request:         decoded request header
+// data/size:       whole file contents
+// version:         file_version of the contents
+// whole_checksum:  CRC32C of the whole contents
+//
+// returns 0 on success, -1 for a bad range, 1 on lost connection
+int send_contents(int client_socket, request_t *request, const char *data, uint64_t size, uint64_t version,
+                  uint32_t whole_checksum)
+{
+    uint64_t length;
+    if (resolve_range(request, size, &length) == -1)
+        return handle_error(client_socket, NULL, STATUS_BAD_RANGE, "Offset is past the end of the file");
+
+    if ((request->flags & REQUEST_COMPRESS) && should_compress(request->target, -1, data, request->offset, length))
+        return send_compressed_reply(client_socket, request, -1, data, length, version);
+
+    int checksummed = (request->flags & REQUEST_CHECKSUM) != 0;
+    int from_start = request->offset == 0 || (request->flags & REQUEST_RESUME);
+    uint32_t checksum = whole_checksum;
+    if (checksummed && !(from_start && request->offset + length == size))
+    {
+        start_checksum(request, -1, data, &checksum);
+        checksum = crc32c(checksum, data + request->offset, length);
+    }
+    if (send_versioned_response(client_socket, STATUS_OK, length, version,
+                                checksummed ? RESPONSE_CHECKSUM : 0, NULL) == -1 ||
+        send_all(client_socket, data + request->offset, length) == -1 ||
+        (checksummed && send_checksum(client_socket, checksum) == -1))
+        return handle_lost("\nserver.handle_get: lost connection during GET\n");
+
+    fprintf(stdout, "\nserver: %s sent\n", request->target);
+    return 0;
+}
+
+// Helper Function:    resume_changed
+// ----------------------------------
+// Checks whether the file a resumed GET continues has been replaced since
+// the download started, so the bytes the client holds belong to another
+// version
+//
+// returns 1 if it has, 0 otherwise or for a GET that isn't resumed
+int resume_changed(request_t *request, uint64_t version)
+{
+    return (request->flags & REQUEST_RESUME) && version != request->resume_version;
+}
+
+// Function:    handle_get
+// -----------------------
+// Server process handling get request. The response carries the size of the
+// requested range and its contents follow immediately. Small files are served
+// from the content cache when present, and read into it on a miss. With
+// REQUEST_CHECKSUM the contents are followed by their CRC32C; a whole file
+// whose checksum is remembered still goes out with sendfile, anything else
+// is checksummed as it is sent. A resumed GET (REQUEST_RESUME) is
+// checksummed from the file's first byte, and one of a file replaced since
+// the download began is answered CHANGED.
+//
+// client_socket:   socket fd
+// request:         decoded request header, offset/size select the range
+//
+// returns 0 on success, 1 on lost connection, -1 for file reading errors
+int handle_get(int client_socket, request_t *request)
+{
+    // Hot files come straight from memory, as long as the file on disk is still the cached version
+    struct stat info;
+    uint64_t current = content_cache.capacity && stat(request->target, &info) == 0 ? file_version(&info) : 0;
+    cache_entry_t *entry = cache_lookup(request->target, current);
+    if (entry)
+    {
+        int result = resume_changed(request, entry->version)
+                   ? handle_error(client_socket, NULL, STATUS_CHANGED, "File changed since the download started")
+                   : send_contents(client_socket, request, entry->data, entry->size, entry->version,
+                                   entry->checksum);
+        cache_release(entry);
+        return result;
+    }
+
+    // Note the invalidation epoch before reading, so a racing WRITE isn't cached over
+    uint64_t epoch = cache_epoch(request->target);
+    uint64_t file_size;
+    int fd = open_file(request->target, &file_size);
+    if (fd == -1)
+        return handle_error(client_socket,
+                            "\nserver.handle_get: error opening file during GET\n",
+                            STATUS_NOT_FOUND, "File not found");
+    uint64_t version = fstat(fd, &info) == 0 ? file_version(&info) : 0;
+    if (resume_changed(request, version))
+    {
+        close(fd);
+        return handle_error(client_socket, NULL, STATUS_CHANGED, "File changed since the download started");
+    }
+
+    if (cache_admits(file_size))
+    {
+        char *data = load_file(fd, file_size);
+        if (data)
+        {
+            close(fd);
+            // Checksummed once as it enters the cache, then served with every hit
+            uint32_t checksum = crc32c(0, data, file_size);
+            int result = send_contents(client_socket, request, data, file_size, version, checksum);
+            cache_insert(request->target, data, file_size, version, checksum, epoch);
+            return result;
+        }
+    }
+
+    uint64_t length;
+    if (resolve_range(request, file_size, &length) == -1)
+    {
+        close(fd);
+        return handle_error(client_socket, NULL, STATUS_BAD_RANGE, "Offset is past the end of the file");
+    }
+
+    if ((request->flags & REQUEST_COMPRESS) && should_compress(request->target, fd, NULL, request->offset, length))
+    {
+        int result = send_compressed_reply(client_socket, request, fd, NULL, length, version);
+        close(fd);
+        return result;
+    }
+
+    // Whole files have their checksum remembered by version; a resumed GET to the end is checksummed whole
+    int checksummed = (request->flags & REQUEST_CHECKSUM) != 0;
+    int from_start = request->offset == 0 || (request->flags & REQUEST_RESUME);
+    int whole = checksummed && version != 0 && from_start && request->offset + length == file_size;
+    uint32_t checksum;
+    int known = whole && checksum_lookup(version, file_size, &checksum);
+    if (checksummed && !known && start_checksum(request, fd, NULL, &checksum) == -1)
+    {
+        close(fd);
+        return handle_error(client_socket, "\nserver.handle_get: error reading file during GET\n",
+                            STATUS_IO_ERROR, "File read failed");
+    }
+
+    if (send_versioned_response(client_socket, STATUS_OK, length, version,
+                                checksummed ? RESPONSE_CHECKSUM : 0, NULL) == -1)
+    {
+        close(fd);
+        return handle_lost("\nserver.handle_get: lost connection during GET\n");
+    }
+
+    int sent = send_file_range(fd, request->offset, length, client_socket,
+                               checksummed && !known ? &checksum : NULL);
+    close(fd);
+    if (sent == 0 && checksummed)
+    {
+        if (whole && !known)
+            checksum_insert(version, file_size, checksum);
+        if (send_checksum(client_socket, checksum) == -1)
+            sent = 1;
+    }
+    switch (sent) // Error handling
+    {
+        case 0:
+            break;
+        case 1:
+            return handle_lost("\nserver.handle_get: lost connection during GET\n");
+        default: // The size is already on the wire, so the stream can't be resynchronised
+            return handle_lost("\nserver.handle_get: error reading file during GET\n");
+    }
+
+    fprintf(stdout, "\nserver: %s sent\n", request->target);
     return 0;
 }
 
@@ -137,92 +789,409 @@ int handle_get(int client_socket, char *target)
 // Server process to handle removal command
 //
 // client_socket:   socket fd
-// target:          target filename
+// request:         decoded request header
 //
-// returns 0 on success, 1 on lost connection, -1 for file saving errors
-int handle_rm(int client_socket, char *target)
+// returns 0 on success, -1 if the target could not be deleted, 1 on lost connection
+int handle_rm(int client_socket, request_t *request)
 {
-    if (!unlink(target)) // Attempt delete
+    if (!unlink(request->target)) // Attempt delete
     { // Upon success
-        fprintf(stdout, "\nserver: %s deleted\n", target);
-
-        send_msg("target deleted successfully\n", client_socket); // Notify client
+        cache_invalidate(request->target);
+        fprintf(stdout, "\nserver: %s deleted\n", request->target);
 
-        clean_up(NULL, target, client_socket);
+        // Notify client
+        if (send_response(client_socket, STATUS_OK, 0, "target deleted successfully") == -1)
+            return handle_lost("\nserver.handle_rm: lost connection during RM\n");
         return 0;
     } else // Failure
     {
-        return handle_error(NULL, target, client_socket,
-                            "\nserver: %s could not be deleted\n",
-                            "target could not be deleted\n");
+        fprintf(stderr, "\nserver: %s could not be deleted\n", request->target);
+        return handle_error(client_socket, NULL,
+                            STATUS_NOT_FOUND, "target could not be deleted");
     }
 }
 
+// Function:    park_session
+// -------------------------
+// Hands a keep-alive connection back to the acceptor loop so its next request
+// header can be read. Called from worker threads.
+//
+// client_socket:   socket fd
+void park_session(int client_socket)
+{
+    ssize_t written;
+    do {
+        written = write(park_pipe[1], &client_socket, sizeof(client_socket));
+    } while (written == -1 && errno == EINTR);
+
+    if (written != sizeof(client_socket))
+    {
+        fprintf(stderr, "server.park_session: unable to park socket %d\n", client_socket);
+        close(client_socket);
+    }
+}
 
 // Function:    handle_inbound
 // ---------------------------
-// Handles commands from a client, parsing command and target identity to perform some operation
+// Handles a decoded request header, dispatching on its operation, then either
+// closes the connection or parks it for the session's next request. Only then
+// is a file the request wrote filed in the content store.
 //
 // Commands:
-// GET: fetches a file from the server and transfers it to client
+// WRITE: stores the file streamed after the header
+// GET: fetches a file, or a range of it, from the server and transfers it to client
+// RM: deletes a file from the server
+// STATUS: reports the committed bytes of a resumable upload, or a file's size
+// COMMIT: publishes a striped upload
+// SIGNATURE: sends a file's block signature for a delta WRITE
+// DELTA: rebuilds a file from its previous version and a delta
+// LINK: stores a file from content the server already holds
 //
-int handle_inbound(int client_socket)
+// client_socket:   socket fd
+// context:         request_t read by the acceptor, freed here
+int handle_inbound(int client_socket, void *context)
 {
-    char *target; // target file
-    int result = -1; // status flag
+    request_t *request = (request_t *)context;
+    int result;
+    ingest_pending = 0;
 
-    // Receive command
-    char *cmd = receive_msg(client_socket);
-    if(!cmd)
+#ifdef DEBUG
+    fprintf(stdout, "\nDEBUG server.handle_inbound: OP = %u, TARGET = %s\n", request->op, request->target);
+#endif
+
+    // Behavior controlled by op
+    switch (request->op)
     {
-        fprintf(stderr, "\nserver.handle_inbound: error receiving command from client\n");
+        case OP_WRITE: // Write request
+            result = handle_write(client_socket, request);
+            break;
+        case OP_GET: // Get request
+            result = handle_get(client_socket, request);
+            break;
+        case OP_RM: // File delete request
+            result = handle_rm(client_socket, request);
+            break;
+        case OP_STATUS: // Resumable upload progress or file size
+            result = handle_status(client_socket, request);
+            break;
+        case OP_COMMIT: // Striped upload complete
+            result = handle_commit(client_socket, request);
+            break;
+        case OP_SIGNATURE: // Block signature for a delta WRITE
+            result = handle_signature(client_socket, request);
+            break;
+        case OP_DELTA: // Delta WRITE against a signature
+            result = handle_delta(client_socket, request);
+            break;
+        case OP_LINK: // Content the server may already hold
+            result = handle_link(client_socket, request);
+            break;
+        default: // If the command is invalid
+            result = handle_error(client_socket,
+                                  "\nserver: client request did not issue valid command\n",
+                                  STATUS_BAD_REQUEST, "Unknown operation");
+            break;
+    }
+
+    // Keep the connection only if the client asked for it and the stream is intact
+    if ((request->flags & REQUEST_KEEPALIVE) && result != 1)
+        park_session(client_socket);
+    else
+        close(client_socket);
+
+    // The client already has its answer, and its next request is served meanwhile
+    if (ingest_pending)
+        ingest_file(request->target);
+
+    SAFE_FREE(request);
+    return result;
+}
+
+// Function:    set_blocking
+// -------------------------
+// Switches a socket between blocking and non-blocking mode
+//
+// returns 0 on success, -1 on failure
+int set_blocking(int fd, int blocking)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1)
         return -1;
+    flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags);
+}
+
+// Function:    set_stall_timeout
+// ------------------------------
+// Bounds how long a blocking send or receive on a socket may wait, so a
+// client that stops reading or writing mid-request fails the call instead of
+// holding a worker. A timed out call fails like a dropped connection.
+//
+// returns 0 on success, -1 on failure
+int set_stall_timeout(int fd, int seconds)
+{
+    struct timeval timeout = { .tv_sec = seconds, .tv_usec = 0 };
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1)
+        return -1;
+    return 0;
+}
+
+// Function:    add_connection
+// ---------------------------
+// Starts watching a connection for its next request header
+//
+// client_socket:   socket fd
+// now:             current time
+void add_connection(int client_socket, time_t now)
+{
+    if (get_queue_size(connections) >= MAX_SESSIONS)
+    {
+        fprintf(stderr, "server: connection table full, closing socket %d\n", client_socket);
+        close(client_socket);
+        return;
     }
 
-#ifdef DEBUG
-    fprintf(stdout, "\nDEBUG server.handle_inbound: CMD = %s\n", cmd);
-#endif
+    connection_t *connection = calloc(1, sizeof(connection_t));
+    if (!connection || set_blocking(client_socket, 0) == -1)
+    {
+        fprintf(stderr, "server: unable to track socket %d\n", client_socket);
+        SAFE_FREE(connection);
+        close(client_socket);
+        return;
+    }
+    connection->socket_desc = client_socket;
+    connection->last_active = now;
 
-    // Parse command
-    if (!strcmp(cmd, "WRITE") || !strcmp(cmd, "GET") || !strcmp(cmd, "RM")) {
-        // Initiate handshake
-        if (!send_msg("GO", client_socket))
-            return handle_error(cmd, NULL, client_socket,
-                                "\nserver.handle_inbound: handshake initiation aborted at GO\n",
-                                NULL);
-        // Take in target name
-        target = receive_msg(client_socket);
-        if (!target)
-            return handle_error(cmd, NULL, client_socket,
-                                "\nserver.handle_inbound: error receiving target ID from client\n",
-                                NULL);
-
-        // Prompt client to fulfill request
-        if (!send_msg("CONTINUE", client_socket))
-            return handle_error(cmd, target, client_socket,
-                                "\nserver.handle_inbound: handshake initiation aborted at CONTINUE\n",
-                                NULL);
-
-
-        // Behavior controlled by cmd
-        if (!strcmp(cmd, "WRITE")) // Write request
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = connection;
+    if (epoll_ctl(epoll_desc, EPOLL_CTL_ADD, client_socket, &event) == -1)
+    {
+        fprintf(stderr, "server: unable to watch socket %d\n", client_socket);
+        SAFE_FREE(connection);
+        close(client_socket);
+        return;
+    }
+
+    push_queue(connections, connection);
+    connection->node = connections->back;
+}
+
+// Function:    release_connection
+// -------------------------------
+// Stops watching a connection and frees its state, leaving the socket open
+//
+// connection:      tracked connection
+//
+// returns the connection's socket fd
+int release_connection(connection_t *connection)
+{
+    int client_socket = connection->socket_desc;
+
+    epoll_ctl(epoll_desc, EPOLL_CTL_DEL, client_socket, NULL);
+    remove_node(connections, connection->node);
+    SAFE_FREE(connection);
+    return client_socket;
+}
+
+// Function:    read_connection
+// ----------------------------
+// Reads whatever part of the next request frame has arrived, never past the
+// end of it so a WRITE payload stays in the socket for the worker
+//
+// connection:      tracked connection
+//
+// returns 1 once a full frame is buffered, 0 if more data is needed, -1 if the
+// connection should be closed
+int read_connection(connection_t *connection)
+{
+    while (1)
+    {
+        char *destination;
+        size_t wanted;
+
+        if (connection->received < FRAME_HEADER_SIZE)
+        {
+            destination = (char *)connection->header + connection->received;
+            wanted = FRAME_HEADER_SIZE - connection->received;
+        }
+        else
         {
-            result = handle_write(client_socket, target);
-        } else if (!strcmp(cmd, "GET")) // Get request
+            destination = connection->payload + (connection->received - FRAME_HEADER_SIZE);
+            wanted = FRAME_HEADER_SIZE + connection->length - connection->received;
+        }
+
+        if (wanted == 0)
+            return 1;
+
+        ssize_t bytes_received = recv(connection->socket_desc, destination, wanted, 0);
+        if (bytes_received < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (bytes_received == 0) // Client ended the session
+            return -1;
+
+        connection->received += bytes_received;
+
+        // Validate the frame as soon as its header is complete
+        if (connection->received == FRAME_HEADER_SIZE)
         {
-            result = handle_get(client_socket, target);
-        } else if (!strcmp(cmd, "RM")) // File delete request
+            frame_t frame;
+            decode_frame_header(connection->header, &frame);
+            if (frame.type != MSG_REQUEST || frame.length > sizeof(connection->payload))
+            {
+                fprintf(stderr, "server: unexpected frame type %u from socket %d\n", frame.type, connection->socket_desc);
+                return -1;
+            }
+            connection->length = frame.length;
+        }
+    }
+}
+
+// Helper Function:    normalize_target
+// ------------------------------------
+// Rewrites a target in one canonical spelling, dropping "." components,
+// repeated slashes and a trailing slash, so "./a//b" and "a/b" share one
+// waiting room handler and one cache entry. ".." is left alone, since what
+// it refers to depends on symlinks.
+//
+// target:          NUL terminated path, rewritten in place
+void normalize_target(char *target)
+{
+    char *read = target, *write = target;
+
+    if (*read == '/')
+        *write++ = *read++;
+    while (*read)
+    {
+        char *end = strchr(read, '/');
+        size_t length = end ? (size_t)(end - read) : strlen(read);
+
+        if (length > 0 && !(length == 1 && read[0] == '.'))
         {
-            result = handle_rm(client_socket, target);
+            if (write > target && write[-1] != '/')
+                *write++ = '/';
+            memmove(write, read, length);
+            write += length;
         }
+        read += length;
+        while (*read == '/')
+            read++;
     }
-    else // If the second command is invalid
-    	return handle_error(NULL, NULL, client_socket,
-                            "\nserver: client request did not issue valid command\n",
-                            NULL);
 
-    close(client_socket);
-    return result;
+    // Nothing left means the current directory
+    if (write == target)
+        *write++ = '.';
+    *write = '\0';
+}
+
+// Function:    dispatch_connection
+// --------------------------------
+// Decodes a buffered request header and hands the connection to the waiting room
+//
+// connection:      tracked connection with a complete frame
+void dispatch_connection(connection_t *connection)
+{
+    request_t *request = malloc(sizeof(request_t));
+    int valid = request && decode_request(connection->payload, connection->length, request) == 0;
+    int client_socket = release_connection(connection);
+
+    if (!valid)
+    {
+        fprintf(stderr, "server: malformed request on socket %d\n", client_socket);
+        SAFE_FREE(request);
+        close(client_socket);
+        return;
+    }
+
+    normalize_target(request->target);
+
+    // Workers use blocking I/O for the body of the request, bounded by the stall timeout
+    if (set_blocking(client_socket, 1) == -1)
+    {
+        SAFE_FREE(request);
+        close(client_socket);
+        return;
+    }
+
+    // Pass request to the waiting room; reads of one file overlap each other and
+    // uploads (which replace the file atomically), removals run alone. The
+    // stripes of a parallel upload only touch their upload file, so they share
+    // the file like readers and the COMMIT that replaces it is the staged step.
+    int striped = request->op == OP_WRITE && (request->flags & REQUEST_STRIPE);
+    access_mode_t mode = (request->op == OP_GET || request->op == OP_STATUS ||
+                          request->op == OP_SIGNATURE || striped) ? ACCESS_SHARED
+                       : (request->op == OP_WRITE || request->op == OP_COMMIT ||
+                          request->op == OP_DELTA || request->op == OP_LINK) ? ACCESS_STAGED
+                       : ACCESS_EXCLUSIVE;
+    make_request(request->target, client_socket, mode, handle_inbound, request);
+}
+
+// Function:    accept_connections
+// -------------------------------
+// Accepts every pending connection on the non-blocking listener
+//
+// now:             current time
+void accept_connections(time_t now)
+{
+    struct sockaddr_in client_addr;
+    socklen_t client_size;
+
+    while (1)
+    {
+        client_size = sizeof(client_addr);
+        int client_sock = accept4(socket_desc, (struct sockaddr*)&client_addr, &client_size, SOCK_NONBLOCK);
+
+        // Check success
+        if (client_sock < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "server: can't accept (errno %d)\n", errno);
+            return;
+        }
+
+        // Tell console
+        printf("Client connected at IP: %s and port: %i\n",
+               inet_ntoa(client_addr.sin_addr),
+               ntohs(client_addr.sin_port));
+
+        // The timeouts only bite once a worker switches the socket to blocking
+        if (set_stall_timeout(client_sock, stall_timeout) == -1)
+        {
+            fprintf(stderr, "server: unable to set timeouts on socket %d\n", client_sock);
+            close(client_sock);
+            continue;
+        }
+
+        add_connection(client_sock, now);
+    }
+}
+
+// Function:    expire_connections
+// -------------------------------
+// Closes connections that have sat idle, or dribbled a partial header, for
+// longer than the idle timeout
+//
+// now:             current time
+void expire_connections(time_t now)
+{
+    node_t *current_node = connections->front;
+    int queue_size = get_queue_size(connections);
+
+    while (queue_size > 0)
+    {
+        connection_t *connection = (connection_t *)current_node->data;
+        current_node = current_node->next;
+        queue_size--;
+
+        if (now - connection->last_active >= idle_timeout)
+            close(release_connection(connection));
+    }
 }
 
 // Function:    handle_sigint
@@ -230,59 +1199,240 @@ int handle_inbound(int client_socket)
 // Closes client and server socket upon keyboard interrupt
 void handle_sigint(int sig)
 {
+    handler_stats_t stats;
+    slab_stats_t nodes, clients;
+    cache_stats_t cached;
+    store_stats_t stored;
+    upload_stats_t uploads;
+
     fprintf(stdout, "\nserver: shutting down\n");
     cleanup_waiting_room();
+    get_handler_stats(&stats);
+    fprintf(stdout, "server: file handlers live %lu, created %lu, reclaimed %lu\n",
+            stats.live, stats.created, stats.reclaimed);
+    get_node_stats(&nodes);
+    get_client_stats(&clients);
+    fprintf(stdout, "server: node pool hits %lu, fallbacks %lu; client pool hits %lu, fallbacks %lu\n",
+            nodes.hits, nodes.fallbacks, clients.hits, clients.fallbacks);
+    get_cache_stats(&cached);
+    fprintf(stdout, "server: content cache hits %lu, misses %lu, evictions %lu, invalidations %lu, %lu files in %zu bytes\n",
+            cached.hits, cached.misses, cached.evictions, cached.invalidations, cached.entries, cached.bytes);
+    fprintf(stdout, "server: checksum cache hits %lu, misses %lu\n", cached.checksum_hits, cached.checksum_misses);
+    cache_cleanup();
+    get_upload_stats(&uploads);
+    fprintf(stdout, "server: uploads in progress %lu, committed %lu, refused %lu, expired %lu\n",
+            uploads.active, uploads.committed, uploads.refused, uploads.expired);
+    if (content_store.enabled)
+    {
+        get_store_stats(&stored);
+        fprintf(stdout, "server: content store new %lu, deduplicated %lu, linked %lu, reclaimed %lu, %" PRIu64 " bytes saved\n",
+                stored.stored, stored.deduplicated, stored.linked, stored.reclaimed, stored.bytes_saved);
+    }
+    while (connections && get_queue_size(connections) != 0)
+        close(release_connection((connection_t *)connections->front->data));
     close(socket_desc);
     exit(sig);
 }
 
 // Function:    main
 // -----------------
-// Modified main function that keeps the server online until a keyboard interrupt is invoked
-int main(void)
+// Modified main function that keeps the server online until a keyboard interrupt is invoked.
+// A single epoll loop accepts connections and assembles request headers without
+// blocking, so a slow or silent client never holds up anyone else; only complete
+// requests reach the waiting room.
+//
+// Options:
+// -t seconds:  idle timeout for persistent sessions
+// -s seconds:  how long a worker waits on a client that stalls mid-request
+// -w workers:  worker threads in the waiting room pool (default: core count)
+// -r seconds:  how long an idle file handler is kept before it is reclaimed
+// -u seconds:  how long an untouched upload file is kept before it is removed (default 1 day)
+// -c bytes:    I/O chunk size for file transfers, with an optional K/M/G suffix
+// -m bytes:    content cache capacity, 0 to disable (default 64M)
+// -g mode:     how uncached GETs are sent, sendfile (default) or mmap
+// -d dir:      keep file contents in a content-addressed store under dir,
+//              deduplicating identical uploads (default: off)
+// -p seconds:  log the progress and rate of transfers this often (default: off)
+int main(int argc, char *argv[])
 {
-  socklen_t client_size;
-  struct sockaddr_in client_addr;
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event event;
+  time_t last_sweep = time(NULL);
+  int opt;
+  uint64_t chunk_size;
+  uint64_t cache_capacity = DEFAULT_CACHE_CAPACITY;
+  int progress_seconds;
+
+  while ((opt = getopt(argc, argv, "t:s:w:r:u:c:m:g:d:p:")) != -1)
+  {
+      switch (opt)
+      {
+          case 't':
+              idle_timeout = atoi(optarg);
+              if (idle_timeout <= 0)
+              {
+                  fprintf(stderr, "server: idle timeout must be a positive number of seconds\n");
+                  return 1;
+              }
+              break;
+          case 's':
+              stall_timeout = atoi(optarg);
+              if (stall_timeout <= 0)
+              {
+                  fprintf(stderr, "server: stall timeout must be a positive number of seconds\n");
+                  return 1;
+              }
+              break;
+          case 'w':
+              worker_count = atoi(optarg);
+              if (worker_count <= 0)
+              {
+                  fprintf(stderr, "server: worker count must be positive\n");
+                  return 1;
+              }
+              break;
+          case 'r':
+              handler_ttl_seconds = atoi(optarg);
+              if (handler_ttl_seconds <= 0)
+              {
+                  fprintf(stderr, "server: handler TTL must be a positive number of seconds\n");
+                  return 1;
+              }
+              break;
+          case 'u':
+              upload_ttl_seconds = atoi(optarg);
+              if (upload_ttl_seconds <= 0)
+              {
+                  fprintf(stderr, "server: upload TTL must be a positive number of seconds\n");
+                  return 1;
+              }
+              break;
+          case 'c':
+              if (parse_size(optarg, &chunk_size) == -1 || set_transfer_chunk(chunk_size) == -1)
+              {
+                  fprintf(stderr, "server: invalid chunk size %s\n", optarg);
+                  return 1;
+              }
+              break;
+          case 'm':
+              if (parse_size(optarg, &cache_capacity) == -1)
+              {
+                  fprintf(stderr, "server: invalid cache capacity %s\n", optarg);
+                  return 1;
+              }
+              break;
+          case 'g':
+              if (strcmp(optarg, "mmap") == 0)
+                  transfer_config.send_mode = SEND_MMAP;
+              else if (strcmp(optarg, "sendfile") == 0)
+                  transfer_config.send_mode = SEND_SENDFILE;
+              else
+              {
+                  fprintf(stderr, "server: unknown send mode %s, expected mmap or sendfile\n", optarg);
+                  return 1;
+              }
+              break;
+          case 'd':
+              if (store_init(optarg) == -1)
+                  return 1;
+              break;
+          case 'p':
+              progress_seconds = atoi(optarg);
+              if (progress_seconds <= 0)
+              {
+                  fprintf(stderr, "server: progress interval must be a positive number of seconds\n");
+                  return 1;
+              }
+              set_progress_callback(log_progress, NULL, (unsigned)progress_seconds * 1000);
+              break;
+          default:
+              fprintf(stderr, "usage: server [-t idle_timeout_seconds] [-s stall_timeout_seconds] [-w workers] [-r handler_ttl_seconds] [-u upload_ttl_seconds] [-c chunk_bytes] [-m cache_bytes] [-g mmap|sendfile] [-d store_dir] [-p progress_seconds]\n");
+              return 1;
+      }
+  }
 
   // Register signature handler
   signal(SIGINT, handle_sigint);
+
+  // sendfile(2) can't take MSG_NOSIGNAL, so a vanished client must not kill the server
+  signal(SIGPIPE, SIG_IGN);
   
   // Initialize server, open inbound socket
   socket_desc = server_init();
+  if (socket_desc < 0 || set_blocking(socket_desc, 0) == -1)
+      return 1;
+
+  // Parked sessions come back from the workers through a non-blocking pipe
+  if (pipe(park_pipe) == -1 || set_blocking(park_pipe[0], 0) == -1)
+  {
+      fprintf(stderr, "server: unable to create session pipe\n");
+      return 1;
+  }
 
-  // Initialize waiting room / file map
-  waiting_room_init();
+  // Watch the listener and the park pipe
+  connections = create_queue();
+  epoll_desc = epoll_create1(0);
+  if (epoll_desc == -1)
+  {
+      fprintf(stderr, "server: unable to create epoll instance\n");
+      return 1;
+  }
+  event.events = EPOLLIN;
+  event.data.ptr = &listener_marker;
+  epoll_ctl(epoll_desc, EPOLL_CTL_ADD, socket_desc, &event);
+  event.data.ptr = &park_marker;
+  epoll_ctl(epoll_desc, EPOLL_CTL_ADD, park_pipe[0], &event);
 
-  // Accept incoming connections on loop:
+  // Initialize content cache, upload registry and waiting room / file map;
+  // the reaper that retires idle handlers also expires abandoned uploads
+  cache_init((size_t)cache_capacity);
+  uploads_init(upload_ttl_seconds);
+  set_reaper_task(expire_uploads);
+  waiting_room_init(worker_count, handler_ttl_seconds);
+
+  // Accept incoming connections and session requests on loop:
   while (1)
   {
-      client_size = sizeof(client_addr);
-      client_sock = accept(socket_desc, (struct sockaddr*)&client_addr, &client_size);
-
-      // Check success
-      if (client_sock < 0){
-          printf("Can't accept\n");
-          close(client_sock);
-          handle_error(NULL, NULL, socket_desc, "client: error getting server response after RM\n",  NULL);
+      int ready = epoll_wait(epoll_desc, events, MAX_EVENTS, POLL_INTERVAL_MS);
+      if (ready == -1)
+      {
+          if (errno == EINTR) continue;
+          printf("Can't wait on epoll\n");
           handle_sigint(-1);
       }
+      time_t now = time(NULL);
 
-      // Tell console
-      printf("Client connected at IP: %s and port: %i\n",
-             inet_ntoa(client_addr.sin_addr),
-             ntohs(client_addr.sin_port));
-
-      // Get the target filename
-      char *filename = receive_msg(client_sock);
-
-      if (!filename) {
-          close(client_sock);
-          handle_error(NULL, NULL, socket_desc, "server: error getting server response after RM\n", NULL);
-          handle_sigint(-1);
+      for (int i = 0; i < ready; i++)
+      {
+          if (events[i].data.ptr == &listener_marker) // New connections
+          {
+              accept_connections(now);
+          }
+          else if (events[i].data.ptr == &park_marker) // Sessions whose request has completed
+          {
+              int parked;
+              while (read(park_pipe[0], &parked, sizeof(parked)) == sizeof(parked))
+                  add_connection(parked, now);
+          }
+          else // Header bytes from a tracked connection
+          {
+              connection_t *connection = (connection_t *)events[i].data.ptr;
+              int status = read_connection(connection);
+              if (status == 1)
+                  dispatch_connection(connection);
+              else if (status == -1)
+                  close(release_connection(connection));
+              else
+                  connection->last_active = now;
+          }
       }
 
-      // Pass request to the waiting room
-      make_request(filename, client_sock, handle_inbound);
+      // Drop idle sessions once per interval
+      if (now != last_sweep)
+      {
+          expire_connections(now);
+          last_sweep = now;
+      }
   }
 
 }
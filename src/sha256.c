@@ -0,0 +1,151 @@
+/*
+ * sha256.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * SHA-256 for content addressing (FIPS 180-4)
+ */
+
+#include "sha256.h"
+#include <string.h>
+
+static const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Helper Function:    rotr32
+// --------------------------
+// Rotates a word right
+static uint32_t rotr32(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+// Helper Function:    compress_block
+// ----------------------------------
+// Runs the compression function over one 64-byte block
+static void compress_block(uint32_t state[8], const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+               (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) +
+                      round_constants[i] + w[i];
+        uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+// Function:    sha256_init
+// ------------------------
+// Starts a new hash
+void sha256_init(sha256_t *hash)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(hash->state, initial, sizeof(initial));
+    hash->length = 0;
+    hash->filled = 0;
+}
+
+// Function:    sha256_update
+// --------------------------
+// Adds len bytes to the hash
+void sha256_update(sha256_t *hash, const void *data, size_t len)
+{
+    const unsigned char *cursor = (const unsigned char *)data;
+    hash->length += len;
+
+    // Top up a partial block first
+    if (hash->filled)
+    {
+        size_t take = SHA256_BLOCK_SIZE - hash->filled < len ? SHA256_BLOCK_SIZE - hash->filled : len;
+        memcpy(hash->block + hash->filled, cursor, take);
+        hash->filled += take;
+        cursor += take;
+        len -= take;
+        if (hash->filled < SHA256_BLOCK_SIZE)
+            return;
+        compress_block(hash->state, hash->block);
+        hash->filled = 0;
+    }
+
+    for (; len >= SHA256_BLOCK_SIZE; cursor += SHA256_BLOCK_SIZE, len -= SHA256_BLOCK_SIZE)
+        compress_block(hash->state, cursor);
+
+    memcpy(hash->block, cursor, len);
+    hash->filled = len;
+}
+
+// Function:    sha256_final
+// -------------------------
+// Pads the message and writes the digest
+void sha256_final(sha256_t *hash, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = hash->length * 8;
+
+    hash->block[hash->filled++] = 0x80;
+    if (hash->filled > SHA256_BLOCK_SIZE - 8)
+    {
+        memset(hash->block + hash->filled, 0, SHA256_BLOCK_SIZE - hash->filled);
+        compress_block(hash->state, hash->block);
+        hash->filled = 0;
+    }
+    memset(hash->block + hash->filled, 0, SHA256_BLOCK_SIZE - 8 - hash->filled);
+    for (int i = 0; i < 8; i++)
+        hash->block[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (8 * i));
+    compress_block(hash->state, hash->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (unsigned char)(hash->state[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(hash->state[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(hash->state[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)hash->state[i];
+    }
+}
+
+// Function:    sha256_hex
+// -----------------------
+// Formats a digest as 64 lowercase hex digits and a NUL
+void sha256_hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[2 * SHA256_DIGEST_SIZE + 1])
+{
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+    {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 15];
+    }
+    hex[2 * SHA256_DIGEST_SIZE] = '\0';
+}
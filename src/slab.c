@@ -0,0 +1,254 @@
+/*
+ * slab.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Pooled fixed-size object allocator
+ */
+
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Type:        slab_cache_t
+// -------------------------
+// One thread's private free list for one slab
+typedef struct slab_cache {
+    void *free;
+    int count;
+    unsigned long hits; // Written only by the owning thread, summed by get_slab_stats
+
+    slab_t *slab;             // Set once the cache is registered with its slab
+    struct slab_cache *next;  // Next registered cache of the same slab
+} slab_cache_t;
+
+static __thread slab_cache_t slab_caches[SLAB_MAX_CLASSES];
+static int slab_classes;
+static pthread_key_t slab_exit_key;
+static pthread_once_t slab_exit_once = PTHREAD_ONCE_INIT;
+
+// Free objects are chained through their first word
+#define NEXT_FREE(object) (*(void **)(object))
+
+// Helper Function:    slab_thread_exit
+// ------------------------------------
+// Thread destructor: hands every object cached by the exiting thread back to
+// its slab's depot and unregisters the cache
+static void slab_thread_exit(void *arg)
+{
+    (void)arg;
+
+    for (int id = 0; id < SLAB_MAX_CLASSES; id++)
+    {
+        slab_cache_t *cache = &slab_caches[id];
+        slab_t *slab = cache->slab;
+        if (!slab)
+            continue;
+
+        pthread_mutex_lock(&slab->lock);
+        slab->stats.hits += cache->hits;
+        for (slab_cache_t **link = &slab->caches; *link; link = &(*link)->next)
+            if (*link == cache)
+            {
+                *link = cache->next;
+                break;
+            }
+        while (cache->free)
+        {
+            void *object = cache->free;
+            cache->free = NEXT_FREE(object);
+            NEXT_FREE(object) = slab->depot;
+            slab->depot = object;
+            slab->depot_count++;
+        }
+        pthread_mutex_unlock(&slab->lock);
+        cache->slab = NULL;
+    }
+}
+
+// Helper Function:    slab_exit_key_init
+// --------------------------------------
+// Creates the key whose destructor runs slab_thread_exit
+static void slab_exit_key_init(void)
+{
+    pthread_key_create(&slab_exit_key, slab_thread_exit);
+}
+
+// Helper Function:    slab_cache
+// ------------------------------
+// Finds the calling thread's cache for a slab, assigning the slab an id and
+// registering the cache on first use
+//
+// returns pointer to the thread's slab_cache_t
+static slab_cache_t *slab_cache(slab_t *slab)
+{
+    int id = __atomic_load_n(&slab->id, __ATOMIC_ACQUIRE);
+    if (id == 0)
+    {
+        pthread_mutex_lock(&slab->lock);
+        if (slab->id == 0)
+        {
+            int claimed = __atomic_add_fetch(&slab_classes, 1, __ATOMIC_RELAXED);
+            if (claimed > SLAB_MAX_CLASSES)
+            {
+                fprintf(stderr, "slab.slab_cache: more than %d slabs in use\n", SLAB_MAX_CLASSES);
+                exit(1);
+            }
+            __atomic_store_n(&slab->id, claimed, __ATOMIC_RELEASE);
+        }
+        id = slab->id;
+        pthread_mutex_unlock(&slab->lock);
+    }
+
+    slab_cache_t *cache = &slab_caches[id - 1];
+    if (!cache->slab)
+    {
+        pthread_once(&slab_exit_once, slab_exit_key_init);
+        pthread_setspecific(slab_exit_key, slab_caches);
+
+        pthread_mutex_lock(&slab->lock);
+        cache->slab = slab;
+        cache->next = slab->caches;
+        slab->caches = cache;
+        pthread_mutex_unlock(&slab->lock);
+    }
+    return cache;
+}
+
+// Helper Function:    slab_refill
+// -------------------------------
+// Moves a batch from the depot into a thread cache, carving a new chunk when
+// the depot is empty
+// Caller must hold slab->lock
+//
+// returns 1 if a chunk had to be malloc'd, 0 if the depot had objects
+static int slab_refill(slab_t *slab, slab_cache_t *cache)
+{
+    int fallback = 0;
+
+    if (slab->depot_count == 0)
+    {
+        slab_chunk_t *chunk = malloc(sizeof(slab_chunk_t) + SLAB_CHUNK_OBJECTS * slab->object_size);
+        if (!chunk)
+        {
+            fprintf(stderr, "slab.slab_refill: memory allocation failed for %d objects of %zu bytes\n",
+                    SLAB_CHUNK_OBJECTS, slab->object_size);
+            exit(1);
+        }
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->stats.chunks++;
+        slab->stats.fallbacks++;
+        fallback = 1;
+
+        // Thread the new objects onto the depot
+        char *object = (char *)(chunk + 1);
+        for (int i = 0; i < SLAB_CHUNK_OBJECTS; i++, object += slab->object_size)
+        {
+            NEXT_FREE(object) = slab->depot;
+            slab->depot = object;
+        }
+        slab->depot_count = SLAB_CHUNK_OBJECTS;
+    }
+
+    // Detach up to a batch from the front of the depot
+    void *first = slab->depot;
+    void *last = first;
+    int moved = 1;
+    while (moved < SLAB_BATCH && NEXT_FREE(last))
+    {
+        last = NEXT_FREE(last);
+        moved++;
+    }
+    slab->depot = NEXT_FREE(last);
+    slab->depot_count -= moved;
+
+    NEXT_FREE(last) = cache->free;
+    cache->free = first;
+    cache->count += moved;
+    return fallback;
+}
+
+// Helper Function:    slab_flush
+// ------------------------------
+// Moves a batch from a thread cache back to the depot
+// Caller must hold slab->lock
+static void slab_flush(slab_t *slab, slab_cache_t *cache)
+{
+    void *first = cache->free;
+    void *last = first;
+    for (int moved = 1; moved < SLAB_BATCH; moved++)
+        last = NEXT_FREE(last);
+    cache->free = NEXT_FREE(last);
+    cache->count -= SLAB_BATCH;
+
+    NEXT_FREE(last) = slab->depot;
+    slab->depot = first;
+    slab->depot_count += SLAB_BATCH;
+}
+
+// Function:    slab_alloc
+// -----------------------
+// Takes an object from the calling thread's cache, refilling it from the depot
+// or a fresh chunk when empty
+//
+// slab:        pool to allocate from
+//
+// returns pointer to uninitialised object, exits on allocation failure
+void *slab_alloc(slab_t *slab)
+{
+    slab_cache_t *cache = slab_cache(slab);
+    int fallback = 0;
+
+    if (cache->count == 0)
+    {
+        pthread_mutex_lock(&slab->lock);
+        fallback = slab_refill(slab, cache);
+        pthread_mutex_unlock(&slab->lock);
+    }
+
+    void *object = cache->free;
+    cache->free = NEXT_FREE(object);
+    cache->count--;
+    if (!fallback)
+        __atomic_store_n(&cache->hits, cache->hits + 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+// Function:    slab_free
+// ----------------------
+// Returns an object to the calling thread's cache, flushing a batch to the
+// depot when the cache grows past SLAB_CACHE_MAX
+//
+// slab:        pool the object came from
+// object:      object to release, may be NULL
+void slab_free(slab_t *slab, void *object)
+{
+    if (!object)
+        return;
+
+    slab_cache_t *cache = slab_cache(slab);
+    NEXT_FREE(object) = cache->free;
+    cache->free = object;
+    cache->count++;
+
+    if (cache->count > SLAB_CACHE_MAX)
+    {
+        pthread_mutex_lock(&slab->lock);
+        slab_flush(slab, cache);
+        pthread_mutex_unlock(&slab->lock);
+    }
+}
+
+// Function:    get_slab_stats
+// ---------------------------
+// Copies a slab's counters, adding in the hits of every live thread cache
+void get_slab_stats(slab_t *slab, slab_stats_t *stats)
+{
+    pthread_mutex_lock(&slab->lock);
+    *stats = slab->stats;
+    for (slab_cache_t *cache = slab->caches; cache; cache = cache->next)
+        stats->hits += __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&slab->lock);
+}
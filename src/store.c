@@ -0,0 +1,289 @@
+/*
+ * store.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Content-addressed store deduplicating identical uploads
+ */
+
+#include "store.h"
+#include "messenger.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+
+content_store_t content_store = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Helper Function:    object_path
+// -------------------------------
+// Path of the object holding some content
+//
+// returns 0 on success, -1 if the path doesn't fit
+static int object_path(const unsigned char digest[SHA256_DIGEST_SIZE], char *path, size_t len)
+{
+    char hex[2 * SHA256_DIGEST_SIZE + 1];
+    sha256_hex(digest, hex);
+    return snprintf(path, len, "%s/%.2s/%s", content_store.root, hex, hex) >= (int)len ? -1 : 0;
+}
+
+// Helper Function:    is_hex_name
+// -------------------------------
+// Checks that a directory entry is len hex digits, as the store names things
+static int is_hex_name(const char *name, size_t len)
+{
+    if (strlen(name) != len)
+        return 0;
+    for (size_t i = 0; i < len; i++)
+        if (!isxdigit((unsigned char)name[i]))
+            return 0;
+    return 1;
+}
+
+// Helper Function:    link_into
+// -----------------------------
+// Replaces a file with a link to an object: the link is made under a fresh
+// name beside the target and renamed over it, so readers see either version
+//
+// returns 0 on success, -1 on failure
+static int link_into(const char *object, const char *target)
+{
+    char staging_path[TARGET_MAX + 16];
+    int fd = open_staging_file(target, staging_path, sizeof(staging_path));
+    if (fd == -1)
+        return -1;
+
+    // Only the unique name is wanted, link(2) won't replace a file
+    close(fd);
+    unlink(staging_path);
+    if (link(object, staging_path) != 0)
+        return -1;
+    if (rename(staging_path, target) != 0)
+    {
+        unlink(staging_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Function:    content_hash
+// -------------------------
+// SHA-256 of a whole file
+//
+// fd: open file
+// size: bytes in the file
+// digest: receives the hash
+//
+// returns 0 on success, -1 if the file couldn't be read in full
+int content_hash(int fd, uint64_t size, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+    unsigned char *buffer = malloc(STORE_HASH_CHUNK);
+    if (!buffer)
+        return -1;
+
+    sha256_t hash;
+    sha256_init(&hash);
+    for (uint64_t offset = 0; offset < size; )
+    {
+        size_t chunk = size - offset < STORE_HASH_CHUNK ? (size_t)(size - offset) : STORE_HASH_CHUNK;
+        if (pread_all(fd, buffer, chunk, offset) == -1)
+        {
+            SAFE_FREE(buffer);
+            return -1;
+        }
+        sha256_update(&hash, buffer, chunk);
+        offset += chunk;
+    }
+    sha256_final(&hash, digest);
+    SAFE_FREE(buffer);
+    return 0;
+}
+
+// Helper Function:    sweep_objects
+// ---------------------------------
+// Removes objects whose last name has been removed or replaced, leaving
+// them with the store's own link alone
+//
+// returns number of objects removed
+static unsigned long sweep_objects(void)
+{
+    unsigned long reclaimed = 0;
+    DIR *root = opendir(content_store.root);
+    if (!root)
+        return 0;
+
+    struct dirent *fanout;
+    while ((fanout = readdir(root)) != NULL)
+    {
+        char directory[STORE_PATH_MAX];
+        if (!is_hex_name(fanout->d_name, 2) ||
+            snprintf(directory, sizeof(directory), "%s/%s", content_store.root, fanout->d_name) >= (int)sizeof(directory))
+            continue;
+
+        DIR *objects = opendir(directory);
+        if (!objects)
+            continue;
+
+        struct dirent *object;
+        while ((object = readdir(objects)) != NULL)
+        {
+            char path[STORE_PATH_MAX];
+            struct stat info;
+            if (!is_hex_name(object->d_name, 2 * SHA256_DIGEST_SIZE) ||
+                snprintf(path, sizeof(path), "%s/%s", directory, object->d_name) >= (int)sizeof(path))
+                continue;
+            if (lstat(path, &info) == 0 && S_ISREG(info.st_mode) && info.st_nlink == 1 && unlink(path) == 0)
+                reclaimed++;
+        }
+        closedir(objects);
+    }
+    closedir(root);
+    return reclaimed;
+}
+
+// Function:    store_init
+// -----------------------
+// Enables the store under root, creating it if needed and reclaiming objects
+// no file refers to any more
+//
+// returns 0 on success, -1 if root can't be used
+int store_init(const char *root)
+{
+    size_t length = strlen(root);
+    while (length > 1 && root[length - 1] == '/')
+        length--;
+    if (length == 0 || length >= sizeof(content_store.root))
+    {
+        fprintf(stderr, "store.store_init: invalid store directory %s\n", root);
+        return -1;
+    }
+
+    struct stat info;
+    memcpy(content_store.root, root, length);
+    content_store.root[length] = '\0';
+    if ((mkdir(content_store.root, 0755) != 0 && errno != EEXIST) ||
+        stat(content_store.root, &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        fprintf(stderr, "store.store_init: %s is not a usable directory\n", content_store.root);
+        return -1;
+    }
+
+    unsigned long reclaimed = sweep_objects();
+    pthread_mutex_lock(&content_store.lock);
+    content_store.stats.reclaimed = reclaimed;
+    content_store.enabled = 1;
+    pthread_mutex_unlock(&content_store.lock);
+    return 0;
+}
+
+// Function:    store_ingest
+// -------------------------
+// Files a newly written file under its content. If an object with the same
+// content exists the file is replaced by a link to it; otherwise the file
+// becomes the object. Callers must hold the file against other writers.
+//
+// path: file just written
+//
+// returns 0 if the content was new, 1 if it was already held, -1 on errors
+// (the file is left as an independent copy)
+int store_ingest(const char *path)
+{
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char object[STORE_PATH_MAX];
+    struct stat info, held;
+    uint64_t file_size;
+
+    int fd = open_file(path, &file_size);
+    if (fd == -1)
+        return -1;
+    int hashed = fstat(fd, &info) == 0 ? content_hash(fd, file_size, digest) : -1;
+    close(fd);
+    if (hashed == -1 || object_path(digest, object, sizeof(object)) == -1)
+        return -1;
+
+    // The fan-out directory may not exist yet
+    char *last_slash = strrchr(object, '/');
+    *last_slash = '\0';
+    if (mkdir(object, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "store.store_ingest: unable to create %s\n", object);
+        return -1;
+    }
+    *last_slash = '/';
+
+    // New content: the file itself becomes the object
+    if (link(path, object) == 0)
+    {
+        pthread_mutex_lock(&content_store.lock);
+        content_store.stats.stored++;
+        pthread_mutex_unlock(&content_store.lock);
+        return 0;
+    }
+    if (errno != EEXIST)
+    {
+        fprintf(stderr, "store.store_ingest: unable to link %s into the store (errno %d)\n", path, errno);
+        return -1;
+    }
+
+    // Known content: swap the fresh copy for a link to the object
+    if (stat(object, &held) != 0 || (uint64_t)held.st_size != file_size)
+    {
+        fprintf(stderr, "store.store_ingest: object %s doesn't match %s\n", object, path);
+        return -1;
+    }
+    if (held.st_dev == info.st_dev && held.st_ino == info.st_ino)
+        return 1;
+    if (link_into(object, path) == -1)
+    {
+        fprintf(stderr, "store.store_ingest: unable to replace %s with a link to %s\n", path, object);
+        return -1;
+    }
+
+    pthread_mutex_lock(&content_store.lock);
+    content_store.stats.deduplicated++;
+    content_store.stats.bytes_saved += file_size;
+    pthread_mutex_unlock(&content_store.lock);
+    return 1;
+}
+
+// Function:    store_link
+// -----------------------
+// Publishes held content under a new name without any data transfer
+//
+// digest: content hash announced by the client
+// size: size the client expects the content to have
+// target: file to create or replace
+//
+// returns 0 on success, 1 if no object of that hash and size is held, -1 on errors
+int store_link(const unsigned char digest[SHA256_DIGEST_SIZE], uint64_t size, const char *target)
+{
+    char object[STORE_PATH_MAX];
+    struct stat held;
+
+    if (!content_store.enabled || object_path(digest, object, sizeof(object)) == -1)
+        return 1;
+    if (stat(object, &held) != 0 || !S_ISREG(held.st_mode) || (uint64_t)held.st_size != size)
+        return 1;
+
+    if (link_into(object, target) == -1)
+    {
+        fprintf(stderr, "store.store_link: unable to link %s to %s\n", target, object);
+        return -1;
+    }
+
+    pthread_mutex_lock(&content_store.lock);
+    content_store.stats.linked++;
+    content_store.stats.bytes_saved += size;
+    pthread_mutex_unlock(&content_store.lock);
+    return 0;
+}
+
+// Function:    get_store_stats
+// ----------------------------
+// Copies the store counters
+void get_store_stats(store_stats_t *stats)
+{
+    pthread_mutex_lock(&content_store.lock);
+    *stats = content_store.stats;
+    pthread_mutex_unlock(&content_store.lock);
+}
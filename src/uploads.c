@@ -0,0 +1,373 @@
+/*
+ * uploads.c / Practicum 2
+ *
+ * Ben Henshaw / CS5600 / Northeastern University
+ * Spring 2025 / 4/15/2025
+ *
+ * Registry of the upload files a server is collecting
+ */
+
+#define _GNU_SOURCE // nftw(3)
+#include "uploads.h"
+#include <ctype.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SAFE_FREE(p) do { if (p) { free(p); p = NULL; } } while (0)
+#define UPLOAD_MARKER ".upload-"   // upload_path names files .<name>.upload-<16 hex digits>
+#define UPLOAD_ID_DIGITS 16
+#define ADOPT_OPEN_DIRS 16         // Directory descriptors nftw may hold at once
+
+upload_table_t upload_table = { .ttl = UPLOAD_TTL, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Helper Function:    find_upload
+// -------------------------------
+// Finds the tracked upload for a path
+// Caller must hold upload_table.lock
+//
+// returns pointer to the link holding the upload, or to the list's final NULL
+static upload_t **find_upload(const char *path)
+{
+    upload_t **link = &upload_table.uploads;
+    while (*link && strcmp((*link)->path, path) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+// Helper Function:    track_upload
+// --------------------------------
+// Starts tracking an upload file
+// Caller must hold upload_table.lock
+//
+// returns the new upload, NULL if memory ran out
+static upload_t *track_upload(const char *path, time_t last_active)
+{
+    upload_t *upload = calloc(1, sizeof(upload_t));
+    char *path_copy = strdup(path);
+    if (!upload || !path_copy)
+    {
+        fprintf(stderr, "uploads.track_upload: memory allocation failed for %s\n", path);
+        SAFE_FREE(upload);
+        SAFE_FREE(path_copy);
+        return NULL;
+    }
+    upload->path = path_copy;
+    upload->last_active = last_active;
+    upload->next = upload_table.uploads;
+    upload_table.uploads = upload;
+    upload_table.stats.active++;
+    return upload;
+}
+
+// Helper Function:    untrack_upload
+// ----------------------------------
+// Stops tracking an upload and frees it
+// Caller must hold upload_table.lock
+//
+// link:        link holding the upload, from find_upload
+static void untrack_upload(upload_t **link)
+{
+    upload_t *upload = *link;
+    *link = upload->next;
+    upload_table.stats.active--;
+
+    SAFE_FREE(upload->path);
+    SAFE_FREE(upload->ranges);
+    SAFE_FREE(upload);
+}
+
+// Helper Function:    reserve_ranges
+// ----------------------------------
+// Makes room for one more range than an upload holds
+//
+// returns 0 on success, -1 if memory ran out
+static int reserve_ranges(upload_t *upload)
+{
+    if (upload->range_count < upload->range_capacity)
+        return 0;
+
+    int capacity = upload->range_capacity ? upload->range_capacity * 2 : 8;
+    byte_range_t *ranges = realloc(upload->ranges, sizeof(byte_range_t) * capacity);
+    if (!ranges)
+        return -1;
+    upload->ranges = ranges;
+    upload->range_capacity = capacity;
+    return 0;
+}
+
+// Helper Function:    add_range
+// -----------------------------
+// Adds start..end to an upload's ranges, merging it with every range it
+// overlaps or touches
+//
+// returns 0 on success, -1 if memory ran out
+static int add_range(upload_t *upload, uint64_t start, uint64_t end)
+{
+    if (reserve_ranges(upload) == -1)
+        return -1;
+
+    // Skip the ranges wholly before the new one, then swallow every one it meets
+    int first = 0;
+    while (first < upload->range_count && upload->ranges[first].end < start)
+        first++;
+    int last = first;
+    for (; last < upload->range_count && upload->ranges[last].start <= end; last++)
+    {
+        if (upload->ranges[last].start < start)
+            start = upload->ranges[last].start;
+        if (upload->ranges[last].end > end)
+            end = upload->ranges[last].end;
+    }
+
+    // ranges[first] up to ranges[last] become the one merged range
+    memmove(&upload->ranges[first + 1], &upload->ranges[last], sizeof(byte_range_t) * (upload->range_count - last));
+    upload->range_count += 1 - (last - first);
+    upload->ranges[first].start = start;
+    upload->ranges[first].end = end;
+    return 0;
+}
+
+// Helper Function:    remove_range
+// --------------------------------
+// Takes start..end out of an upload's ranges, splitting the one it falls
+// inside if need be
+//
+// returns 0 on success, -1 if memory ran out
+static int remove_range(upload_t *upload, uint64_t start, uint64_t end)
+{
+    if (reserve_ranges(upload) == -1)
+        return -1;
+
+    for (int i = 0; i < upload->range_count; i++)
+    {
+        byte_range_t *range = &upload->ranges[i];
+        if (range->end <= start || range->start >= end)
+            continue;
+
+        if (range->start < start && range->end > end) // Split around the hole
+        {
+            memmove(&upload->ranges[i + 1], &upload->ranges[i], sizeof(byte_range_t) * (upload->range_count - i));
+            upload->range_count++;
+            upload->ranges[i].end = start;
+            upload->ranges[i + 1].start = end;
+            return 0;
+        }
+        if (range->start < start)
+            range->end = start;
+        else if (range->end > end)
+            range->start = end;
+        else // Wholly inside the hole
+        {
+            memmove(&upload->ranges[i], &upload->ranges[i + 1], sizeof(byte_range_t) * (upload->range_count - i - 1));
+            upload->range_count--;
+            i--;
+        }
+    }
+    return 0;
+}
+
+// Function:    upload_begin
+// -------------------------
+// Registers a request about to write into an upload file, tracking the
+// upload from then on if it is new
+//
+// path:        upload file, from upload_path
+//
+// returns 0 on success, -1 if the upload can't be tracked
+int upload_begin(const char *path)
+{
+    pthread_mutex_lock(&upload_table.lock);
+    upload_t *upload = *find_upload(path);
+    if (!upload)
+        upload = track_upload(path, time(NULL));
+    if (upload)
+        upload->writers++;
+    pthread_mutex_unlock(&upload_table.lock);
+
+    return upload ? 0 : -1;
+}
+
+// Function:    upload_end
+// -----------------------
+// Ends a write begun with upload_begin. A range that was stored intact is
+// added to the upload's ranges; one that wasn't is taken out of them, since
+// whatever it held before may have been overwritten. Should the ranges not
+// fit in memory, they are all dropped, which only costs a refused COMMIT.
+//
+// path:        upload file
+// offset/length: range the request covered
+// stored:      1 if every byte of it arrived intact, 0 otherwise
+void upload_end(const char *path, uint64_t offset, uint64_t length, int stored)
+{
+    pthread_mutex_lock(&upload_table.lock);
+    upload_t *upload = *find_upload(path);
+    if (upload)
+    {
+        upload->writers--;
+        upload->last_active = time(NULL);
+
+        int recorded = length == 0 ? 0
+                     : stored ? add_range(upload, offset, offset + length)
+                     : remove_range(upload, offset, offset + length);
+        if (recorded == -1)
+        {
+            fprintf(stderr, "uploads.upload_end: memory allocation failed for %s\n", path);
+            upload->range_count = 0;
+        }
+    }
+    pthread_mutex_unlock(&upload_table.lock);
+}
+
+// Function:    upload_claim
+// -------------------------
+// Checks that a striped upload holds every byte of the file and no request
+// is still writing into it, and stops tracking it so it can be published
+//
+// path:        upload file
+// size:        bytes in the whole file
+//
+// returns 0 if it is complete, -1 if it is unknown or has gaps
+int upload_claim(const char *path, uint64_t size)
+{
+    pthread_mutex_lock(&upload_table.lock);
+    upload_t **link = find_upload(path);
+    upload_t *upload = *link;
+    int complete = upload && upload->writers == 0 && upload->range_count == 1 &&
+                   upload->ranges[0].start == 0 && upload->ranges[0].end == size;
+    if (complete)
+    {
+        untrack_upload(link);
+        upload_table.stats.committed++;
+    }
+    else
+        upload_table.stats.refused++;
+    pthread_mutex_unlock(&upload_table.lock);
+
+    return complete ? 0 : -1;
+}
+
+// Function:    upload_forget
+// --------------------------
+// Stops tracking an upload whose file has been published
+void upload_forget(const char *path)
+{
+    pthread_mutex_lock(&upload_table.lock);
+    upload_t **link = find_upload(path);
+    if (*link)
+        untrack_upload(link);
+    pthread_mutex_unlock(&upload_table.lock);
+}
+
+// Helper Function:    is_upload_name
+// ----------------------------------
+// Recognises the name upload_path gives an upload file
+//
+// returns 1 if name is .<name>.upload-<16 hex digits>, 0 otherwise
+static int is_upload_name(const char *name)
+{
+    const char *marker = strstr(name, UPLOAD_MARKER);
+    if (name[0] != '.' || !marker || marker == name)
+        return 0;
+
+    // The target's own name may contain the marker, the ID follows the last one
+    const char *next;
+    while ((next = strstr(marker + 1, UPLOAD_MARKER)))
+        marker = next;
+
+    const char *digits = marker + strlen(UPLOAD_MARKER);
+    if (strlen(digits) != UPLOAD_ID_DIGITS)
+        return 0;
+    for (int i = 0; i < UPLOAD_ID_DIGITS; i++)
+        if (!isxdigit((unsigned char)digits[i]))
+            return 0;
+    return 1;
+}
+
+// Helper Function:    adopt_upload
+// --------------------------------
+// nftw callback tracking an upload file left by an earlier run from its
+// modification time, so it expires like any other
+// Caller must hold upload_table.lock
+//
+// returns 0 to keep walking
+static int adopt_upload(const char *path, const struct stat *info, int type, struct FTW *walk)
+{
+    if (type != FTW_F || !S_ISREG(info->st_mode) || !is_upload_name(path + walk->base))
+        return 0;
+
+    // Targets never carry a leading "./", and neither do their upload paths
+    if (strncmp(path, "./", 2) == 0)
+        path += 2;
+    if (!*find_upload(path))
+        track_upload(path, info->st_mtime);
+    return 0;
+}
+
+// Function:    uploads_init
+// -------------------------
+// Sets how long an upload file may sit untouched before it is removed, and
+// takes on the upload files an earlier run left under the working
+// directory, which expire by their modification time. Call before any
+// requests are served.
+//
+// ttl:         seconds, 0 for UPLOAD_TTL
+void uploads_init(int ttl)
+{
+    pthread_mutex_lock(&upload_table.lock);
+    upload_table.ttl = ttl > 0 ? ttl : UPLOAD_TTL;
+    nftw(".", adopt_upload, ADOPT_OPEN_DIRS, FTW_PHYS);
+    pthread_mutex_unlock(&upload_table.lock);
+}
+
+// Function:    expire_uploads
+// ---------------------------
+// Removes upload files no request has written into for the TTL, so
+// abandoned uploads don't collect on disk. An upload a request is writing
+// into is never removed, and a request arriving after its file is gone finds
+// no bytes to build on, so the upload starts over.
+//
+// now:         current time
+//
+// returns number of upload files removed
+int expire_uploads(time_t now)
+{
+    int expired = 0;
+
+    pthread_mutex_lock(&upload_table.lock);
+    upload_t **link = &upload_table.uploads;
+    while (*link)
+    {
+        upload_t *upload = *link;
+        if (upload->writers > 0 || now - upload->last_active < upload_table.ttl)
+        {
+            link = &upload->next;
+            continue;
+        }
+
+        if (unlink(upload->path) == 0)
+        {
+            fprintf(stdout, "\nuploads: removed %s, untouched for %ld s\n", upload->path,
+                    (long)(now - upload->last_active));
+            expired++;
+        }
+        untrack_upload(link);
+    }
+    upload_table.stats.expired += expired;
+    pthread_mutex_unlock(&upload_table.lock);
+
+    return expired;
+}
+
+// Function:    get_upload_stats
+// -----------------------------
+// Copies the upload counters
+void get_upload_stats(upload_stats_t *stats)
+{
+    pthread_mutex_lock(&upload_table.lock);
+    *stats = upload_table.stats;
+    pthread_mutex_unlock(&upload_table.lock);
+}
@@ -8,95 +8,93 @@
  */
 
 #include "waitingroom.h"
-queue_t *file_map;
-pthread_mutex_t global_map_lock;
+file_map_t file_map;
+worker_pool_t worker_pool;
+handler_stats_t handler_stats;
+slab_t client_slab = SLAB_INITIALIZER(client_t); // One client_t per request
 int shutdown_signal;
 
-// Helper Function:    map_get
-// --------------------
-// Searches local file map for relevant file handlers
+// Reaper state
+pthread_t reaper_tid;
+pthread_cond_t reaper_cond; // Signalled (under worker_pool.lock) at shutdown
+int handler_ttl;
+reaper_task_fn reaper_task; // Extra sweep run on every pass, NULL for none
+
+// Helper Function:    hash_filename
+// ---------------------------------
+// FNV-1a hash of a filename
 //
 // filename:    target filename
 //
-// returns *file_handler_t if found, NULL if absent
-file_handler_t *map_get(const char *filename)
+// returns 64-bit hash
+uint64_t hash_filename(const char *filename)
 {
-    // Pull the head node
-    node_t *current_node = file_map->front;
-    int queue_size = get_queue_size(file_map);
-    file_handler_t *node_data;
-
-    // Iterate through list
-    while(queue_size > 0)
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *)filename; *c; c++)
     {
-        // Coerce type to extract file handler
-        node_data = (file_handler_t *)current_node->data;
-
-        // If the filename is a match
-        if (strcmp(node_data->filename, filename) == 0)
-            return node_data;
-
-        // Otherwise continue to the next node
-        current_node = current_node->next;
-        queue_size--;
+        hash ^= *c;
+        hash *= 1099511628211ULL;
     }
+    return hash;
+}
 
-    // File handler not found
-    return NULL;
+// Helper Function:    map_stripe
+// ------------------------------
+// Finds the lock guarding the bucket for a hash
+//
+// returns pointer to the stripe mutex
+pthread_mutex_t *map_stripe(uint64_t hash)
+{
+    return &file_map.stripes[(hash & (FILE_MAP_BUCKETS - 1)) % FILE_MAP_STRIPES];
 }
 
-// Helper Function:    map_get_node
+// Helper Function:    map_get
 // --------------------
 // Searches local file map for relevant file handlers
+// Caller must hold the stripe lock for hash
 //
 // filename:    target filename
+// hash:        hash_filename(filename)
 //
 // returns *file_handler_t if found, NULL if absent
-node_t *map_get_node(const char *filename)
+file_handler_t *map_get(const char *filename, uint64_t hash)
 {
-    // Pull head node
-    node_t *current_node = file_map->front;
-    int queue_size = get_queue_size(file_map);
-    file_handler_t *node_data;
+    file_handler_t *handler = file_map.buckets[hash & (FILE_MAP_BUCKETS - 1)];
 
-    // Iterate through list
-    while(queue_size > 0)
+    // Walk the bucket chain, comparing full hashes before strings
+    while (handler)
     {
-        // If the current node contains data matching target
-        node_data = (file_handler_t *)current_node->data;
-        if (strcmp(node_data->filename, filename) == 0)
-            return current_node;
-
-        // Otherwise proceed to next node
-        current_node = current_node->next;
-        queue_size--;
+        if (handler->hash == hash && strcmp(handler->filename, filename) == 0)
+            return handler;
+        handler = handler->next;
     }
 
+    // File handler not found
     return NULL;
 }
 
 // Helper Function:    map_put
 // ---------------------------
-// Adds a new file_handler_t to the global map
+// Adds a new file_handler_t to its bucket
+// Caller must hold the stripe lock for new_fh->hash
 void map_put(file_handler_t *new_fh)
 {
-    push_queue(file_map, new_fh);
+    file_handler_t **bucket = &file_map.buckets[new_fh->hash & (FILE_MAP_BUCKETS - 1)];
+    new_fh->next = *bucket;
+    *bucket = new_fh;
 }
 
 // Debug Function:    print_map
 // ----------------------------
-// Prints current contents of file map
+// Prints current contents of file map, one stripe at a time
 void print_map(){
-    node_t *current_node = file_map->front;
-    int queue_size = get_queue_size(file_map);
-    file_handler_t *node_data;
-    // Iterate through list
-    while(queue_size > 0)
+    for (int stripe = 0; stripe < FILE_MAP_STRIPES; stripe++)
     {
-        node_data = (file_handler_t *)current_node->data;
-        fprintf(stdout, "%s, ", node_data->filename);
-        current_node = current_node->next;
-        queue_size--;
+        pthread_mutex_lock(&file_map.stripes[stripe]);
+        for (int bucket = stripe; bucket < FILE_MAP_BUCKETS; bucket += FILE_MAP_STRIPES)
+            for (file_handler_t *handler = file_map.buckets[bucket]; handler; handler = handler->next)
+                fprintf(stdout, "%s, ", handler->filename);
+        pthread_mutex_unlock(&file_map.stripes[stripe]);
     }
     fprintf(stdout, "\n");
 }
@@ -104,47 +102,187 @@ void print_map(){
 // Debug Function:  print_requests
 // -------------------------------
 // Prints the socket fds in a handler's request queue
+// Only the worker holding the handler's token may call this
 //
 // handler:         target file handler
 void print_requests(file_handler_t *handler)
 {
-    queue_t *requests = handler->request_queue;
-    node_t *current_node = requests->front;
-    int queue_size = get_queue_size(requests);
+    node_t *current_node = __atomic_load_n(&handler->request_queue->head->next, __ATOMIC_ACQUIRE);
     client_t *node_data;
 
-    while(queue_size > 0)
+    while(current_node)
     {
         node_data = (client_t *)current_node->data;
         int socket_desc = node_data->socket_desc;
         fprintf(stdout, "%d, ", socket_desc);
-        current_node = current_node->next;
-        queue_size--;
+        current_node = __atomic_load_n(&current_node->next, __ATOMIC_ACQUIRE);
     }
     fprintf(stdout, "\n");
 }
 
+// Helper Function:    update_state
+// --------------------------------
+// Compare-and-swap on handler->state
+//
+// returns 1 if state still held expected and now holds desired, 0 otherwise
+// (expected is refreshed with the current state)
+static int update_state(file_handler_t *handler, unsigned int *expected, unsigned int desired)
+{
+    return __atomic_compare_exchange_n(&handler->state, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// Helper Function:    schedule_handler
+// ------------------------------------
+// Puts a handler on the pool's ready queue, waking a worker only if one is asleep
+// Caller must hold the handler's token
+void schedule_handler(file_handler_t *handler)
+{
+    pthread_mutex_lock(&worker_pool.lock);
+    push_queue(worker_pool.ready, handler);
+    if (worker_pool.idle > 0)
+        pthread_cond_signal(&worker_pool.cond);
+    pthread_mutex_unlock(&worker_pool.lock);
+}
+
+// Helper Function:    release_token
+// ---------------------------------
+// Lets go of a handler whose queue looks empty. A producer that pushes while
+// the token is being released flags HANDLER_PENDING instead of scheduling, and
+// the queue is checked again after HANDLER_RELEASING is visible, so a request
+// can't slip in unnoticed between the last pop and the release.
+// The handler must not be touched once this returns 1.
+//
+// handler:         handler whose token the caller holds
+//
+// returns 1 if the token was released, 0 if new requests arrived and the caller keeps it
+int release_token(file_handler_t *handler)
+{
+    __atomic_store_n(&handler->last_used, time(NULL), __ATOMIC_RELAXED);
+    __atomic_xor_fetch(&handler->state, HANDLER_TOKEN | HANDLER_RELEASING, __ATOMIC_SEQ_CST);
+    int arrived = peek_mpsc_queue(handler->request_queue) != NULL;
+
+    unsigned int state = __atomic_load_n(&handler->state, __ATOMIC_SEQ_CST);
+    unsigned int desired;
+    do
+    {
+        desired = state & ~(HANDLER_RELEASING | HANDLER_PENDING);
+        if (arrived || (state & HANDLER_PENDING))
+            desired |= HANDLER_TOKEN;
+    } while (!update_state(handler, &state, desired));
+
+    return !(desired & HANDLER_TOKEN);
+}
+
+// Helper Function:    pass_token
+// ------------------------------
+// Puts the handler back at the end of the ready queue if requests are waiting,
+// otherwise releases it
+//
+// handler:         handler whose token the caller holds
+void pass_token(file_handler_t *handler)
+{
+    if (peek_mpsc_queue(handler->request_queue) || !release_token(handler))
+        schedule_handler(handler);
+}
+
+// Helper Function:    conflicts
+// -----------------------------
+// Checks whether a request must wait for the requests already running
+//
+// state:           handler state
+// mode:            access mode of the request that wants to start
+//
+// returns 1 if it must wait, 0 if it may start
+static int conflicts(unsigned int state, access_mode_t mode)
+{
+    switch (mode)
+    {
+        case ACCESS_SHARED:
+            return 0;
+        case ACCESS_STAGED:
+            return (state & HANDLER_STAGER) != 0;
+        default:
+            return state >= HANDLER_READER || (state & HANDLER_STAGER);
+    }
+}
+
+// Helper Function:    park_until_clear
+// ------------------------------------
+// Called by the token holder when the front request may conflict with running
+// ones. Trades the token for HANDLER_PARKED if it does; whichever running
+// request finishes last takes the token back and reschedules the handler.
+//
+// handler:         handler whose token the caller holds
+// mode:            access mode of the front request
+//
+// returns 1 if the front request may start now, 0 if parked
+int park_until_clear(file_handler_t *handler, access_mode_t mode)
+{
+    unsigned int state = __atomic_load_n(&handler->state, __ATOMIC_SEQ_CST);
+    do
+    {
+        if (!conflicts(state, mode))
+            return 1;
+    } while (!update_state(handler, &state, (state & ~HANDLER_TOKEN) | HANDLER_PARKED));
+
+    return 0;
+}
+
+// Helper Function:    finish_request
+// ----------------------------------
+// Retires a shared or staged request, handing the token to a parked front
+// request that no longer conflicts with what is still running. While parked
+// nobody pops, so the front request can be read safely here.
+// The handler must not be touched after this unless it rescheduled it.
+//
+// handler:         handler the request ran on
+// running:         HANDLER_READER or HANDLER_STAGER, as counted when it started
+void finish_request(file_handler_t *handler, unsigned int running)
+{
+    __atomic_store_n(&handler->last_used, time(NULL), __ATOMIC_RELAXED);
+
+    unsigned int state = __atomic_load_n(&handler->state, __ATOMIC_SEQ_CST);
+    unsigned int desired;
+    do
+    {
+        desired = state - running;
+        if (desired & HANDLER_PARKED)
+        {
+            client_t *front = (client_t *)peek_mpsc_queue(handler->request_queue);
+            if (!conflicts(desired, front->mode))
+                desired = (desired & ~HANDLER_PARKED) | HANDLER_TOKEN;
+        }
+    } while (!update_state(handler, &state, desired));
+
+    if (!(state & HANDLER_TOKEN) && (desired & HANDLER_TOKEN))
+        schedule_handler(handler);
+}
+
 // Function:    make_request
 // -------------------------
 // Searches file_map for a file_handler_t with a matching filename
-// Creates a new one and pushes to file_map if none
+// Creates a new one and adds it to file_map if none, then queues the request
+// and schedules the handler on the worker pool if nobody holds its token
 //
 // filename:    requested filename
 // socket_desc: fd for client socket
-void make_request(char* filename, int socket_desc, request_handler_fn handler_fn)
+// mode:        ACCESS_SHARED for reads, ACCESS_STAGED for atomic replacements,
+//              ACCESS_EXCLUSIVE for in-place modifications
+// handler_fn:  process run by the file worker for this request
+// context:     request state passed through to handler_fn
+void make_request(char* filename, int socket_desc, access_mode_t mode, request_handler_fn handler_fn, void *context)
 {
-    // Lock access to global file map and retrieve it
-    pthread_mutex_lock(&global_map_lock);
-    file_handler_t *handler = map_get(filename);
+    // Lock only the stripe holding this file's bucket and look the handler up
+    uint64_t hash = hash_filename(filename);
+    pthread_mutex_t *stripe = map_stripe(hash);
+    pthread_mutex_lock(stripe);
+    file_handler_t *handler = map_get(filename, hash);
 
     // Create a new client
-    client_t *client = malloc(sizeof(client_t));
-    if (!client)
-    {
-        fprintf(stderr, "waitingroom.make_request: memory allocation failed for client_t for socket %d and file %s\n", socket_desc, filename);
-        exit(1);
-    }
+    client_t *client = slab_alloc(&client_slab);
     client->socket_desc = socket_desc;
+    client->mode = mode;
+    client->context = context;
 
     // If there isn't an existing corresponding handler, generate a new one
     if (!handler)
@@ -157,166 +295,373 @@ void make_request(char* filename, int socket_desc, request_handler_fn handler_fn
         if (!handler)
         {
             fprintf(stderr, "waitingroom.make_request: memory allocation failed for file_handler_t for %s\n", filename);
-            SAFE_FREE(client);
+            slab_free(&client_slab, client);
             exit(1);
         }
 
         // Generate fields
-        pthread_mutex_init(&handler->lock, NULL);
-        handler->request_queue = create_queue();
+        handler->request_queue = create_mpsc_queue();
         handler->filename = strdup(filename);
+        handler->hash = hash;
         handler->handler_fn = handler_fn;
+        handler->state = 0;
+        handler->last_used = time(NULL);
 
-        // Add handler to global file map
+        // Add handler to its file map bucket
         map_put(handler);
+        __atomic_add_fetch(&handler_stats.created, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&handler_stats.live, 1, __ATOMIC_RELAXED);
+    }
 
-#ifdef DEBUG
-        fprintf(stdout, "DEBUG waitingroom.make_request: socket %d added to existing handler for %s\n", socket_desc, filename);
-        fprintf(stdout, "DEBUG waitingroom.make_request: current requests queue for %s handler\n", filename);
-        print_requests(handler);
-#endif
-        // Add client to request queue
-        push_queue(handler->request_queue, client);
+    // Queue the request without taking any per-file lock
+    push_mpsc_queue(handler->request_queue, client);
 
-        // Create pthread and store thread ID
-        pthread_create(&handler->tid, NULL, file_worker, handler);
-    }
-    else // If there is already a matching file handler
+    // Take the token and wake the pool only if the handler was idle; a worker
+    // holding or releasing the token, or a parked writer, picks the request up itself
+    unsigned int state = __atomic_load_n(&handler->state, __ATOMIC_SEQ_CST);
+    unsigned int desired;
+    do
     {
-        // Lock access to the handler and add the request to the handler's request queue
-        pthread_mutex_lock(&handler->lock);
-        push_queue(handler->request_queue, client);
-        pthread_cond_signal(&handler->cond);
+        if (state & (HANDLER_TOKEN | HANDLER_PARKED))
+            break;
+        desired = state | ((state & HANDLER_RELEASING) ? HANDLER_PENDING : HANDLER_TOKEN);
+    } while (!update_state(handler, &state, desired));
+
+    if (!(state & (HANDLER_TOKEN | HANDLER_PARKED | HANDLER_RELEASING)))
+        schedule_handler(handler);
 
 #ifdef DEBUG
-        fprintf(stdout, "DEBUG waitingroom.make_request: socket %d added to handler for %s\n", socket_desc, filename);
-        fprintf(stdout, "DEBUG waitingroom.make_request: current requests queue for %s handler\n", filename);
-        print_requests(handler);
+    fprintf(stdout, "DEBUG waitingroom.make_request: socket %d added to handler for %s\n", socket_desc, filename);
 #endif
 
-        // Release the handler mutex
-        pthread_mutex_unlock(&handler->lock);
-    }
+    // Release the bucket stripe; reclamation can't retire the handler while it's held
+    pthread_mutex_unlock(stripe);
 
 #ifdef DEBUG
     fprintf(stdout, "DEBUG waitingroom.make_request: current file map contents\n");
     print_map();
 #endif
-
-    // Release the global file map mutex
-    pthread_mutex_unlock(&global_map_lock);
 }
 
 // Function:    file_worker
 // ------------------------
-// Iteratively processes clients in a handler's queue
-// Spawned whenever a new file is being handled
+// Pool worker: repeatedly takes a ready file handler and starts the request at
+// the front of its queue. A handler in the ready queue holds its token, and
+// only the token holder pops, so each file's requests start in FIFO order. A
+// shared request (GET) passes the token on before it runs, so the requests
+// queued behind it can start on other workers; a staged request (WRITE) does
+// the same once the previous staged request has finished; an exclusive
+// request (RM) parks until everything running has finished and keeps the
+// token while it runs. Passing the token puts the handler at the back of the ready queue,
+// which keeps one busy file from starving the others.
 // Sleeps for 10 seconds before parsing requests when in debug mode
 void *file_worker(void *arg)
 {
-    // Capture the file handler object, and pull active requests and worker function
-    file_handler_t *handler = (file_handler_t *)arg;
-    queue_t *requests = handler->request_queue;
-    request_handler_fn handler_process = handler->handler_fn;
-
-#ifdef DEBUG
-    pthread_mutex_lock(&global_map_lock);
-    fprintf(stdout, "DEBUG waitingroom.file_worker: entering file worker for %s, current file_map: \n", handler->filename);
-    print_map();
-    pthread_mutex_unlock(&global_map_lock);
-#endif
+    (void)arg;
 
     while (1) // Loop indefinitely
     {
-        // Lock mutex handler
-        pthread_mutex_lock(&handler->lock);
-
-        // If the file worker runs out of requests
-        while (get_queue_size(requests) == 0 && !shutdown_signal)
+        // Wait for a handler with pending work
+        pthread_mutex_lock(&worker_pool.lock);
+        while (get_queue_size(worker_pool.ready) == 0 && !shutdown_signal)
         {
-
-#ifdef DEBUG
-            fprintf(stdout, "DEBUG waitingroom.file_worker: requests queue depleted for %s\n", handler->filename);
-#endif
-
-            // Put the thread on hold until a signal to wake is provided
-            pthread_cond_wait(&handler->cond, &handler->lock);
+            worker_pool.idle++;
+            pthread_cond_wait(&worker_pool.cond, &worker_pool.lock);
+            worker_pool.idle--;
         }
 
         // Exit if shutting down and no more requests
-        if (shutdown_signal && get_queue_size(requests) == 0)
+        if (get_queue_size(worker_pool.ready) == 0)
         {
-            pthread_mutex_unlock(&handler->lock);
+            pthread_mutex_unlock(&worker_pool.lock);
             break;
         }
+        file_handler_t *handler = (file_handler_t *)pop_queue(worker_pool.ready);
+        pthread_mutex_unlock(&worker_pool.lock);
+
+        // Look at the oldest request for this file; an empty read means a push is still linking
+        client_t *req = (client_t *)peek_mpsc_queue(handler->request_queue);
+        if (!req)
+        {
+            if (!release_token(handler))
+                schedule_handler(handler);
+            continue;
+        }
 
-        // Pull most recent request
-        client_t *req = (client_t *)pop_queue(requests);
+        // Wait out conflicting requests; the last of them to finish reschedules the handler
+        access_mode_t mode = req->mode;
+        if (!park_until_clear(handler, mode))
+            continue;
+
+        pop_mpsc_queue(handler->request_queue);
+        request_handler_fn handler_process = handler->handler_fn;
 
 #ifdef DEBUG
-        fprintf(stdout, "DEBUG waitingroom.file_worker: processing socket %d request for file %s\n", req->socket_desc, handler->filename);
+        fprintf(stdout, "DEBUG waitingroom.file_worker: processing socket %d %s request for file %s\n", req->socket_desc,
+                mode == ACCESS_SHARED ? "shared" : mode == ACCESS_STAGED ? "staged" : "exclusive", handler->filename);
         fprintf(stdout, "DEBUG waitingroom.file_worker: remaining requests for %s: \n", handler->filename);
         print_requests(handler);
         sleep(10);
 #endif
 
-        // Release mutex handler and perform operation on released request
-        pthread_mutex_unlock(&handler->lock);
-        int result = handler_process(req->socket_desc);
+        // Count the request as running, then let the next one in line start alongside it
+        unsigned int running = mode == ACCESS_SHARED ? HANDLER_READER : HANDLER_STAGER;
+        if (mode != ACCESS_EXCLUSIVE)
+        {
+            __atomic_add_fetch(&handler->state, running, __ATOMIC_SEQ_CST);
+            pass_token(handler);
+        }
+
+        // Perform operation on released request
+        int result = handler_process(req->socket_desc, req->context);
 
         if (result) fprintf(stderr, "waitingroom.file_worker: operation failed\n");
 
         // Free request once completed
-        SAFE_FREE(req);
+        slab_free(&client_slab, req);
+
+        // Let whatever was waiting on this request start
+        if (mode != ACCESS_EXCLUSIVE)
+            finish_request(handler, running);
+        else
+            pass_token(handler);
+    }
+
+    return NULL;
+}
+
+// Helper Function:    destroy_handler
+// -----------------------------------
+// Frees a file handler that is no longer reachable from file_map
+void destroy_handler(file_handler_t *handler)
+{
+    // Destroy request queue, returning any stranded clients to their pool
+    void *client;
+    while ((client = pop_mpsc_queue(handler->request_queue)) != NULL)
+        slab_free(&client_slab, client);
+    destroy_mpsc_queue(handler->request_queue);
+
+    // Free remaining pointers
+    SAFE_FREE(handler->filename);
+    SAFE_FREE(handler);
+}
+
+// Function:    reclaim_idle_handlers
+// ----------------------------------
+// Retires handlers that have been idle for at least the TTL. A handler is only
+// retired while its stripe lock is held and it is not scheduled, running or holding
+// requests; make_request looks handlers up and queues onto them under that same
+// stripe lock, so a concurrent request either lands before the check (and the
+// handler is kept) or finds no handler and creates a fresh one.
+//
+// now:         current time
+//
+// returns number of handlers reclaimed
+int reclaim_idle_handlers(time_t now)
+{
+    int reclaimed = 0;
+
+    for (int stripe = 0; stripe < FILE_MAP_STRIPES; stripe++)
+    {
+        pthread_mutex_lock(&file_map.stripes[stripe]);
+        for (int bucket = stripe; bucket < FILE_MAP_BUCKETS; bucket += FILE_MAP_STRIPES)
+        {
+            file_handler_t **link = &file_map.buckets[bucket];
+            while (*link)
+            {
+                file_handler_t *handler = *link;
+
+                int idle = __atomic_load_n(&handler->state, __ATOMIC_SEQ_CST) == 0
+                           && peek_mpsc_queue(handler->request_queue) == NULL
+                           && now - __atomic_load_n(&handler->last_used, __ATOMIC_RELAXED) >= handler_ttl;
+
+                if (!idle)
+                {
+                    link = &handler->next;
+                    continue;
+                }
+
+                // Unlink, then free; with state 0 no worker holds or runs requests for it
+                *link = handler->next;
+                destroy_handler(handler);
+                reclaimed++;
+            }
+        }
+        pthread_mutex_unlock(&file_map.stripes[stripe]);
+    }
+
+    if (reclaimed)
+    {
+        __atomic_sub_fetch(&handler_stats.live, reclaimed, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&handler_stats.reclaimed, reclaimed, __ATOMIC_RELAXED);
+    }
+    return reclaimed;
+}
+
+// Function:    handler_reaper
+// ---------------------------
+// Background thread sweeping file_map for idle handlers until shutdown
+void *handler_reaper(void *arg)
+{
+    (void)arg;
+    int interval = handler_ttl < REAPER_INTERVAL ? handler_ttl : REAPER_INTERVAL;
+
+    pthread_mutex_lock(&worker_pool.lock);
+    while (!shutdown_signal)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval;
+        pthread_cond_timedwait(&reaper_cond, &worker_pool.lock, &deadline);
+        if (shutdown_signal)
+            break;
+
+        // Sweep without holding the pool lock
+        pthread_mutex_unlock(&worker_pool.lock);
+        time_t now = time(NULL);
+        int reclaimed = reclaim_idle_handlers(now);
+        if (reaper_task)
+            reaper_task(now);
+#ifdef DEBUG
+        if (reclaimed)
+            fprintf(stdout, "DEBUG waitingroom.handler_reaper: reclaimed %d idle handlers\n", reclaimed);
+#else
+        (void)reclaimed;
+#endif
+        pthread_mutex_lock(&worker_pool.lock);
     }
+    pthread_mutex_unlock(&worker_pool.lock);
 
     return NULL;
 }
 
+// Function:    set_reaper_task
+// ----------------------------
+// Has the reaper run a sweep of its own on every pass; set it before
+// waiting_room_init
+//
+// task:        sweep to run, NULL for none
+void set_reaper_task(reaper_task_fn task)
+{
+    reaper_task = task;
+}
+
+// Function:    get_handler_stats
+// ------------------------------
+// Copies the live/created/reclaimed handler counters
+void get_handler_stats(handler_stats_t *stats)
+{
+    stats->live = __atomic_load_n(&handler_stats.live, __ATOMIC_RELAXED);
+    stats->created = __atomic_load_n(&handler_stats.created, __ATOMIC_RELAXED);
+    stats->reclaimed = __atomic_load_n(&handler_stats.reclaimed, __ATOMIC_RELAXED);
+}
+
+// Function:    get_client_stats
+// -----------------------------
+// Copies the pool counters for client_t allocations
+void get_client_stats(slab_stats_t *stats)
+{
+    get_slab_stats(&client_slab, stats);
+}
+
 // Function:    waiting_room_init
 // ---------------------
-// Initializes file_map
-void waiting_room_init()
+// Initializes file_map and starts the worker pool and handler reaper
+//
+// workers:     number of pool threads, 0 for one per online core
+// ttl:         seconds an idle file handler is kept, 0 for HANDLER_IDLE_TTL
+void waiting_room_init(int workers, int ttl)
 {
-    file_map = create_queue();
-    pthread_mutex_init(&global_map_lock, NULL);
+    memset(file_map.buckets, 0, sizeof(file_map.buckets));
+    memset(&handler_stats, 0, sizeof(handler_stats));
+    handler_ttl = ttl > 0 ? ttl : HANDLER_IDLE_TTL;
+    for (int stripe = 0; stripe < FILE_MAP_STRIPES; stripe++)
+        pthread_mutex_init(&file_map.stripes[stripe], NULL);
     shutdown_signal = 0;
+
+    if (workers <= 0)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int)cores : 1;
+    }
+
+    // Start the pool
+    worker_pool.ready = create_queue();
+    worker_pool.idle = 0;
+    pthread_mutex_init(&worker_pool.lock, NULL);
+    pthread_cond_init(&worker_pool.cond, NULL);
+    worker_pool.threads = malloc(sizeof(pthread_t) * workers);
+    if (!worker_pool.threads)
+    {
+        fprintf(stderr, "waitingroom.waiting_room_init: memory allocation failed for %d workers\n", workers);
+        exit(1);
+    }
+    worker_pool.size = 0;
+    for (int i = 0; i < workers; i++)
+    {
+        if (pthread_create(&worker_pool.threads[i], NULL, file_worker, NULL) != 0)
+        {
+            fprintf(stderr, "waitingroom.waiting_room_init: unable to start worker %d\n", i);
+            break;
+        }
+        worker_pool.size++;
+    }
+    if (worker_pool.size == 0)
+        exit(1);
+
+    // Start the reaper
+    pthread_cond_init(&reaper_cond, NULL);
+    if (pthread_create(&reaper_tid, NULL, handler_reaper, NULL) != 0)
+    {
+        fprintf(stderr, "waitingroom.waiting_room_init: unable to start handler reaper\n");
+        exit(1);
+    }
 }
 
 // Function:    cleanup_waiting_room
 // --------------------------------
-// Destroys all threads indicated by file_map
+// Lets the pool finish queued requests, joins it and frees every file handler
 void cleanup_waiting_room(void)
 {
-    // Flag for shutdown
+    // Flag for shutdown and wake every idle worker
+    pthread_mutex_lock(&worker_pool.lock);
     shutdown_signal = 1;
-
-    // While there are remaining file threads
-    while(get_queue_size(file_map) != 0)
+    pthread_cond_broadcast(&worker_pool.cond); // Wake up babe, the shutdown flag was raised
+    pthread_cond_signal(&reaper_cond);
+    pthread_mutex_unlock(&worker_pool.lock);
+
+    // Stop the reaper before the handlers it walks are freed
+    pthread_join(reaper_tid, NULL);
+    pthread_cond_destroy(&reaper_cond);
+
+    // Safely join threads after releasing mutex
+    for (int i = 0; i < worker_pool.size; i++)
+        pthread_join(worker_pool.threads[i], NULL);
+    SAFE_FREE(worker_pool.threads);
+    worker_pool.size = 0;
+
+    // Walk every bucket, freeing each chain of file handlers
+    for (int bucket = 0; bucket < FILE_MAP_BUCKETS; bucket++)
     {
-        // Get file handler
-        file_handler_t *handler = (file_handler_t *)pop_queue(file_map);
-
-        // Terminate and join any active threads
-        pthread_mutex_lock(&handler->lock);
-        pthread_cond_signal(&handler->cond); // Wake up babe, the shutdown flag was raised
-        pthread_mutex_unlock(&handler->lock);
-
-        // Safely join threads after releasing mutex
-        pthread_join(handler->tid, NULL); // Join the threads
-
-        // Destroy mutex/conditional
-        pthread_mutex_destroy(&handler->lock);
-        pthread_cond_destroy(&handler->cond);
-
-        // Destroy request queue
-        destroy_queue(handler->request_queue);
+        pthread_mutex_t *stripe = &file_map.stripes[bucket % FILE_MAP_STRIPES];
+        pthread_mutex_lock(stripe);
+        file_handler_t *handler = file_map.buckets[bucket];
+        file_map.buckets[bucket] = NULL;
+        pthread_mutex_unlock(stripe);
 
-        // Free remaining pointers
-        SAFE_FREE(handler->filename);
-        SAFE_FREE(handler);
+        while (handler)
+        {
+            file_handler_t *next = handler->next;
+            destroy_handler(handler);
+            handler = next;
+        }
     }
 
-    SAFE_FREE(file_map);
-    pthread_mutex_destroy(&global_map_lock);
-}
\ No newline at end of file
+    for (int stripe = 0; stripe < FILE_MAP_STRIPES; stripe++)
+        pthread_mutex_destroy(&file_map.stripes[stripe]);
+
+    // Tear down the pool
+    destroy_queue(worker_pool.ready);
+    pthread_mutex_destroy(&worker_pool.lock);
+    pthread_cond_destroy(&worker_pool.cond);
+}